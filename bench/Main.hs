@@ -0,0 +1,181 @@
+-- | Benchmarks against a running sshd, configured with the environment:
+--
+-- * @SIMPLESSH_BENCH_HOST@ (127.0.0.1), @SIMPLESSH_BENCH_PORT@ (2222)
+-- * @SIMPLESSH_BENCH_USER@ (simplessh)
+-- * @SIMPLESSH_BENCH_KEY@, path to the private key, the public key being
+--   next to it with a @.pub@ extension (~/.ssh/id_rsa)
+-- * @SIMPLESSH_BENCH_RUNS@, number of runs of each measurement (3)
+--
+-- bench/sshd.sh starts such a server. The benchmarks to run (connect, exec,
+-- transfer, concurrency) can be given as arguments, all of them being run
+-- otherwise. Each measurement is printed as a JSON object on its own line.
+module Main (main) where
+
+import           Control.Concurrent
+import           Control.Exception (finally)
+import           Control.Monad
+import           Control.Monad.Trans
+
+import qualified Data.ByteString.Char8 as BS
+import           Data.List (intercalate, sort)
+import           Data.Time.Clock
+
+import           System.Environment
+import           System.Exit
+import           System.IO
+
+import           Text.Printf
+
+import           Network.SSH.Client.SimpleSSH
+
+data Config = Config
+  { configHost :: String
+  , configPort :: Integer
+  , configUser :: String
+  , configKey  :: FilePath
+  , configRuns :: Int
+  }
+
+getConfig :: IO Config
+getConfig = do
+  env <- getEnvironment
+  let get name def = maybe def id $ lookup name env
+      home         = get "HOME" "."
+  return Config
+    { configHost = get "SIMPLESSH_BENCH_HOST" "127.0.0.1"
+    , configPort = read $ get "SIMPLESSH_BENCH_PORT" "2222"
+    , configUser = get "SIMPLESSH_BENCH_USER" "simplessh"
+    , configKey  = get "SIMPLESSH_BENCH_KEY" (home ++ "/.ssh/id_rsa")
+    , configRuns = read $ get "SIMPLESSH_BENCH_RUNS" "3"
+    }
+
+benchSession :: Config -> (Session -> SimpleSSH a) -> SimpleSSH a
+benchSession config =
+  withSessionKey (configHost config) (configPort config) 10
+                 (configUser config) (configKey config ++ ".pub")
+                 (configKey config) ""
+
+orDie :: SimpleSSH a -> IO a
+orDie action = do
+  eRes <- runSimpleSSH action
+  case eRes of
+    Left err  -> hPutStrLn stderr ("Error: " ++ show err) >> exitFailure
+    Right res -> return res
+
+withBenchSession :: Config -> (Session -> SimpleSSH a) -> IO a
+withBenchSession config = orDie . benchSession config
+
+-- | Run an action a number of times and return the sorted durations.
+measure :: Int -> SimpleSSH a -> SimpleSSH [Double]
+measure runs action = fmap sort $ replicateM runs $ do
+  start <- liftIO getCurrentTime
+  _     <- action
+  end   <- liftIO getCurrentTime
+  return $ realToFrac $ diffUTCTime end start
+
+-- | Number of runs for measurements of tiny operations, which are noisier.
+manyRuns :: Config -> Int
+manyRuns config = 10 * configRuns config
+
+-- | Print a measurement as a JSON object.
+report :: String             -- ^ Benchmark
+       -> [(String, Int)]    -- ^ Parameters
+       -> Int                -- ^ Bytes transferred by each run, if any
+       -> [Double]           -- ^ Sorted durations in seconds
+       -> IO ()
+report name params bytes durations = do
+  putStrLn $ "{" ++ intercalate ", " fields ++ "}"
+  hFlush stdout
+  where
+    median = durations !! (length durations `div` 2)
+    fields = [printf "\"benchmark\": \"%s\"" name]
+          ++ [printf "\"%s\": %d" k v | (k, v) <- params]
+          ++ [ printf "\"runs\": %d" (length durations)
+             , printf "\"min_s\": %.6f" (head durations)
+             , printf "\"median_s\": %.6f" median
+             ]
+          ++ [ printf "\"mib_per_s\": %.2f"
+                 (fromIntegral bytes / 1048576 / median :: Double)
+             | bytes > 0 ]
+
+remotePath :: String
+remotePath = "/tmp/simplessh-bench"
+
+-- | Latency of a new session: connection, handshake and authentication.
+connect :: Config -> IO ()
+connect config = do
+  durations <- orDie $ withSimpleSSH $
+    measure (manyRuns config) $ benchSession config $ const $ return ()
+  report "connect" [] 0 durations
+
+-- | Round trip of a tiny command and throughput of a large stdout.
+exec :: Config -> IO ()
+exec config = withBenchSession config $ \session -> do
+  durations <- measure (manyRuns config) $ execCommand session "true"
+  liftIO $ report "exec_roundtrip" [] 0 durations
+
+  forM_ [1024 * 1024, 64 * 1024 * 1024] $ \size -> do
+    let command = "head -c " ++ show size ++ " /dev/zero"
+    durations' <- measure (configRuns config) $
+      execCommandWith defaultExecOptions { execSizeHint = size } session
+                      command
+    liftIO $ report "exec_stdout" [("size", size)] size durations'
+
+-- | Upload throughput across write sizes and download throughput across
+-- window sizes.
+transfer :: Config -> IO ()
+transfer config = withBenchSession config $ \session ->
+  forM_ [1024 * 1024, 64 * 1024 * 1024] $ \size -> do
+    let payload = BS.replicate size 'x'
+
+    forM_ [4, 16, 32, 64, 256, 1024] $ \chunk -> do
+      setTransferOptions session
+        defaultTransferOptions { transferChunkSize = chunk * 1024 }
+      durations <- measure (configRuns config) $
+        sendFile session 0o644 payload remotePath
+      liftIO $ report "scp_upload" [("size", size), ("chunk", chunk * 1024)]
+                      size durations
+
+    forM_ [256, 2048, 8192, 32768] $ \window -> do
+      setTransferOptions session
+        defaultTransferOptions { transferWindowSize = window * 1024 }
+      durations <- measure (configRuns config) $
+        receiveFile session remotePath (remotePath ++ ".local")
+      liftIO $ report "scp_download"
+                      [("size", size), ("window", window * 1024)]
+                      size durations
+
+-- | Tiny commands on many sessions at once, one thread each, the duration
+-- being the time for all of them to be done.
+concurrency :: Config -> IO ()
+concurrency config = orDie $ withSimpleSSH $ lift $
+  forM_ [1, 4, 16, 64] $ \sessions -> do
+    let commands = 20
+    durations <- orDie $ measure (configRuns config) $ lift $ do
+      done <- replicateM sessions newEmptyMVar
+      forM_ done $ \var -> forkIO $
+        orDie (benchSession config $ \session ->
+                 replicateM_ commands $ execCommand session "true")
+          `finally` putMVar var ()
+      mapM_ takeMVar done
+    report "concurrency" [("sessions", sessions), ("commands", commands)]
+           0 durations
+
+benchmarks :: [(String, Config -> IO ())]
+benchmarks =
+  [ ("connect",     connect)
+  , ("exec",        exec)
+  , ("transfer",    transfer)
+  , ("concurrency", concurrency)
+  ]
+
+main :: IO ()
+main = do
+  config <- getConfig
+  names  <- getArgs
+  forM_ (if null names then map fst benchmarks else names) $ \name ->
+    case lookup name benchmarks of
+      Just benchmark -> benchmark config
+      Nothing -> do
+        hPutStrLn stderr $ "Unknown benchmark: " ++ name
+        exitFailure
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Start an unprivileged OpenSSH server for the benchmarks and print the
+# environment to run them with, e.g.
+#
+#   eval "$(bench/sshd.sh)" && cabal bench
+#
+# The server accepts the current user with a key generated next to its
+# configuration, listens on $SIMPLESSH_BENCH_PORT (2222) and runs until
+# `kill $(cat $dir/sshd.pid)`.
+set -e
+
+port=${SIMPLESSH_BENCH_PORT:-2222}
+dir=${SIMPLESSH_BENCH_DIR:-${TMPDIR:-/tmp}/simplessh-bench-sshd}
+sshd=$(command -v sshd || echo /usr/sbin/sshd)
+
+mkdir -p "$dir"
+[ -f "$dir/host_key" ] || ssh-keygen -q -t ed25519 -N "" -f "$dir/host_key"
+[ -f "$dir/id_rsa" ]   || ssh-keygen -q -t rsa -b 3072 -m PEM -N "" \
+                                     -f "$dir/id_rsa"
+cp "$dir/id_rsa.pub" "$dir/authorized_keys"
+chmod 600 "$dir/authorized_keys"
+
+cat > "$dir/sshd_config" <<CONFIG
+Port $port
+ListenAddress 127.0.0.1
+HostKey $dir/host_key
+PidFile $dir/sshd.pid
+AuthorizedKeysFile $dir/authorized_keys
+PasswordAuthentication no
+KbdInteractiveAuthentication no
+UsePAM no
+StrictModes no
+MaxSessions 256
+MaxStartups 256
+CONFIG
+
+"$sshd" -f "$dir/sshd_config" -E "$dir/sshd.log"
+
+echo "export SIMPLESSH_BENCH_HOST=127.0.0.1"
+echo "export SIMPLESSH_BENCH_PORT=$port"
+echo "export SIMPLESSH_BENCH_USER=$(id -un)"
+echo "export SIMPLESSH_BENCH_KEY=$dir/id_rsa"
@@ -8,9 +8,16 @@
 #include <errno.h>
 #include <poll.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include <libssh2.h>
 #include <simplessh.h>
+#include <simplessh/connect.h>
+#include <simplessh/forward.h>
+#include <simplessh/keyfile.h>
+#include <simplessh/knownhosts.h>
+#include <simplessh/stats.h>
+#include <simplessh/trace.h>
 
 #define returnError(either, err) { \
   struct simplessh_either *tmp = (either); \
@@ -23,142 +30,536 @@ inline int min(int a, int b) {
   return a < b ? a : b;
 }
 
-static int waitsocket(int socket_fd, LIBSSH2_SESSION *session) {
-  struct timeval timeout;
-  int rc;
-  fd_set fd;
-  fd_set *writefd = NULL;
-  fd_set *readfd = NULL;
-  int dir;
-
-  timeout.tv_sec = 10;
-  timeout.tv_usec = 0;
+static int wait_ready(struct simplessh_session *session) {
+  struct pollfd pollfd;
+  int rc, dir, next, slice, remaining = session->timeout, unanswered = 0;
 
-  FD_ZERO(&fd);
-  FD_SET(socket_fd, &fd);
+  pollfd.fd      = session->sock;
+  pollfd.events  = 0;
+  pollfd.revents = 0;
 
   /* now make sure we wait in the correct direction */
-  dir = libssh2_session_block_directions(session);
+  dir = libssh2_session_block_directions(session->lsession);
+
+  if(dir & LIBSSH2_SESSION_BLOCK_INBOUND)  pollfd.events |= POLLIN;
+  if(dir & LIBSSH2_SESSION_BLOCK_OUTBOUND) pollfd.events |= POLLOUT;
+  if(pollfd.events == 0) pollfd.events = POLLIN;
+
+  for(;;) {
+    next = simplessh_keepalive_tick(session);
+    if(next < 0) return -1;
+    slice = next > 0 && (remaining < 0 || next < remaining) ? next : remaining;
 
-  if(dir & LIBSSH2_SESSION_BLOCK_INBOUND) readfd = &fd;
-  if(dir & LIBSSH2_SESSION_BLOCK_OUTBOUND) writefd = &fd;
+    do {
+      rc = poll(&pollfd, 1, slice);
+    } while(rc == -1 && errno == EINTR);
 
-  rc = select(socket_fd + 1, readfd, writefd, NULL, &timeout);
+    if(rc != 0 || slice == remaining) return rc;
+    if(remaining > 0) remaining -= slice;
+    if(session->keepalive_count_max > 0 &&
+       ++unanswered > session->keepalive_count_max)
+      return 0;
+  }
+}
+
+/* Wait until the socket is ready in the direction libssh2 is blocked on.
+ *
+ * When keepalives are enabled, they are sent while waiting and the wait
+ * gives up early once `keepalive_count_max` of them went by without the
+ * socket getting ready, the connection being considered dead.
+ *
+ * Returns a positive value when the socket is ready, 0 when the session's
+ * timeout expired or the connection is dead and -1 on error. */
+int simplessh_waitsocket(struct simplessh_session *session) {
+  int rc;
+
+  simplessh_stats_wait_begin(session);
+  rc = wait_ready(session);
+  simplessh_stats_wait_end(session);
   return rc;
 }
 
-inline int get_socket(const char *hostname, uint16_t port, int timeout) {
-  struct addrinfo hints;
-  memset(&hints, 0, sizeof(struct addrinfo));
-  hints.ai_family   = AF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
-  hints.ai_flags    = AI_NUMERICSERV;
-  hints.ai_protocol = 0;
+/* Send a keepalive if one is due. Returns the time in milliseconds until the
+ * next one, 0 if keepalives are disabled and -1 if the connection failed. */
+int simplessh_keepalive_tick(struct simplessh_session *session) {
+  int rc, next;
 
-  struct addrinfo *res = NULL;
-  char service[6]; // enough to contain a port number
-  snprintf(service, 6, "%i", port);
-  int rc = getaddrinfo(hostname, service, &hints, &res);
-  if(rc != 0) {
-    if(res) freeaddrinfo(res);
-    return -1;
-  }
+  if(session->keepalive_interval <= 0) return 0;
 
-  struct addrinfo *current;
-  int sock;
-  for(current = res; current != NULL; current = current->ai_next) {
-    do {
-      sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-      fcntl(sock, F_SETFL, O_NONBLOCK);
-    } while(sock == -1 && errno == EINTR);
-    if(sock == -1) continue;
+  rc = libssh2_keepalive_send(session->lsession, &next);
+  if(rc && rc != LIBSSH2_ERROR_EAGAIN) return -1;
+  return (next > 0 ? next : session->keepalive_interval) * 1000;
+}
 
-    rc = connect(sock, res->ai_addr, res->ai_addrlen);
+/* Send keepalives every `interval` seconds while waiting on the socket, 0
+ * disabling them. After `count_max` of them without an answer, 0 meaning no
+ * limit, the connection is considered dead. */
+void simplessh_set_keepalive(struct simplessh_session *session,
+                             int interval,
+                             int count_max) {
+  session->keepalive_interval  = interval > 0 ? interval : 0;
+  session->keepalive_count_max = count_max;
+  libssh2_keepalive_config(session->lsession, 1, session->keepalive_interval);
+}
 
-    struct pollfd pollfd;
-    pollfd.fd     = sock;
-    pollfd.events = POLLIN;
+/* Wait up to `timeout` milliseconds for the peer to send something.
+ * Returns 1 if data is waiting, 0 if nothing came and -1 if the connection
+ * was closed or failed. */
+static int peer_readable(struct simplessh_session *session, int timeout) {
+  struct pollfd pollfd;
+  char c;
+  int rc;
 
-    rc = poll(&pollfd, 1, timeout * 1000);
+  pollfd.fd      = session->sock;
+  pollfd.events  = POLLIN;
+  pollfd.revents = 0;
 
-    if (rc == 0 || rc == -1) goto end_loop;
+  do {
+    rc = poll(&pollfd, 1, timeout);
+  } while(rc == -1 && errno == EINTR);
 
-    if(pollfd.revents & (POLLIN | POLLPRI)) {
-      freeaddrinfo(res);
-      __auto_type flags = fcntl(sock, F_GETFL);
-      fcntl(sock, F_SETFL, flags & (~O_NONBLOCK));
-      return sock;
-    }
+  if(rc == -1 || pollfd.revents & (POLLERR | POLLHUP | POLLNVAL)) return -1;
+  if(rc == 0) return 0;
 
-    end_loop:
-    close(sock);
-  }
+  do {
+    rc = recv(session->sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  } while(rc == -1 && errno == EINTR);
 
-  freeaddrinfo(res);
+  if(rc == 1) return 1;
+  if(rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
   return -1;
 }
 
-struct simplessh_either *simplessh_open_session(
+/* Health check: the peer must not have closed the connection and must
+ * answer a keepalive, or send anything else, within the timeout of the
+ * session capped to SIMPLESSH_ALIVE_WAIT. The answer is left for libssh2 to
+ * read. Returns 1 if the session is alive. */
+int simplessh_session_alive(struct simplessh_session *session) {
+  int rc, next, wait;
+
+  // Anything already waiting shows the peer is there
+  rc = peer_readable(session, 0);
+  if(rc != 0) return rc > 0;
+
+  // Send one now, unless something was sent within the last second
+  libssh2_keepalive_config(session->lsession, 1, 1);
+  rc = libssh2_keepalive_send(session->lsession, &next);
+  /* Restored even when keepalive_interval is 0, on purpose: the interval of
+   * 0 turns the keepalives of libssh2 back off. */
+  libssh2_keepalive_config(session->lsession, 1, session->keepalive_interval);
+  if(rc && rc != LIBSSH2_ERROR_EAGAIN) return 0;
+
+  wait = session->timeout >= 0 && session->timeout < SIMPLESSH_ALIVE_WAIT
+    ? session->timeout : SIMPLESSH_ALIVE_WAIT;
+  return peer_readable(session, wait) > 0;
+}
+
+/* libssh2_init and libssh2_exit set up and tear down the global state of the
+ * crypto backend and are not thread-safe. They are reference counted here
+ * under a lock, every session holding a reference. Holding one for the whole
+ * life of the program with simplessh_init keeps the state from being torn
+ * down and set up again whenever no session is open. */
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static int init_count = 0;
+
+int simplessh_init(void) {
+  int rc = 0;
+
+  pthread_mutex_lock(&init_lock);
+  if(init_count == 0) rc = libssh2_init(0);
+  if(rc == 0) init_count++;
+  pthread_mutex_unlock(&init_lock);
+
+  return rc ? INIT : 0;
+}
+
+void simplessh_exit(void) {
+  pthread_mutex_lock(&init_lock);
+  if(init_count > 0 && --init_count == 0) libssh2_exit();
+  pthread_mutex_unlock(&init_lock);
+}
+
+/* Allocate a session with a nonblocking libssh2 session which is yet to be
+ * connected. `lsession` is NULL if libssh2 could not allocate it. */
+struct simplessh_session *simplessh_session_new(int timeout) {
+  struct simplessh_session *session;
+  int rc;
+
+  rc = simplessh_init();
+
+  session = malloc(sizeof(struct simplessh_session));
+  session->lsession = NULL;
+  session->sock     = -1;
+  session->timeout  = timeout;
+  session->opening  = NULL;
+  session->chunk_size  = SIMPLESSH_DEFAULT_CHUNK_SIZE;
+  session->window_size = LIBSSH2_CHANNEL_WINDOW_DEFAULT;
+  session->packet_size = LIBSSH2_CHANNEL_PACKET_DEFAULT;
+  session->resolve_time = 0;
+  session->connect_time = 0;
+  session->keepalive_interval  = 0;
+  session->keepalive_count_max = 0;
+  session->hostname    = NULL;
+  session->port        = 0;
+  session->known_hosts = NULL;
+  session->accept_new  = 0;
+  session->agent       = NULL;
+  session->identity    = NULL;
+  simplessh_arena_init(&session->arena);
+  memset(&session->stats, 0, sizeof(struct simplessh_stats));
+  session->trace = NULL;
+
+  /* A session holds a reference as long as it has a libssh2 session, the
+   * reference being given back by simplessh_close_session. */
+  if(rc == 0) {
+    session->lsession = libssh2_session_init();
+    if(session->lsession == NULL) simplessh_exit();
+  }
+
+  if(session->lsession != NULL) {
+    libssh2_session_set_blocking(session->lsession, 0);
+    libssh2_session_set_timeout(session->lsession, timeout);
+  }
+
+  return session;
+}
+
+/* Nonblocking interface
+ *
+ * The step functions never wait on the socket. They return 0 when done,
+ * LIBSSH2_ERROR_EAGAIN when they must be called again once the socket is
+ * ready in the directions given by simplessh_block_directions, or an error.
+ * This lets the caller wait with its own event loop. The blocking functions
+ * are the same steps wrapped in waitLoop. */
+
+#define stepStatus(rc, err) \
+  ((rc) == LIBSSH2_ERROR_EAGAIN ? (rc) : (rc) ? (err) : 0)
+
+int simplessh_get_socket(struct simplessh_session *session) {
+  return session->sock;
+}
+
+int simplessh_block_directions(struct simplessh_session *session) {
+  return libssh2_session_block_directions(session->lsession);
+}
+
+int simplessh_get_timeout(struct simplessh_session *session) {
+  return session->timeout;
+}
+
+int simplessh_get_keepalive_count_max(struct simplessh_session *session) {
+  return session->keepalive_count_max;
+}
+
+/* The algorithm negotiated for one of the LIBSSH2_METHOD_* types, NULL
+ * before the handshake. */
+const char *simplessh_get_method(struct simplessh_session *session,
+                                 int method) {
+  return libssh2_session_methods(session->lsession, method);
+}
+
+// Time spent resolving and connecting in microseconds
+void simplessh_get_connect_timing(struct simplessh_session *session,
+                                  int64_t *resolve_time,
+                                  int64_t *connect_time) {
+  *resolve_time = session->resolve_time;
+  *connect_time = session->connect_time;
+}
+
+/* Connect to the server, the next step being simplessh_handshake_step. */
+struct simplessh_either *simplessh_connect(
     const char *hostname,
     uint16_t port,
     int timeout) {
-  struct simplessh_either *either;
+  return simplessh_connect_with(hostname, port, timeout, NULL);
+}
+
+static int method_pref(struct simplessh_session *session,
+                       int method,
+                       const char *prefs) {
+  return prefs == NULL ? 0
+    : libssh2_session_method_pref(session->lsession, method, prefs);
+}
+
+/* Set the algorithm preferences before the handshake. Returns HANDSHAKE when
+ * none of the algorithms of a list is supported by libssh2. */
+static int set_methods(struct simplessh_session *session,
+                       const struct simplessh_options *options) {
+  if(method_pref(session, LIBSSH2_METHOD_KEX, options->kex) ||
+     method_pref(session, LIBSSH2_METHOD_HOSTKEY, options->hostkey) ||
+     method_pref(session, LIBSSH2_METHOD_CRYPT_CS, options->ciphers) ||
+     method_pref(session, LIBSSH2_METHOD_CRYPT_SC, options->ciphers) ||
+     method_pref(session, LIBSSH2_METHOD_MAC_CS, options->macs) ||
+     method_pref(session, LIBSSH2_METHOD_MAC_SC, options->macs))
+    return HANDSHAKE;
+
+  if(options->compress &&
+     libssh2_session_flag(session->lsession, LIBSSH2_FLAG_COMPRESS, 1))
+    return HANDSHAKE;
+
+  return 0;
+}
+
+// Version of simplessh_connect with options, NULL for the defaults
+struct simplessh_either *simplessh_connect_with(
+    const char *hostname,
+    uint16_t port,
+    int timeout,
+    const struct simplessh_options *options) {
   struct simplessh_session *session;
-  char *hostkey;
-  int hostkey_type, rc;
-  size_t hostkey_len;
+  int64_t start;
+  int rc = 0;
 
-  libssh2_init(0);
+  session = simplessh_session_new(timeout * 1000);
+  session->hostname = strdup(hostname);
+  session->port     = port;
 
-  #define returnLocalErrorSP(err) { \
-    simplessh_close_session(session); \
-    returnError(either, (err)); \
+  /* Loading or refreshing the known hosts here keeps the handshake step, and
+   * so the check, from ever reading the file. */
+  if(options != NULL && options->known_hosts != NULL) {
+    session->known_hosts = simplessh_knownhosts_get(options->known_hosts);
+    session->accept_new  = options->accept_new;
+    if(session->known_hosts == NULL) rc = KNOWNHOSTS_INIT;
   }
 
-  // Empty simplessh_session
-  session = malloc(sizeof(struct simplessh_session));
-  session->lsession = NULL;
+  if(!rc && options != NULL && options->stats) {
+    simplessh_stats_enable(session);
+    simplessh_stamp(session, session->stats.started);
+  }
 
-  // Empty simplessh_either
-  either = malloc(sizeof(struct simplessh_either));
-  either->side    = RIGHT;
-  either->u.value = session;
+  if(!rc && options != NULL && options->trace > 0 &&
+     simplessh_trace_sampled(options->trace_sample)) {
+    simplessh_trace_enable(session, options->trace, options->trace_libssh2);
+    if(session->trace != NULL)
+      simplessh_trace_emit(session->trace, TRACE_CONNECT, NULL, port,
+                           hostname, strlen(hostname));
+  }
 
-  // Connection initialisation
-  session->sock = get_socket(hostname, port, timeout);
-  if(session->sock == -1) returnError(either, CONNECT);
+  if(!rc) {
+    if(options != NULL && options->jump != NULL) {
+      start = simplessh_now_us();
+      session->sock = simplessh_jump_connect(options->jump, hostname, port,
+                                             timeout * 1000);
+      session->connect_time = simplessh_now_us() - start;
+    } else {
+      session->sock = simplessh_connect_socket(hostname, port, timeout * 1000,
+                                              options ? &options->socket
+                                                      : NULL,
+                                              &session->resolve_time,
+                                              &session->connect_time);
+    }
+    if(session->stats.enabled) {
+      session->stats.resolved  = session->stats.started + session->resolve_time;
+      session->stats.connected = simplessh_now_us();
+    }
 
-  session->lsession = libssh2_session_init();
-  if(!session) returnLocalErrorSP(INIT);
+    if(session->sock == -1) rc = CONNECT;
+    else if(session->lsession == NULL) rc = INIT;
+    else if(options != NULL) {
+      simplessh_set_keepalive(session, options->keepalive_interval,
+                              options->keepalive_count_max);
+      rc = set_methods(session, options);
+    }
+    simplessh_trace(session, TRACE_CONNECTED, NULL, rc);
+  }
 
-  libssh2_session_set_blocking(session->lsession, 0);
-  libssh2_session_set_timeout(session->lsession, timeout * 1000);
+  if(rc) {
+    simplessh_close_session(session);
+    return simplessh_either_new(rc, NULL);
+  }
 
-  while((rc = libssh2_session_handshake(session->lsession, session->sock)) == LIBSSH2_ERROR_EAGAIN);
-  if(rc) returnLocalErrorSP(HANDSHAKE);
+  return simplessh_either_new(0, session);
+}
 
-  return either;
+static int check_hostkey(struct simplessh_session *session) {
+  const char *hostkey;
+  size_t hostkey_len;
+  int hostkey_type;
+
+  hostkey = libssh2_session_hostkey(session->lsession, &hostkey_len,
+                                    &hostkey_type);
+  if(hostkey == NULL) return KNOWNHOSTS_HOSTKEY;
+
+  switch(simplessh_knownhosts_check(session->known_hosts, session->hostname,
+                                    session->port, hostkey, hostkey_len,
+                                    hostkey_type)) {
+  case KNOWNHOST_MATCH:    return 0;
+  case KNOWNHOST_NOTFOUND: return session->accept_new ? 0 : KNOWNHOSTS_CHECK;
+  default:                 return KNOWNHOSTS_CHECK;
+  }
 }
 
-struct simplessh_either *simplessh_authenticate_password(
+/* The host key is checked as soon as the key exchange is over, before
+ * anything is sent to the server, when the session has known hosts. */
+int simplessh_handshake_step(struct simplessh_session *session) {
+  int rc = libssh2_session_handshake(session->lsession, session->sock);
+  if(rc == 0 && session->known_hosts != NULL) rc = check_hostkey(session);
+  else rc = stepStatus(rc, HANDSHAKE);
+  if(rc == 0) simplessh_stamp(session, session->stats.handshaken);
+  if(rc != LIBSSH2_ERROR_EAGAIN)
+    simplessh_trace(session, TRACE_HANDSHAKE, NULL, rc);
+  return rc;
+}
+
+static void auth_begin(struct simplessh_session *session) {
+  if(session->stats.auth_started == 0)
+    simplessh_stamp(session, session->stats.auth_started);
+}
+
+static int auth_status(struct simplessh_session *session, int rc) {
+  rc = stepStatus(rc, AUTHENTICATION);
+  if(rc == 0) simplessh_stamp(session, session->stats.authenticated);
+  if(rc != LIBSSH2_ERROR_EAGAIN)
+    simplessh_trace(session, TRACE_AUTH, NULL, rc);
+  return rc;
+}
+
+int simplessh_authenticate_password_step(
     struct simplessh_session *session,
     const char *username,
     const char *password) {
   int rc;
-  struct simplessh_either *either = malloc(sizeof(struct simplessh_either));
 
-  while((rc = libssh2_userauth_password(session->lsession, username, password)) == LIBSSH2_ERROR_EAGAIN);
+  auth_begin(session);
+  rc = libssh2_userauth_password(session->lsession, username, password);
+  return auth_status(session, rc);
+}
+
+int simplessh_authenticate_key_step(
+    struct simplessh_session *session,
+    const char *username,
+    const char *public_key_path,
+    const char *private_key_path,
+    const char *passphrase) {
+  int rc;
+
+  auth_begin(session);
+  rc = libssh2_userauth_publickey_fromfile(session->lsession, username,
+                                           public_key_path, private_key_path,
+                                           passphrase);
+  return auth_status(session, rc);
+}
+
+int simplessh_authenticate_memory_step(
+    struct simplessh_session *session,
+    const char *username,
+    const char *public_key,
+    int public_key_len,
+    const char *private_key,
+    int private_key_len,
+    const char *passphrase) {
+  int rc;
+
+  auth_begin(session);
+  rc = libssh2_userauth_publickey_frommemory(session->lsession, username,
+                                             strlen(username),
+                                             public_key, public_key_len,
+                                             private_key, private_key_len,
+                                             passphrase);
+  return auth_status(session, rc);
+}
+
+int simplessh_authenticate_key_handle_step(
+    struct simplessh_session *session,
+    const char *username,
+    const struct simplessh_key *key) {
+  return simplessh_authenticate_memory_step(session, username,
+                                            key->public_key,
+                                            key->public_key_len,
+                                            key->private_key,
+                                            key->private_key_len,
+                                            key->passphrase);
+}
+
+static void agent_free(struct simplessh_session *session) {
+  libssh2_agent_disconnect(session->agent);
+  libssh2_agent_free(session->agent);
+  session->agent    = NULL;
+  session->identity = NULL;
+}
+
+/* Try the identities of the agent at SSH_AUTH_SOCK one after the other. The
+ * agent is connected to and listed on the first call, those being local
+ * exchanges, and the state is kept in the session between calls. */
+int simplessh_authenticate_agent_step(struct simplessh_session *session,
+                                      const char *username) {
+  int rc;
+
+  auth_begin(session);
+  if(session->agent == NULL) {
+    session->agent = libssh2_agent_init(session->lsession);
+    if(session->agent == NULL) return AUTHENTICATION;
+
+    if(libssh2_agent_connect(session->agent) ||
+       libssh2_agent_list_identities(session->agent) ||
+       libssh2_agent_get_identity(session->agent, &session->identity, NULL)) {
+      agent_free(session);
+      return AUTHENTICATION;
+    }
+  }
+
+  for(;;) {
+    rc = libssh2_agent_userauth(session->agent, username, session->identity);
+    if(rc == LIBSSH2_ERROR_EAGAIN) return rc;
+    if(rc == 0) break;
+
+    if(libssh2_agent_get_identity(session->agent, &session->identity,
+                                  session->identity)) {
+      rc = AUTHENTICATION;
+      break;
+    }
+  }
+
+  agent_free(session);
+  return auth_status(session, rc);
+}
+
+struct simplessh_either *simplessh_open_session(
+    const char *hostname,
+    uint16_t port,
+    int timeout) {
+  return simplessh_open_session_with(hostname, port, timeout, NULL);
+}
+
+struct simplessh_either *simplessh_open_session_with(
+    const char *hostname,
+    uint16_t port,
+    int timeout,
+    const struct simplessh_options *options) {
+  struct simplessh_either *either;
+  struct simplessh_session *session;
+  int rc;
+
+  either = simplessh_connect_with(hostname, port, timeout, options);
+  if(either->side == LEFT) return either;
+  session = either->u.value;
+
+  waitLoop(session, rc, simplessh_handshake_step(session));
   if(rc) {
-    either->side    = LEFT;
-    either->u.error = AUTHENTICATION;
-  } else {
-    either->side    = RIGHT;
-    either->u.value = session;
+    simplessh_close_session(session);
+    returnError(either, rc == LIBSSH2_ERROR_TIMEOUT ? TIMEOUT : rc);
   }
 
   return either;
 }
 
+static struct simplessh_either *auth_either(struct simplessh_session *session,
+                                            int rc) {
+  return simplessh_either_new(rc == LIBSSH2_ERROR_TIMEOUT ? TIMEOUT : rc,
+                              session);
+}
+
+struct simplessh_either *simplessh_authenticate_password(
+    struct simplessh_session *session,
+    const char *username,
+    const char *password) {
+  int rc;
+
+  waitLoop(session, rc,
+           simplessh_authenticate_password_step(session, username, password));
+  return auth_either(session, rc);
+}
+
 struct simplessh_either *simplessh_authenticate_key(
     struct simplessh_session *session,
     const char *username,
@@ -166,18 +567,11 @@ struct simplessh_either *simplessh_authenticate_key(
     const char *private_key_path,
     const char *passphrase) {
   int rc;
-  struct simplessh_either *either = malloc(sizeof(struct simplessh_either));
 
-  while((rc = libssh2_userauth_publickey_fromfile(session->lsession, username, public_key_path, private_key_path, passphrase)) == LIBSSH2_ERROR_EAGAIN);
-  if(rc) {
-    either->side    = LEFT;
-    either->u.error = AUTHENTICATION;
-  } else {
-    either->side    = RIGHT;
-    either->u.value = session;
-  }
-
-  return either;
+  waitLoop(session, rc,
+           simplessh_authenticate_key_step(session, username, public_key_path,
+                                           private_key_path, passphrase));
+  return auth_either(session, rc);
 }
 
 struct simplessh_either *simplessh_authenticate_memory(
@@ -189,166 +583,851 @@ struct simplessh_either *simplessh_authenticate_memory(
     int private_key_len,
     const char *passphrase) {
   int rc;
-  struct simplessh_either *either = malloc(sizeof(struct simplessh_either));
 
-  while((rc = libssh2_userauth_publickey_frommemory(session->lsession, username, strlen(username), public_key, public_key_len, private_key, private_key_len, passphrase)) == LIBSSH2_ERROR_EAGAIN);
-  if(rc) {
-    either->side    = LEFT;
-    either->u.error = AUTHENTICATION;
-  } else {
-    either->side    = RIGHT;
-    either->u.value = session;
-  }
+  waitLoop(session, rc,
+           simplessh_authenticate_memory_step(session, username,
+                                              public_key, public_key_len,
+                                              private_key, private_key_len,
+                                              passphrase));
+  return auth_either(session, rc);
+}
 
-  return either;
+struct simplessh_either *simplessh_authenticate_key_handle(
+    struct simplessh_session *session,
+    const char *username,
+    const struct simplessh_key *key) {
+  int rc;
+
+  waitLoop(session, rc,
+           simplessh_authenticate_key_handle_step(session, username, key));
+  return auth_either(session, rc);
 }
 
-struct simplessh_either *simplessh_exec_command(
+struct simplessh_either *simplessh_authenticate_agent(
     struct simplessh_session *session,
-    const char *command) {
-  struct simplessh_either *either;
-  struct simplessh_result *result;
-  LIBSSH2_CHANNEL *channel;
-  int rc, rc2;
-  char *out = NULL;
-  char *err = NULL;
-
-  // Empty result
-  result = malloc(sizeof(struct simplessh_result));
-  result->out = NULL;
-  result->err = NULL;
-  result->exit_code   = 127;
-  result->exit_signal = NULL;
-
-  // Empty either
-  either = malloc(sizeof(struct simplessh_either));
-  either->side    = RIGHT;
-  either->u.value = result;
+    const char *username) {
+  int rc;
+
+  waitLoop(session, rc, simplessh_authenticate_agent_step(session, username));
+  if(rc && session->agent != NULL) agent_free(session);
+  return auth_either(session, rc);
+}
+
+static char *read_file(const char *path, size_t *len, int *error) {
+  struct stat st;
+  char *data;
+  ssize_t n;
+  int fd;
 
-  #define returnLocalErrorC(error) { \
-    if(out != NULL) free(out); \
-    if(err != NULL) free(err); \
-    free(result); \
-    returnError(either, (error)); \
+  *len = 0;
+  fd = open(path, O_RDONLY);
+  if(fd == -1) {
+    *error = FILEOPEN;
+    return NULL;
   }
 
-  while((channel = libssh2_channel_open_session(session->lsession)) == NULL) {
-    if(libssh2_session_last_errno(session->lsession) == LIBSSH2_ERROR_EAGAIN)
-      waitsocket(session->sock, session->lsession);
-    else
-      returnLocalErrorC(CHANNEL_OPEN);
+  if(fstat(fd, &st) == -1) {
+    close(fd);
+    *error = READ;
+    return NULL;
   }
 
-  // Send the command
-  while((rc = libssh2_channel_exec(channel, command)) != 0) {
-    if(rc == LIBSSH2_ERROR_EAGAIN) {
-      waitsocket(session->sock, session->lsession);
-    } else {
-      returnLocalErrorC(CHANNEL_EXEC);
+  data = malloc(st.st_size + 1);
+  while(*len < (size_t)st.st_size) {
+    n = read(fd, data + *len, st.st_size - *len);
+    if(n == -1 && errno == EINTR) continue;
+    if(n <= 0) break;
+    *len += n;
+  }
+  close(fd);
+
+  if(*len != (size_t)st.st_size) {
+    free(data);
+    *error = READ;
+    return NULL;
+  }
+
+  data[*len] = '\0';
+  return data;
+}
+
+static void wipe(char *data, size_t len) {
+  volatile char *p = data;
+
+  while(len--) *p++ = 0;
+}
+
+/* Read a key pair once for all the sessions authenticating with it, the
+ * public key being derived from the private one if `public_key_path` is NULL
+ * or empty. The private key is decrypted here, so that the key derivation
+ * of the passphrase is not run again at each authentication, failing with
+ * AUTHENTICATION if the passphrase is wrong. Only the keys in a format
+ * simplessh_key_decrypt leaves alone keep the passphrase, for libssh2. */
+struct simplessh_either *simplessh_key_load(const char *public_key_path,
+                                            const char *private_key_path,
+                                            const char *passphrase) {
+  struct simplessh_key *key;
+  char *decrypted;
+  size_t len;
+  int error = 0;
+
+  if(passphrase == NULL) passphrase = "";
+  key = calloc(1, sizeof(struct simplessh_key));
+  key->private_key = read_file(private_key_path, &key->private_key_len,
+                               &error);
+  if(!error && public_key_path != NULL && public_key_path[0] != '\0')
+    key->public_key = read_file(public_key_path, &key->public_key_len,
+                                &error);
+
+  if(!error) {
+    decrypted = simplessh_key_decrypt(key->private_key, key->private_key_len,
+                                      passphrase, &len, &error);
+    if(decrypted != NULL) {
+      wipe(key->private_key, key->private_key_len);
+      free(key->private_key);
+      key->private_key     = decrypted;
+      key->private_key_len = len;
+    } else if(!error) {
+      key->passphrase = strdup(passphrase);
     }
   }
 
-  // Read result
-  int out_size = 128, out_position = 0, err_size = 128, err_position = 0;
-  out = malloc(out_size);
-  err = malloc(err_size);
+  if(error) {
+    simplessh_key_free(key);
+    return simplessh_either_new(error, NULL);
+  }
 
-  for(;;) {
-    rc  = libssh2_channel_read(channel,
-                               out + out_position,
-                               out_size - out_position - 1);
-    rc2 = libssh2_channel_read_stderr(channel,
-                                      err + err_position,
-                                      err_size - err_position - 1);
-
-    if(rc == 0 && rc2 == 0) {
-      break;
-    } else if(rc == LIBSSH2_ERROR_EAGAIN && rc2 == LIBSSH2_ERROR_EAGAIN) {
-      waitsocket(session->sock, session->lsession);
-    } else if((rc < 0  && rc  != LIBSSH2_ERROR_EAGAIN) ||
-              (rc2 < 0 && rc2 != LIBSSH2_ERROR_EAGAIN)) {
-      returnLocalErrorC(READ);
-    } else {
-      if(rc > 0) {
-        out_position += rc;
-        if(out_size - out_position < 1024) {
-          out_size = min(out_size * 2, out_size + 65536);
-          out = realloc(out, out_size);
-        }
+  return simplessh_either_new(0, key);
+}
+
+void simplessh_key_free(struct simplessh_key *key) {
+  if(key->private_key != NULL) wipe(key->private_key, key->private_key_len);
+  if(key->passphrase != NULL) wipe(key->passphrase, strlen(key->passphrase));
+  free(key->public_key);
+  free(key->private_key);
+  free(key->passphrase);
+  free(key);
+}
+
+/* Hand `len` bytes just read on a stream to the callback or keep them in the
+ * buffer, within the limit of the stream. With a head limit, the bytes past
+ * it are simply not committed and get overwritten by the next read. */
+static int exec_consume(struct simplessh_session *session,
+                        struct simplessh_exec *exec,
+                        int stream,
+                        struct simplessh_buffer *buffer,
+                        const char *data,
+                        size_t len) {
+  struct simplessh_limit *limit;
+  size_t *dropped, keep;
+
+  if(exec->callback != NULL) {
+    simplessh_buffer_commit(buffer, len);
+    simplessh_buffer_clear(buffer);
+    return exec->callback(stream, data, len);
+  }
+
+  limit   = stream == STREAM_OUT ? &exec->out_limit : &exec->err_limit;
+  dropped = stream == STREAM_OUT ? &exec->out_dropped : &exec->err_dropped;
+
+  switch(limit->mode) {
+  case LIMIT_HEAD:
+    keep = buffer->len < limit->size ? limit->size - buffer->len : 0;
+    if(keep > len) keep = len;
+    simplessh_buffer_commit(buffer, keep);
+    *dropped += len - keep;
+    break;
+
+  case LIMIT_TAIL:
+    simplessh_buffer_commit(buffer, len);
+    *dropped += simplessh_buffer_keep_tail(buffer, &session->arena,
+                                           limit->size);
+    break;
+
+  default:
+    simplessh_buffer_commit(buffer, len);
+  }
+
+  return 0;
+}
+
+/* Read a stream until it would block, or up to SIMPLESSH_DRAIN_BATCH bytes
+ * so that a flood on one stream does not starve the other. libssh2 extends
+ * the window as the data is consumed, so draining in large batches keeps the
+ * server sending.
+ *
+ * Returns 1 if something was read, 0 at the end of the stream,
+ * LIBSSH2_ERROR_EAGAIN if nothing is available and -1 on error. */
+static int exec_drain(struct simplessh_session *session,
+                      struct simplessh_exec *exec,
+                      int stream) {
+  struct simplessh_buffer *buffer = stream == STREAM_OUT ? &exec->out
+                                                         : &exec->err;
+  size_t room, total = 0;
+  ssize_t rc;
+  char *data;
+
+  while(total < SIMPLESSH_DRAIN_BATCH) {
+    data = simplessh_buffer_reserve(buffer, &session->arena, &room);
+    rc   = libssh2_channel_read_ex(exec->channel, stream, data, room);
+
+    if(rc == 0 || rc == LIBSSH2_ERROR_EAGAIN) return total > 0 ? 1 : rc;
+    if(rc < 0 || exec_consume(session, exec, stream, buffer, data, rc))
+      return -1;
+    total       += rc;
+    exec->moved += rc;
+  }
+
+  return 1;
+}
+
+/* Write to stdin what the input callback gives, until the channel would
+ * block or SIMPLESSH_DRAIN_BATCH bytes have been written, and send EOF once
+ * the callback is exhausted. A command which exits without reading all of
+ * its input just ends the feeding.
+ *
+ * Returns 1 if something was written, 0 once EOF is sent,
+ * LIBSSH2_ERROR_EAGAIN if the channel is full and -1 on error, with
+ * `*error` set to READ if the callback failed and WRITE otherwise. */
+static int exec_feed(struct simplessh_session *session,
+                     struct simplessh_exec *exec,
+                     int *error) {
+  size_t total = 0;
+  ssize_t rc;
+
+  while(exec->input_state != INPUT_DONE && total < SIMPLESSH_DRAIN_BATCH) {
+    if(exec->input_state == INPUT_EOF) {
+      rc = libssh2_channel_send_eof(exec->channel);
+      if(rc == LIBSSH2_ERROR_EAGAIN) return total > 0 ? 1 : rc;
+      if(rc && !libssh2_channel_eof(exec->channel)) {
+        *error = WRITE;
+        return -1;
+      }
+      exec->input_state = INPUT_DONE;
+      return 1;
+    }
+
+    if(exec->in_pos == exec->in_len) {
+      if(exec->in_data == NULL)
+        exec->in_data = simplessh_buffer_reserve(&exec->in, &session->arena,
+                                                 &exec->in_size);
+      rc = exec->input(exec->in_data, exec->in_size);
+      if(rc < 0) {
+        *error = READ;
+        return -1;
+      }
+      if(rc == 0) {
+        exec->input_state = INPUT_EOF;
+        continue;
       }
-      if(rc2 > 0) {
-        err_position += rc2;
-        if(err_size - err_position < 1024) {
-          err_size = min(err_size * 2, err_size + 65536);
-          err = realloc(err, err_size);
-        }
+      exec->in_len = rc;
+      exec->in_pos = 0;
+    }
+
+    rc = libssh2_channel_write(exec->channel, exec->in_data + exec->in_pos,
+                               exec->in_len - exec->in_pos);
+    if(rc == LIBSSH2_ERROR_EAGAIN) return total > 0 ? 1 : rc;
+    if(rc < 0) {
+      if(libssh2_channel_eof(exec->channel)) {
+        exec->input_state = INPUT_DONE;
+        return 0;
       }
+      *error = WRITE;
+      return -1;
     }
+    exec->in_pos += rc;
+    total        += rc;
+    exec->moved  += rc;
   }
-  out[out_position] = '\0';
-  out = realloc(out, out_position + 1);
-  result->out = out;
 
-  err[err_position] = '\0';
-  err = realloc(err, err_position + 1);
-  result->err = err;
+  return exec->input_state == INPUT_DONE && total == 0 ? 0 : 1;
+}
 
-  while((rc = libssh2_channel_close(channel)) == LIBSSH2_ERROR_EAGAIN)
-    waitsocket(session->sock, session->lsession);
+// The output of a command cannot be read to the end
+static int exec_failed(struct simplessh_session *session,
+                       struct simplessh_exec *exec,
+                       int error) {
+  simplessh_trace(session, TRACE_EOF, exec, error);
+  return error;
+}
 
-  if(rc == 0) {
-    result->exit_code = libssh2_channel_get_exit_status(channel);
-    libssh2_channel_get_exit_signal(channel,
-                                    &result->exit_signal, NULL,
-                                    NULL, NULL,
-                                    NULL, NULL);
+void simplessh_exec_init(struct simplessh_exec *exec, const char *command) {
+  exec->channel  = NULL;
+  exec->command  = command;
+  exec->command_len = strlen(command);
+  exec->state    = EXEC_OPEN;
+  exec->callback  = NULL;
+  exec->size_hint = 0;
+  exec->result    = NULL;
+  exec->out_limit.mode = exec->err_limit.mode = LIMIT_NONE;
+  exec->out_limit.size = exec->err_limit.size = 0;
+  exec->out_dropped    = exec->err_dropped    = 0;
+  exec->signal_pending = 0;
+  exec->input       = NULL;
+  exec->input_state = INPUT_DONE;
+  exec->in_data     = NULL;
+  exec->in_size     = exec->in_len = exec->in_pos = 0;
+  simplessh_buffer_init(&exec->in);
+  memset(&exec->stats, 0, sizeof(struct simplessh_exec_stats));
+  exec->moved       = 0;
+  simplessh_buffer_init(&exec->out);
+  simplessh_buffer_init(&exec->err);
+}
+
+void simplessh_exec_cleanup(struct simplessh_session *session,
+                            struct simplessh_exec *exec) {
+  if(session->opening == exec) session->opening = NULL;
+  if(exec->channel != NULL) libssh2_channel_free(exec->channel);
+  exec->channel = NULL;
+  simplessh_buffer_free(&exec->out, &session->arena);
+  simplessh_buffer_free(&exec->err, &session->arena);
+  simplessh_buffer_free(&exec->in, &session->arena);
+  exec->in_data = NULL;
+}
+
+/* Drive a command as far as possible without blocking.
+ *
+ * Returns 0 when the command is done and exec->result is set,
+ * LIBSSH2_ERROR_EAGAIN when waiting on the socket is needed and an error
+ * otherwise. libssh2 only supports one pending channel opening per session so
+ * a command waits for its turn before opening its channel. */
+int simplessh_exec_step(struct simplessh_session *session,
+                        struct simplessh_exec *exec) {
+  int rc, rc2, rc3, error;
+
+  switch(exec->state) {
+  case EXEC_OPEN:
+    simplessh_exec_stats_begin(session, &exec->stats);
+    if(session->opening != NULL && session->opening != exec)
+      return LIBSSH2_ERROR_EAGAIN;
+    session->opening = exec;
+
+    exec->channel = libssh2_channel_open_ex(session->lsession,
+                                            "session", sizeof("session") - 1,
+                                            session->window_size,
+                                            session->packet_size,
+                                            NULL, 0);
+    if(exec->channel == NULL) {
+      if(libssh2_session_last_errno(session->lsession) == LIBSSH2_ERROR_EAGAIN)
+        return LIBSSH2_ERROR_EAGAIN;
+      session->opening = NULL;
+      simplessh_trace(session, TRACE_CHANNEL_OPEN, exec, CHANNEL_OPEN);
+      return CHANNEL_OPEN;
+    }
+    session->opening = NULL;
+    simplessh_stamp(session, exec->stats.opened);
+    simplessh_trace(session, TRACE_CHANNEL_OPEN, exec, 0);
+    exec->state = EXEC_START;
+    // fall through
+
+  case EXEC_START:
+    rc = libssh2_channel_process_startup(exec->channel, "exec",
+                                         sizeof("exec") - 1, exec->command,
+                                         exec->command_len);
+    if(rc == LIBSSH2_ERROR_EAGAIN) return rc;
+    simplessh_trace(session, TRACE_EXEC, exec, rc ? CHANNEL_EXEC : 0);
+    if(rc) return CHANNEL_EXEC;
+
+    if(exec->callback == NULL)
+      simplessh_buffer_preallocate(&exec->out, exec->size_hint);
+    simplessh_stamp(session, exec->stats.executed);
+    exec->state = EXEC_READ;
+    // fall through
+
+  case EXEC_READ:
+    /* Stdin and both output streams get a turn at each round and the socket
+     * is only waited on once none of them can make progress. Feeding stdin
+     * without draining the output could deadlock with a command blocked on
+     * writing to a full window. */
+    for(;;) {
+      rc3 = exec_feed(session, exec, &error);
+      if(rc3 == -1) return exec_failed(session, exec, error);
+      rc = exec_drain(session, exec, STREAM_OUT);
+      if(rc == -1) return exec_failed(session, exec, READ);
+      rc2 = exec_drain(session, exec, STREAM_ERR);
+      if(rc2 == -1) return exec_failed(session, exec, READ);
+
+      if(rc == 0 && rc2 == 0) break;
+      if(rc != 1 && rc2 != 1 && rc3 != 1) return LIBSSH2_ERROR_EAGAIN;
+    }
+    simplessh_buffer_free(&exec->in, &session->arena);
+    exec->in_data = NULL;
+
+    simplessh_stamp(session, exec->stats.drained);
+    simplessh_trace(session, TRACE_EOF, exec, 0);
+    exec->result = malloc(sizeof(struct simplessh_result));
+    if(exec->callback != NULL) {
+      simplessh_buffer_free(&exec->out, &session->arena);
+      simplessh_buffer_free(&exec->err, &session->arena);
+      exec->result->out     = NULL;
+      exec->result->out_len = 0;
+      exec->result->err     = NULL;
+      exec->result->err_len = 0;
+    } else {
+      exec->result->out = simplessh_buffer_finish(&exec->out, &session->arena,
+                                                  &exec->result->out_len);
+      exec->result->err = simplessh_buffer_finish(&exec->err, &session->arena,
+                                                  &exec->result->err_len);
+    }
+    exec->result->exit_code   = 127;
+    exec->result->exit_signal = NULL;
+    exec->result->out_dropped = exec->out_dropped;
+    exec->result->err_dropped = exec->err_dropped;
+    exec->state = EXEC_CLOSE;
+    // fall through
+
+  case EXEC_CLOSE:
+    rc = libssh2_channel_close(exec->channel);
+    if(rc == LIBSSH2_ERROR_EAGAIN) return rc;
+
+    if(rc == 0) {
+      exec->result->exit_code = libssh2_channel_get_exit_status(exec->channel);
+      libssh2_channel_get_exit_signal(exec->channel,
+                                      &exec->result->exit_signal, NULL,
+                                      NULL, NULL,
+                                      NULL, NULL);
+    }
+
+    libssh2_channel_free(exec->channel);
+    exec->channel = NULL;
+    simplessh_exec_stats_end(session, &exec->stats);
+    simplessh_trace(session, TRACE_CLOSE, exec, exec->result->exit_code);
+    exec->result->stats = exec->stats;
+    exec->state   = EXEC_DONE;
+    return 0;
+
+  case EXEC_CANCEL:
+    /* The signal is only a request which the server may not honour, closing
+     * the channel is what actually ends the command for us. */
+    if(exec->signal_pending) {
+      rc = libssh2_channel_signal_ex(exec->channel, "TERM", sizeof("TERM") - 1);
+      if(rc == LIBSSH2_ERROR_EAGAIN) return rc;
+      exec->signal_pending = 0;
+    }
+
+    rc = libssh2_channel_close(exec->channel);
+    if(rc == LIBSSH2_ERROR_EAGAIN) return rc;
+
+    libssh2_channel_free(exec->channel);
+    exec->channel = NULL;
+    exec->state   = EXEC_DONE;
+    simplessh_trace(session, TRACE_CANCEL, exec, 0);
+    // fall through
+
+  case EXEC_DONE:
+    return 0;
   }
 
+  return 0;
+}
 
-  libssh2_channel_free(channel);
+// Drive a single exec to completion
+static struct simplessh_either *exec_run(struct simplessh_session *session,
+                                         struct simplessh_exec *exec) {
+  struct simplessh_either *either;
+  int rc;
 
+  either = malloc(sizeof(struct simplessh_either));
+
+  while((rc = simplessh_exec_step(session, exec)) == LIBSSH2_ERROR_EAGAIN) {
+    if(simplessh_waitsocket(session) <= 0) {
+      rc = TIMEOUT;
+      break;
+    }
+  }
+
+  if(rc) {
+    simplessh_exec_cleanup(session, exec);
+    if(exec->result != NULL) simplessh_free_result(exec->result);
+    returnError(either, rc);
+  }
+
+  either->side    = RIGHT;
+  either->u.value = exec->result;
   return either;
 }
 
-struct simplessh_either *simplessh_send_file(
+struct simplessh_either *simplessh_exec_command(
     struct simplessh_session *session,
-    int mode,
-    const char *data,
-    int data_len,
-    const char *destination_path) {
+    const char *command) {
+  struct simplessh_exec exec;
+
+  simplessh_exec_init(&exec, command);
+  return exec_run(session, &exec);
+}
+
+/* Execute a command, preallocating `size_hint` bytes for its stdout. */
+struct simplessh_either *simplessh_exec_command_with(
+    struct simplessh_session *session,
+    const char *command,
+    size_t size_hint) {
+  struct simplessh_exec exec;
+
+  simplessh_exec_init(&exec, command);
+  exec.size_hint = size_hint;
+  return exec_run(session, &exec);
+}
+
+/* Execute a command, handing its stdout and stderr to `callback` in chunks of
+ * at most SIMPLESSH_SLAB_SIZE bytes as they arrive. The result has no
+ * output, only the exit code and signal. */
+struct simplessh_either *simplessh_exec_command_stream(
+    struct simplessh_session *session,
+    const char *command,
+    simplessh_chunk_callback callback) {
+  struct simplessh_exec exec;
+
+  simplessh_exec_init(&exec, command);
+  exec.callback = callback;
+  return exec_run(session, &exec);
+}
+
+/* Allocate a command to be driven with simplessh_exec_step, `command`
+ * having to stay valid until simplessh_exec_free. */
+struct simplessh_exec *simplessh_exec_new(const char *command,
+                                          size_t size_hint) {
+  struct simplessh_exec *exec = malloc(sizeof(struct simplessh_exec));
+
+  simplessh_exec_init(exec, command);
+  exec->size_hint = size_hint;
+  return exec;
+}
+
+/* Bound what is kept of stdout and stderr, see enum simplessh_limit_mode.
+ * Must be called before the first step. */
+void simplessh_exec_set_limits(struct simplessh_exec *exec,
+                               int out_mode,
+                               size_t out_size,
+                               int err_mode,
+                               size_t err_size) {
+  exec->out_limit.mode = out_mode;
+  exec->out_limit.size = out_size;
+  exec->err_limit.mode = err_mode;
+  exec->err_limit.size = err_size;
+}
+
+/* Stream the data pulled from `input` to the stdin of the command, EOF being
+ * sent once it returns 0. `input` is called from simplessh_exec_step, which
+ * must then not be imported as unsafe from Haskell. Must be called before
+ * the first step. */
+void simplessh_exec_set_input(struct simplessh_exec *exec,
+                              simplessh_read_callback input) {
+  exec->input       = input;
+  exec->input_state = input != NULL ? INPUT_OPEN : INPUT_DONE;
+}
+
+/* Drive a command until it is running on the server, returning 0 once the
+ * exec request is accepted. The command can then be left to run and driven
+ * to completion later with simplessh_exec_step. */
+int simplessh_exec_start_step(struct simplessh_session *session,
+                              struct simplessh_exec *exec) {
+  int rc;
+
+  if(exec->state >= EXEC_READ) return 0;
+
+  rc = simplessh_exec_step(session, exec);
+  return rc == LIBSSH2_ERROR_EAGAIN && exec->state >= EXEC_READ ? 0 : rc;
+}
+
+/* Make the next steps send SIGTERM to a running command and close its
+ * channel, without a result. A command which is already closing is left to
+ * finish normally. */
+void simplessh_exec_cancel(struct simplessh_exec *exec) {
+  if(exec->state != EXEC_READ) return;
+
+  exec->state          = EXEC_CANCEL;
+  exec->signal_pending = 1;
+}
+
+/* Size of struct simplessh_exec, for callers keeping one in their own memory
+ * with simplessh_exec_setup and simplessh_exec_release instead of
+ * simplessh_exec_new and simplessh_exec_free. */
+size_t simplessh_exec_size(void) {
+  return sizeof(struct simplessh_exec);
+}
+
+/* Initialise a command in memory owned by the caller, with its size hint and
+ * limits, see simplessh_exec_set_limits. The command is given by its length,
+ * so that it can hold any byte and be used in place. */
+void simplessh_exec_setup(struct simplessh_exec *exec,
+                          const char *command,
+                          size_t command_len,
+                          size_t size_hint,
+                          int out_mode,
+                          size_t out_size,
+                          int err_mode,
+                          size_t err_size) {
+  simplessh_exec_init(exec, "");
+  exec->command     = command;
+  exec->command_len = command_len;
+  exec->size_hint   = size_hint;
+  simplessh_exec_set_limits(exec, out_mode, out_size, err_mode, err_size);
+}
+
+// The result of a command once simplessh_exec_step returned 0, NULL if none
+struct simplessh_result *simplessh_exec_get_result(
+    struct simplessh_exec *exec) {
+  return exec->result;
+}
+
+// Take the result of a command once simplessh_exec_step returned 0
+struct simplessh_result *simplessh_exec_take_result(
+    struct simplessh_exec *exec) {
+  struct simplessh_result *result = exec->result;
+
+  exec->result = NULL;
+  return result;
+}
+
+// Free everything a command holds but the command itself
+void simplessh_exec_release(struct simplessh_session *session,
+                            struct simplessh_exec *exec) {
+  simplessh_exec_cleanup(session, exec);
+  if(exec->result != NULL) simplessh_free_result(exec->result);
+  exec->result = NULL;
+}
+
+void simplessh_exec_free(struct simplessh_session *session,
+                         struct simplessh_exec *exec) {
+  simplessh_exec_release(session, exec);
+  free(exec);
+}
+
+/* Allocate a batch of commands to be run concurrently, each on its own
+ * channel, keeping at most `max_channels` of them open at the same time.
+ * `commands`, and `command_lens` unless it is NULL for NUL-terminated
+ * commands, have to stay valid until simplessh_batch_free. */
+struct simplessh_batch *simplessh_batch_new(const char **commands,
+                                            const size_t *command_lens,
+                                            int count,
+                                            int max_channels) {
+  struct simplessh_batch *batch = malloc(sizeof(struct simplessh_batch));
+
+  batch->commands     = commands;
+  batch->command_lens = command_lens;
+  batch->count        = count;
+  batch->max_channels = max_channels > 0 ? max_channels : count;
+  batch->started      = 0;
+  batch->running      = 0;
+  batch->finished     = 0;
+  batch->execs        = malloc(count * sizeof(struct simplessh_exec));
+  batch->results          = malloc(sizeof(struct simplessh_results));
+  batch->results->count   = count;
+  batch->results->results = calloc(count, sizeof(struct simplessh_result*));
+
+  return batch;
+}
+
+/* Whether the session already holds data for the channel of a command,
+ * read from the socket while another channel was being stepped. */
+static int exec_pending(struct simplessh_exec *exec) {
+  if(exec->state != EXEC_READ || exec->channel == NULL) return 0;
+  return libssh2_poll_channel_read(exec->channel, STREAM_OUT) ||
+         libssh2_poll_channel_read(exec->channel, STREAM_ERR) ||
+         libssh2_channel_eof(exec->channel);
+}
+
+/* Drive all the channels of a batch as far as possible without blocking,
+ * with the same return values as simplessh_exec_step.
+ *
+ * Reading a channel makes libssh2 read every packet waiting on the socket,
+ * queueing each on its own channel, so the packets of a command already
+ * stepped in a pass may have been read by a later one. The pass is thus
+ * repeated as long as any command moved data or changed state, and before
+ * waiting on the socket, which would then be empty, when any channel still
+ * has queued data. */
+int simplessh_batch_step(struct simplessh_session *session,
+                         struct simplessh_batch *batch) {
+  struct simplessh_exec *exec;
+  enum simplessh_exec_state state;
+  uint64_t moved;
+  int i, rc, progress;
+
+  for(;;) {
+    while(batch->running < batch->max_channels &&
+          batch->started < batch->count) {
+      exec = &batch->execs[batch->started];
+      if(batch->command_lens == NULL) {
+        simplessh_exec_init(exec, batch->commands[batch->started]);
+      } else {
+        simplessh_exec_init(exec, "");
+        exec->command     = batch->commands[batch->started];
+        exec->command_len = batch->command_lens[batch->started];
+      }
+      batch->started++;
+      batch->running++;
+    }
+
+    progress = 0;
+    for(i = 0; i < batch->started; i++) {
+      exec = &batch->execs[i];
+      if(exec->state == EXEC_DONE) continue;
+
+      state = exec->state;
+      moved = exec->moved;
+      rc    = simplessh_exec_step(session, exec);
+      if(exec->state != state || exec->moved != moved) progress = 1;
+      if(rc == LIBSSH2_ERROR_EAGAIN) continue;
+      if(rc) return rc;
+
+      batch->results->results[i] = exec->result;
+      batch->running--;
+      batch->finished++;
+    }
+
+    if(batch->finished == batch->count) return 0;
+
+    for(i = 0; !progress && i < batch->started; i++)
+      progress = exec_pending(&batch->execs[i]);
+    if(!progress) return LIBSSH2_ERROR_EAGAIN;
+  }
+}
+
+// Take the results of a batch once simplessh_batch_step returned 0
+struct simplessh_results *simplessh_batch_take_results(
+    struct simplessh_batch *batch) {
+  struct simplessh_results *results = batch->results;
+
+  batch->results = NULL;
+  return results;
+}
+
+void simplessh_batch_free(struct simplessh_session *session,
+                          struct simplessh_batch *batch) {
+  struct simplessh_exec *exec;
+  int i;
+
+  for(i = 0; i < batch->started; i++) {
+    exec = &batch->execs[i];
+    simplessh_exec_cleanup(session, exec);
+    // Results of finished commands belong to batch->results
+    if(exec->state != EXEC_DONE && exec->result != NULL)
+      simplessh_free_result(exec->result);
+  }
+
+  if(batch->results != NULL) simplessh_free_results(batch->results);
+  free(batch->execs);
+  free(batch);
+}
+
+/* Run several commands concurrently, each on its own channel, keeping at most
+ * `max_channels` of them open at the same time.
+ *
+ * All the channels are driven from a single loop, waiting on the socket only
+ * when none of them can make progress. */
+struct simplessh_either *simplessh_exec_commands(
+    struct simplessh_session *session,
+    const char **commands,
+    int count,
+    int max_channels) {
   struct simplessh_either *either;
-  LIBSSH2_CHANNEL *channel = NULL;
+  struct simplessh_batch *batch;
   int rc;
-  int *transferred = malloc(sizeof(int));
-  *transferred = 0;
 
-  // Empty either
-  either = malloc(sizeof(struct simplessh_either));
-  either->side    = RIGHT;
-  either->u.value = transferred;
+  batch = simplessh_batch_new(commands, NULL, count, max_channels);
+
+  while((rc = simplessh_batch_step(session, batch)) == LIBSSH2_ERROR_EAGAIN) {
+    if(simplessh_waitsocket(session) <= 0) {
+      rc = TIMEOUT;
+      break;
+    }
+  }
+
+  either = simplessh_either_new(rc, rc ? NULL
+                                       : simplessh_batch_take_results(batch));
+  simplessh_batch_free(session, batch);
+  return either;
+}
+
+/* Sources of the data sent by scp_upload. Each one makes up to `max` bytes
+ * available at `*data` and returns how many, 0 at the end or -1 on error. */
+typedef ssize_t (*scp_source)(void *ctx, const char **data, size_t max);
+
+struct memory_source {
+  const char *data;
+};
+
+static ssize_t memory_next(void *ctx, const char **data, size_t max) {
+  struct memory_source *source = ctx;
+  *data = source->data;
+  source->data += max;
+  return max;
+}
+
+struct fd_source {
+  int fd;
+  char *buffer;
+  size_t size;
+};
+
+static ssize_t fd_next(void *ctx, const char **data, size_t max) {
+  struct fd_source *source = ctx;
+  ssize_t rc;
+
+  do {
+    rc = read(source->fd, source->buffer, max < source->size ? max : source->size);
+  } while(rc == -1 && errno == EINTR);
+
+  *data = source->buffer;
+  return rc;
+}
+
+struct callback_source {
+  simplessh_read_callback callback;
+  char *buffer;
+  size_t size;
+};
+
+static ssize_t callback_next(void *ctx, const char **data, size_t max) {
+  struct callback_source *source = ctx;
+  *data = source->buffer;
+  return source->callback(source->buffer,
+                          max < source->size ? max : source->size);
+}
+
+/* Size of the buffer to preallocate for reading chunks, 0 when a standard
+ * slab is big enough. */
+static size_t chunk_buffer_size(struct simplessh_session *session) {
+  return session->chunk_size > SIMPLESSH_SLAB_SIZE ? session->chunk_size : 0;
+}
+
+/* Send `size` bytes taken from a source to `destination_path` over SCP,
+ * counting the bytes written in `*transferred`. */
+static int scp_upload(struct simplessh_session *session,
+                      int mode,
+                      int64_t size,
+                      const char *destination_path,
+                      scp_source next,
+                      void *ctx,
+                      int64_t *transferred) {
+  LIBSSH2_CHANNEL *channel;
+  const char *current;
+  ssize_t n;
+  int rc;
 
   #define returnLocalErrorS(err) { \
-    if(channel) libssh2_channel_free(channel); \
-    either->side    = LEFT; \
-    either->u.error = err; \
-    return either; \
+    libssh2_channel_free(channel); \
+    return (err); \
   }
 
-  while((channel = libssh2_scp_send(session->lsession, destination_path, mode & 0777, data_len)) == NULL) {
-    if(libssh2_session_last_errno(session->lsession) == LIBSSH2_ERROR_EAGAIN) {
-      waitsocket(session->sock, session->lsession);
-    } else {
-      returnLocalErrorS(CHANNEL_OPEN);
-    }
+  while((channel = libssh2_scp_send64(session->lsession, destination_path,
+                                      mode & 0777, size, 0, 0)) == NULL) {
+    if(libssh2_session_last_errno(session->lsession) != LIBSSH2_ERROR_EAGAIN)
+      return CHANNEL_OPEN;
+    if(simplessh_waitsocket(session) <= 0)
+      return TIMEOUT;
   }
 
-  char *current;
-  while(*transferred < data_len) {
-    size_t n = min(data_len - *transferred, 16 * 1024);
-    current = data + *transferred;
+  while(*transferred < size) {
+    n = next(ctx, &current,
+             size - *transferred < (int64_t)session->chunk_size
+               ? size - *transferred : (int64_t)session->chunk_size);
+    if(n <= 0) returnLocalErrorS(READ);
+
     // Ready to write n bytes to the channel
     while(n > 0) {
-      while((rc = libssh2_channel_write(channel, current, n)) == LIBSSH2_ERROR_EAGAIN);
+      waitLoop(session, rc, libssh2_channel_write(channel, current, n));
+      if(rc == LIBSSH2_ERROR_TIMEOUT) returnLocalErrorS(TIMEOUT);
       if(rc < 0) returnLocalErrorS(WRITE);
       n -= rc;
       current += rc;
@@ -356,16 +1435,310 @@ struct simplessh_either *simplessh_send_file(
     }
   }
 
-  while(libssh2_channel_send_eof(channel) == LIBSSH2_ERROR_EAGAIN);
-  while(libssh2_channel_close(channel) == LIBSSH2_ERROR_EAGAIN);
-  while(libssh2_channel_free(channel) == LIBSSH2_ERROR_EAGAIN);
+  #undef returnLocalErrorS
+
+  waitLoop(session, rc, libssh2_channel_send_eof(channel));
+  waitLoop(session, rc, libssh2_channel_close(channel));
+  waitLoop(session, rc, libssh2_channel_free(channel));
+  return 0;
+}
+
+static struct simplessh_either *either_count(int rc, int64_t *transferred) {
+  struct simplessh_either *either = malloc(sizeof(struct simplessh_either));
+
+  if(rc) {
+    free(transferred);
+    returnError(either, rc);
+  }
+
+  either->side    = RIGHT;
+  either->u.value = transferred;
   return either;
 }
 
+struct simplessh_either *simplessh_send_file(
+    struct simplessh_session *session,
+    int mode,
+    const char *data,
+    int64_t data_len,
+    const char *destination_path) {
+  struct memory_source source;
+  int64_t *transferred = malloc(sizeof(int64_t));
+  int rc;
+
+  *transferred = 0;
+  source.data  = data;
+
+  rc = scp_upload(session, mode, data_len, destination_path,
+                  memory_next, &source, transferred);
+  return either_count(rc, transferred);
+}
+
+/* Send a local file, streaming it through a fixed buffer. */
+struct simplessh_either *simplessh_send_file_from_path(
+    struct simplessh_session *session,
+    int mode,
+    const char *source_path,
+    const char *destination_path) {
+  struct simplessh_buffer buffer;
+  struct fd_source source;
+  struct stat st;
+  int64_t *transferred = malloc(sizeof(int64_t));
+  int rc;
+
+  *transferred = 0;
+
+  source.fd = open(source_path, O_RDONLY);
+  if(source.fd == -1) return either_count(FILEOPEN, transferred);
+  if(fstat(source.fd, &st) == -1) {
+    close(source.fd);
+    return either_count(FILEOPEN, transferred);
+  }
+
+  simplessh_buffer_init(&buffer);
+  simplessh_buffer_preallocate(&buffer, chunk_buffer_size(session));
+  source.buffer = simplessh_buffer_reserve(&buffer, &session->arena,
+                                           &source.size);
+
+  rc = scp_upload(session, mode, st.st_size, destination_path,
+                  fd_next, &source, transferred);
+
+  simplessh_buffer_free(&buffer, &session->arena);
+  close(source.fd);
+  return either_count(rc, transferred);
+}
+
+/* Send `size` bytes pulled from `callback`, which fills the buffer it is given
+ * and returns how many bytes it wrote, 0 at the end or -1 on error. */
+struct simplessh_either *simplessh_send_file_callback(
+    struct simplessh_session *session,
+    int mode,
+    int64_t size,
+    simplessh_read_callback callback,
+    const char *destination_path) {
+  struct simplessh_buffer buffer;
+  struct callback_source source;
+  int64_t *transferred = malloc(sizeof(int64_t));
+  int rc;
+
+  *transferred = 0;
+
+  simplessh_buffer_init(&buffer);
+  simplessh_buffer_preallocate(&buffer, chunk_buffer_size(session));
+  source.callback = callback;
+  source.buffer   = simplessh_buffer_reserve(&buffer, &session->arena,
+                                             &source.size);
+
+  rc = scp_upload(session, mode, size, destination_path,
+                  callback_next, &source, transferred);
+
+  simplessh_buffer_free(&buffer, &session->arena);
+  return either_count(rc, transferred);
+}
+
+/* Receive a remote file over SCP, streaming it to `destination_path` through
+ * a fixed buffer. The local file is created with the mode of the remote
+ * one. */
+struct simplessh_either *simplessh_receive_file(
+    struct simplessh_session *session,
+    const char *source_path,
+    const char *destination_path) {
+  LIBSSH2_CHANNEL *channel;
+  libssh2_struct_stat fileinfo;
+  struct simplessh_buffer buffer;
+  int64_t *transferred = malloc(sizeof(int64_t));
+  char *data, *current;
+  size_t size;
+  ssize_t n, written;
+  int fd, rc = 0;
+
+  *transferred = 0;
+
+  while((channel = libssh2_scp_recv2(session->lsession, source_path,
+                                     &fileinfo)) == NULL) {
+    if(libssh2_session_last_errno(session->lsession) != LIBSSH2_ERROR_EAGAIN)
+      return either_count(CHANNEL_OPEN, transferred);
+    if(simplessh_waitsocket(session) <= 0)
+      return either_count(TIMEOUT, transferred);
+  }
+
+  fd = open(destination_path, O_WRONLY | O_CREAT | O_TRUNC,
+            fileinfo.st_mode & 0777);
+  if(fd == -1) {
+    libssh2_channel_free(channel);
+    return either_count(FILEOPEN, transferred);
+  }
+
+  // libssh2_scp_recv2 opens its channel with the default window
+  if(session->window_size > LIBSSH2_CHANNEL_WINDOW_DEFAULT) {
+    unsigned int window;
+    waitLoop(session, rc,
+             libssh2_channel_receive_window_adjust2(
+               channel, session->window_size - LIBSSH2_CHANNEL_WINDOW_DEFAULT,
+               1, &window));
+    if(rc == LIBSSH2_ERROR_TIMEOUT) rc = TIMEOUT;
+    else if(rc < 0) rc = READ;
+    else rc = 0;
+  }
+
+  simplessh_buffer_init(&buffer);
+  data = simplessh_buffer_reserve(&buffer, &session->arena, &size);
+
+  while(rc == 0 && *transferred < fileinfo.st_size) {
+    if(fileinfo.st_size - *transferred < (int64_t)size)
+      size = fileinfo.st_size - *transferred;
+
+    waitLoop(session, n, libssh2_channel_read(channel, data, size));
+    if(n == LIBSSH2_ERROR_TIMEOUT) { rc = TIMEOUT; break; }
+    if(n <= 0) { rc = READ; break; }
+
+    for(current = data; n > 0; current += written, n -= written) {
+      do {
+        written = write(fd, current, n);
+      } while(written == -1 && errno == EINTR);
+      if(written == -1) { rc = WRITE; break; }
+      *transferred += written;
+    }
+  }
+
+  simplessh_buffer_free(&buffer, &session->arena);
+  if(close(fd) == -1 && rc == 0) rc = WRITE;
+
+  waitLoop(session, n, libssh2_channel_free(channel));
+  return either_count(rc, transferred);
+}
+
+/* Set the size of the writes of SCP uploads, as well as the window and
+ * maximum packet sizes of the channels opened for commands. Downloads grow
+ * the window of their channel to the given size. 0 keeps the current
+ * value. */
+void simplessh_set_transfer_options(struct simplessh_session *session,
+                                    size_t chunk_size,
+                                    unsigned int window_size,
+                                    unsigned int packet_size) {
+  if(chunk_size  > 0) session->chunk_size  = chunk_size;
+  if(window_size > 0) session->window_size = window_size;
+  if(packet_size > 0) session->packet_size = packet_size;
+}
+
+// Options with every value set to the default
+struct simplessh_options *simplessh_options_new(void) {
+  return calloc(1, sizeof(struct simplessh_options));
+}
+
+void simplessh_options_set_socket(struct simplessh_options *options,
+                                  int nodelay,
+                                  int sndbuf,
+                                  int rcvbuf,
+                                  int keepalive,
+                                  int keepalive_interval,
+                                  int user_timeout) {
+  options->socket.nodelay            = nodelay;
+  options->socket.sndbuf             = sndbuf;
+  options->socket.rcvbuf             = rcvbuf;
+  options->socket.keepalive          = keepalive;
+  options->socket.keepalive_interval = keepalive_interval;
+  options->socket.user_timeout       = user_timeout;
+}
+
+void simplessh_options_set_keepalive(struct simplessh_options *options,
+                                     int interval,
+                                     int count_max) {
+  options->keepalive_interval  = interval;
+  options->keepalive_count_max = count_max;
+}
+
+/* Check the host key against a known_hosts file, `accept_new` letting the
+ * hosts missing from it in. Keys that changed or are revoked are always
+ * rejected. */
+void simplessh_options_set_known_hosts(struct simplessh_options *options,
+                                       const char *path,
+                                       int accept_new) {
+  free(options->known_hosts);
+  options->known_hosts = path ? strdup(path) : NULL;
+  options->accept_new  = accept_new;
+}
+
+static void set_string(char **field, const char *value) {
+  free(*field);
+  *field = value && value[0] != '\0' ? strdup(value) : NULL;
+}
+
+/* Algorithm preferences as comma separated lists, NULL or empty for the
+ * defaults of libssh2. */
+void simplessh_options_set_methods(struct simplessh_options *options,
+                                   const char *kex,
+                                   const char *hostkey,
+                                   const char *ciphers,
+                                   const char *macs,
+                                   int compress) {
+  set_string(&options->kex, kex);
+  set_string(&options->hostkey, hostkey);
+  set_string(&options->ciphers, ciphers);
+  set_string(&options->macs, macs);
+  options->compress = compress;
+}
+
+// Measure the sessions, see simplessh_get_stats
+void simplessh_options_set_stats(struct simplessh_options *options,
+                                 int stats) {
+  options->stats = stats;
+}
+
+/* Connect through a bastion, see simplessh_jump_new. The jump is borrowed and
+ * must outlive the sessions going through it. */
+void simplessh_options_set_jump(struct simplessh_options *options,
+                                struct simplessh_forward *jump) {
+  options->jump = jump;
+}
+
+/* Trace the sessions, keeping the last `size` events of each, see
+ * simplessh/trace.h. Only one session in `sample` is traced when it is more
+ * than 1. */
+void simplessh_options_set_trace(struct simplessh_options *options,
+                                 int size,
+                                 int sample,
+                                 int libssh2_mask) {
+  options->trace         = size;
+  options->trace_sample  = sample;
+  options->trace_libssh2 = libssh2_mask;
+}
+
+void simplessh_options_free(struct simplessh_options *options) {
+  free(options->known_hosts);
+  free(options->kex);
+  free(options->hostkey);
+  free(options->ciphers);
+  free(options->macs);
+  free(options);
+}
+
+/* Change the TCP options of an open session, e.g. to switch between
+ * interactive commands and bulk transfers. Returns 0 or CONNECT if an option
+ * could not be set. */
+int simplessh_set_socket_options(struct simplessh_session *session,
+                                 const struct simplessh_options *options) {
+  return simplessh_apply_socket_options(session->sock, &options->socket)
+    ? CONNECT : 0;
+}
+
+void simplessh_set_timeout(struct simplessh_session *session, int timeout) {
+  session->timeout = timeout;
+  libssh2_session_set_timeout(session->lsession, timeout);
+}
+
 void simplessh_close_session(struct simplessh_session *session) {
-  libssh2_session_disconnect(session->lsession, "simplessh_close_session");
-  libssh2_session_free(session->lsession);
-  close(session->sock);
+  if(session->agent != NULL) agent_free(session);
+  if(session->lsession != NULL) {
+    // Nothing to say goodbye to before the key exchange
+    if(libssh2_session_methods(session->lsession, LIBSSH2_METHOD_KEX) != NULL)
+      libssh2_session_disconnect(session->lsession, "simplessh_close_session");
+    libssh2_session_free(session->lsession);
+    simplessh_exit();
+  }
+  if(session->sock != -1) close(session->sock);
+  simplessh_arena_free(&session->arena);
+  simplessh_trace_free(session->trace);
+  free(session->hostname);
   free(session);
-  libssh2_exit();
 }
@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <simplessh/buffer.h>
+
+static struct simplessh_slab *slab_new(size_t size) {
+  struct simplessh_slab *slab = malloc(sizeof(struct simplessh_slab));
+  slab->data = malloc(size);
+  slab->size = size;
+  slab->len  = 0;
+  slab->next = NULL;
+  return slab;
+}
+
+static struct simplessh_slab *slab_get(struct simplessh_arena *arena) {
+  struct simplessh_slab *slab = arena->free;
+
+  if(slab == NULL) return slab_new(SIMPLESSH_SLAB_SIZE);
+
+  arena->free = slab->next;
+  arena->count--;
+  slab->len  = 0;
+  slab->next = NULL;
+  return slab;
+}
+
+static void slab_release(struct simplessh_arena *arena,
+                         struct simplessh_slab *slab) {
+  if(slab->size == SIMPLESSH_SLAB_SIZE && arena->count < SIMPLESSH_ARENA_MAX) {
+    slab->next  = arena->free;
+    arena->free = slab;
+    arena->count++;
+  } else {
+    free(slab->data);
+    free(slab);
+  }
+}
+
+void simplessh_arena_init(struct simplessh_arena *arena) {
+  arena->free  = NULL;
+  arena->count = 0;
+}
+
+void simplessh_arena_free(struct simplessh_arena *arena) {
+  struct simplessh_slab *slab;
+
+  while(arena->free != NULL) {
+    slab = arena->free;
+    arena->free = slab->next;
+    free(slab->data);
+    free(slab);
+  }
+  arena->count = 0;
+}
+
+void simplessh_buffer_init(struct simplessh_buffer *buffer) {
+  buffer->head = NULL;
+  buffer->tail = NULL;
+  buffer->skip = 0;
+  buffer->len  = 0;
+}
+
+/* Allocate a first slab big enough for `size` bytes and the terminating NUL,
+ * e.g. when the caller knows how big the output is going to be. */
+void simplessh_buffer_preallocate(struct simplessh_buffer *buffer,
+                                  size_t size) {
+  if(buffer->head != NULL || size == 0) return;
+  buffer->head = buffer->tail = slab_new(size + 1);
+}
+
+/* Return where the next bytes can be written and how many, adding a slab if
+ * the last one is full. */
+char *simplessh_buffer_reserve(struct simplessh_buffer *buffer,
+                               struct simplessh_arena *arena,
+                               size_t *room) {
+  struct simplessh_slab *slab;
+
+  if(buffer->tail == NULL || buffer->tail->len == buffer->tail->size) {
+    slab = slab_get(arena);
+    if(buffer->tail == NULL) buffer->head = slab;
+    else buffer->tail->next = slab;
+    buffer->tail = slab;
+  }
+
+  *room = buffer->tail->size - buffer->tail->len;
+  return buffer->tail->data + buffer->tail->len;
+}
+
+// Account for `len` bytes written after simplessh_buffer_reserve
+void simplessh_buffer_commit(struct simplessh_buffer *buffer, size_t len) {
+  buffer->tail->len += len;
+  buffer->len       += len;
+}
+
+// Forget the content but keep the slabs
+void simplessh_buffer_clear(struct simplessh_buffer *buffer) {
+  struct simplessh_slab *slab;
+
+  for(slab = buffer->head; slab != NULL; slab = slab->next) slab->len = 0;
+  buffer->tail = buffer->head;
+  buffer->skip = 0;
+  buffer->len  = 0;
+}
+
+/* Drop the oldest bytes so that at most `size` are left, giving whole slabs
+ * back to the arena. Returns how many bytes were dropped. */
+size_t simplessh_buffer_keep_tail(struct simplessh_buffer *buffer,
+                                  struct simplessh_arena *arena,
+                                  size_t size) {
+  struct simplessh_slab *slab;
+  size_t dropped = 0, first;
+
+  if(buffer->len <= size) return 0;
+
+  for(;;) {
+    slab  = buffer->head;
+    first = slab->len - buffer->skip;
+    if(slab->next == NULL || buffer->len - first < size) break;
+
+    buffer->head  = slab->next;
+    buffer->skip  = 0;
+    buffer->len  -= first;
+    dropped      += first;
+    slab_release(arena, slab);
+  }
+
+  first = buffer->len - size;
+  buffer->skip += first;
+  buffer->len   = size;
+  return dropped + first;
+}
+
+/* Give the content away as a single NUL-terminated malloc'd block.
+ *
+ * A single slab is handed over as is unless it is a mostly empty standard
+ * slab, which is worth copying from to keep it in the arena. Otherwise the
+ * slabs are copied once into a block of the exact size. */
+char *simplessh_buffer_finish(struct simplessh_buffer *buffer,
+                              struct simplessh_arena *arena,
+                              size_t *len) {
+  struct simplessh_slab *slab = buffer->head;
+  char *data, *current;
+
+  *len = buffer->len;
+
+  if(slab != NULL && slab->next == NULL &&
+     (slab->size != SIMPLESSH_SLAB_SIZE ||
+      slab->len >= SIMPLESSH_SLAB_SIZE / 4)) {
+    if(buffer->skip > 0) memmove(slab->data, slab->data + buffer->skip, *len);
+    data = realloc(slab->data, *len + 1);
+    free(slab);
+  } else {
+    data = current = malloc(buffer->len + 1);
+    while(slab != NULL) {
+      buffer->head = slab->next;
+      memcpy(current, slab->data + buffer->skip, slab->len - buffer->skip);
+      current += slab->len - buffer->skip;
+      buffer->skip = 0;
+      slab_release(arena, slab);
+      slab = buffer->head;
+    }
+  }
+
+  data[*len] = '\0';
+  simplessh_buffer_init(buffer);
+  return data;
+}
+
+void simplessh_buffer_free(struct simplessh_buffer *buffer,
+                           struct simplessh_arena *arena) {
+  struct simplessh_slab *slab;
+
+  while(buffer->head != NULL) {
+    slab = buffer->head;
+    buffer->head = slab->next;
+    slab_release(arena, slab);
+  }
+  simplessh_buffer_init(buffer);
+}
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <simplessh/connect.h>
+
+struct dns_entry {
+  char *hostname;
+  uint16_t port;
+  int64_t expires; // in microseconds on the monotonic clock
+  struct simplessh_address *addresses;
+  int count;
+  struct dns_entry *next;
+};
+
+static pthread_mutex_t dns_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dns_entry *dns_cache = NULL; // most recent first
+static int dns_ttl   = SIMPLESSH_DNS_TTL;
+
+static int64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void dns_entry_free(struct dns_entry *entry) {
+  free(entry->hostname);
+  free(entry->addresses);
+  free(entry);
+}
+
+/* Drop the expired entries and, if the cache is still full, the oldest ones.
+ * Must be called with the lock held. */
+static void dns_sweep(int64_t now) {
+  struct dns_entry **entry = &dns_cache, *tmp;
+  int kept = 0;
+
+  while(*entry != NULL) {
+    if((*entry)->expires <= now || kept >= SIMPLESSH_DNS_MAX - 1) {
+      tmp = *entry;
+      *entry = tmp->next;
+      dns_entry_free(tmp);
+    } else {
+      kept++;
+      entry = &(*entry)->next;
+    }
+  }
+}
+
+static void address_copy(struct simplessh_address *address,
+                         struct addrinfo *info) {
+  address->family   = info->ai_family;
+  address->socktype = info->ai_socktype;
+  address->protocol = info->ai_protocol;
+  address->len      = info->ai_addrlen;
+  memcpy(&address->addr, info->ai_addr, info->ai_addrlen);
+}
+
+/* Copy the addresses from getaddrinfo, alternating between the family of the
+ * first one, usually IPv6, and the others while keeping their order. */
+static int interleave(struct addrinfo *res,
+                      struct simplessh_address **addresses) {
+  struct addrinfo *current, **primary, **secondary;
+  int count = 0, n1 = 0, n2 = 0, i = 0, j;
+
+  for(current = res; current != NULL; current = current->ai_next) count++;
+
+  primary    = malloc(count * sizeof(struct addrinfo*));
+  secondary  = malloc(count * sizeof(struct addrinfo*));
+  *addresses = malloc(count * sizeof(struct simplessh_address));
+
+  for(current = res; current != NULL; current = current->ai_next) {
+    if(current->ai_family == res->ai_family) primary[n1++] = current;
+    else secondary[n2++] = current;
+  }
+
+  for(j = 0; j < n1 || j < n2; j++) {
+    if(j < n1) address_copy(&(*addresses)[i++], primary[j]);
+    if(j < n2) address_copy(&(*addresses)[i++], secondary[j]);
+  }
+
+  free(primary);
+  free(secondary);
+  return count;
+}
+
+/* Resolve a name, going through the cache. `*addresses` is to be freed by
+ * the caller. Returns 0 on success and CONNECT otherwise. */
+int simplessh_resolve(const char *hostname,
+                      uint16_t port,
+                      struct simplessh_address **addresses,
+                      int *count) {
+  struct addrinfo hints, *res = NULL;
+  struct dns_entry *entry;
+  char service[6]; // enough to contain a port number
+  int64_t now = now_us();
+
+  pthread_mutex_lock(&dns_lock);
+  for(entry = dns_cache; entry != NULL; entry = entry->next) {
+    if(entry->port == port && entry->expires > now &&
+       strcmp(entry->hostname, hostname) == 0) {
+      *count     = entry->count;
+      *addresses = malloc(entry->count * sizeof(struct simplessh_address));
+      memcpy(*addresses, entry->addresses,
+             entry->count * sizeof(struct simplessh_address));
+      pthread_mutex_unlock(&dns_lock);
+      return 0;
+    }
+  }
+  pthread_mutex_unlock(&dns_lock);
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags    = AI_NUMERICSERV;
+
+  snprintf(service, sizeof(service), "%u", port);
+  if(getaddrinfo(hostname, service, &hints, &res) != 0 || res == NULL) {
+    if(res) freeaddrinfo(res);
+    return CONNECT;
+  }
+
+  *count = interleave(res, addresses);
+  freeaddrinfo(res);
+
+  pthread_mutex_lock(&dns_lock);
+  if(dns_ttl > 0) {
+    dns_sweep(now);
+
+    entry = malloc(sizeof(struct dns_entry));
+    entry->hostname  = strdup(hostname);
+    entry->port      = port;
+    entry->expires   = now + (int64_t)dns_ttl * 1000000;
+    entry->count     = *count;
+    entry->addresses = malloc(*count * sizeof(struct simplessh_address));
+    memcpy(entry->addresses, *addresses,
+           *count * sizeof(struct simplessh_address));
+    entry->next = dns_cache;
+    dns_cache   = entry;
+  }
+  pthread_mutex_unlock(&dns_lock);
+
+  return 0;
+}
+
+/* Set the options of a TCP socket, NULL leaving them untouched. Buffer sizes
+ * are best set before connecting, for the window scale to be negotiated
+ * accordingly. Returns -1 if any of them could not be set. */
+int simplessh_apply_socket_options(
+    int sock,
+    const struct simplessh_socket_options *options) {
+  int rc = 0, keepalive;
+
+  if(options == NULL) return 0;
+
+  keepalive = options->keepalive > 0;
+  rc |= setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &options->nodelay,
+                   sizeof(int));
+  rc |= setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(int));
+
+  if(options->sndbuf > 0)
+    rc |= setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &options->sndbuf,
+                     sizeof(int));
+  if(options->rcvbuf > 0)
+    rc |= setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &options->rcvbuf,
+                     sizeof(int));
+
+#ifdef TCP_KEEPIDLE
+  if(keepalive)
+    rc |= setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &options->keepalive,
+                     sizeof(int));
+#endif
+#ifdef TCP_KEEPINTVL
+  if(keepalive && options->keepalive_interval > 0)
+    rc |= setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL,
+                     &options->keepalive_interval, sizeof(int));
+#endif
+#ifdef TCP_USER_TIMEOUT
+  rc |= setsockopt(sock, IPPROTO_TCP, TCP_USER_TIMEOUT,
+                   &options->user_timeout, sizeof(int));
+#endif
+
+  return rc ? -1 : 0;
+}
+
+/* Start connecting to an address. Returns the socket, connected or not, or
+ * -1 if the attempt failed straight away. */
+static int attempt(struct simplessh_address *address,
+                   const struct simplessh_socket_options *options,
+                   int *connected) {
+  int sock;
+
+  sock = socket(address->family, address->socktype, address->protocol);
+  if(sock == -1) return -1;
+  fcntl(sock, F_SETFL, O_NONBLOCK);
+  simplessh_apply_socket_options(sock, options);
+
+  *connected = connect(sock, (struct sockaddr*)&address->addr,
+                       address->len) == 0;
+  if(*connected || errno == EINPROGRESS || errno == EINTR) return sock;
+
+  close(sock);
+  return -1;
+}
+
+/* Connect to a host within `timeout` milliseconds and return the socket, in
+ * blocking mode, or -1. An attempt completes when the socket is writable,
+ * SO_ERROR telling whether it succeeded. The time spent resolving and
+ * connecting is stored in microseconds. */
+int simplessh_connect_socket(const char *hostname,
+                             uint16_t port,
+                             int timeout,
+                             const struct simplessh_socket_options *options,
+                             int64_t *resolve_time,
+                             int64_t *connect_time) {
+  struct simplessh_address *addresses;
+  struct pollfd *fds;
+  int64_t start, now, deadline, next_attempt, until;
+  int count, next = 0, active = 0, sock = -1, connected, error, i, rc;
+  socklen_t len;
+
+  start = now_us();
+  if(simplessh_resolve(hostname, port, &addresses, &count)) return -1;
+  now = now_us();
+  *resolve_time = now - start;
+
+  fds = malloc(count * sizeof(struct pollfd));
+  deadline     = now + (int64_t)timeout * 1000;
+  next_attempt = now;
+
+  while(sock == -1 && now < deadline) {
+    if(next < count && now >= next_attempt) {
+      rc = attempt(&addresses[next++], options, &connected);
+      if(rc != -1 && connected) {
+        sock = rc;
+        break;
+      }
+
+      if(rc != -1) {
+        fds[active].fd      = rc;
+        fds[active].events  = POLLOUT;
+        fds[active].revents = 0;
+        active++;
+        next_attempt = now + SIMPLESSH_ATTEMPT_DELAY * 1000;
+      }
+      continue;
+    }
+
+    if(active == 0) break; // every address failed
+
+    until = next < count && next_attempt < deadline ? next_attempt : deadline;
+    rc = poll(fds, active, (int)((until - now + 999) / 1000));
+    if(rc == -1 && errno != EINTR) break;
+
+    for(i = 0; rc > 0 && i < active; i++) {
+      if(fds[i].revents == 0) continue;
+
+      len = sizeof(int);
+      if(getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1)
+        error = errno;
+      if(error == 0) {
+        sock = fds[i].fd;
+        fds[i] = fds[--active];
+        break;
+      }
+
+      // Failed, try the next address without waiting for the delay
+      close(fds[i].fd);
+      fds[i--] = fds[--active];
+      next_attempt = now;
+    }
+
+    now = now_us();
+  }
+
+  for(i = 0; i < active; i++) close(fds[i].fd);
+  free(fds);
+  free(addresses);
+
+  if(sock != -1) {
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+    *connect_time = now_us() - start - *resolve_time;
+  }
+
+  return sock;
+}
+
+/* Set for how long resolved names are kept, 0 disabling the cache. */
+void simplessh_set_dns_ttl(int ttl) {
+  pthread_mutex_lock(&dns_lock);
+  dns_ttl = ttl;
+  pthread_mutex_unlock(&dns_lock);
+  if(ttl <= 0) simplessh_flush_dns_cache();
+}
+
+void simplessh_flush_dns_cache(void) {
+  struct dns_entry *entry;
+
+  pthread_mutex_lock(&dns_lock);
+  while(dns_cache != NULL) {
+    entry = dns_cache;
+    dns_cache = entry->next;
+    dns_entry_free(entry);
+  }
+  pthread_mutex_unlock(&dns_lock);
+}
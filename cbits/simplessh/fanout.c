@@ -0,0 +1,352 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <libssh2.h>
+#include <simplessh.h>
+#include <simplessh/fanout.h>
+
+#define SIMPLESSH_FANOUT_EVENTS 64 // events handled per epoll_wait
+
+static int64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static char *copy(const char *str) {
+  return str == NULL ? NULL : strdup(str);
+}
+
+struct simplessh_hosts *simplessh_hosts_new(int count) {
+  struct simplessh_hosts *hosts = malloc(sizeof(struct simplessh_hosts));
+
+  hosts->count = count;
+  hosts->hosts = calloc(count, sizeof(struct simplessh_host));
+  return hosts;
+}
+
+static struct simplessh_host *host_set(struct simplessh_hosts *hosts,
+                                       int i,
+                                       const char *hostname,
+                                       uint16_t port,
+                                       const char *username) {
+  struct simplessh_host *host = &hosts->hosts[i];
+
+  host->hostname = copy(hostname);
+  host->port     = port;
+  host->username = copy(username);
+  host->state    = HOST_PENDING;
+  return host;
+}
+
+void simplessh_hosts_set_password(struct simplessh_hosts *hosts,
+                                  int i,
+                                  const char *hostname,
+                                  uint16_t port,
+                                  const char *username,
+                                  const char *password) {
+  host_set(hosts, i, hostname, port, username)->password = copy(password);
+}
+
+void simplessh_hosts_set_key(struct simplessh_hosts *hosts,
+                             int i,
+                             const char *hostname,
+                             uint16_t port,
+                             const char *username,
+                             const char *public_key_path,
+                             const char *private_key_path,
+                             const char *passphrase) {
+  struct simplessh_host *host = host_set(hosts, i, hostname, port, username);
+
+  host->public_key_path  = copy(public_key_path);
+  host->private_key_path = copy(private_key_path);
+  host->passphrase       = copy(passphrase);
+}
+
+/* The key must outlive the call to simplessh_exec_on_hosts, it is shared by
+ * all the hosts using it. */
+void simplessh_hosts_set_key_handle(struct simplessh_hosts *hosts,
+                                    int i,
+                                    const char *hostname,
+                                    uint16_t port,
+                                    const char *username,
+                                    const struct simplessh_key *key) {
+  host_set(hosts, i, hostname, port, username)->key = key;
+}
+
+void simplessh_hosts_set_agent(struct simplessh_hosts *hosts,
+                               int i,
+                               const char *hostname,
+                               uint16_t port,
+                               const char *username) {
+  host_set(hosts, i, hostname, port, username)->agent = 1;
+}
+
+/* Check the outcome of the connection in progress, if any, and move on to
+ * the next address until one connects or is in progress. */
+static int host_connect(struct simplessh_host *host) {
+  struct simplessh_session *session = host->session;
+  struct simplessh_address *address;
+  socklen_t len = sizeof(int);
+  int error;
+
+  if(session->sock != -1) {
+    if(getsockopt(session->sock, SOL_SOCKET, SO_ERROR, &error, &len) == -1)
+      error = errno;
+    if(error == 0) return 0;
+
+    close(session->sock);
+    session->sock = -1;
+    host->address++;
+  }
+
+  for(; host->address < host->address_count; host->address++) {
+    address = &host->addresses[host->address];
+    session->sock = socket(address->family, address->socktype,
+                           address->protocol);
+    if(session->sock == -1) continue;
+    fcntl(session->sock, F_SETFL, O_NONBLOCK);
+
+    if(connect(session->sock, (struct sockaddr*)&address->addr,
+               address->len) == 0)
+      return 0;
+    if(errno == EINPROGRESS || errno == EINTR) return LIBSSH2_ERROR_EAGAIN;
+
+    close(session->sock);
+    session->sock = -1;
+  }
+
+  return CONNECT;
+}
+
+/* Drive a host as far as possible without blocking, with the same return
+ * values as simplessh_exec_step. */
+static int host_step(struct simplessh_host *host) {
+  struct simplessh_session *session = host->session;
+  int rc;
+
+  switch(host->state) {
+  case HOST_PENDING:
+  case HOST_CONNECT:
+    host->state = HOST_CONNECT;
+    rc = host_connect(host);
+    if(rc) return rc;
+    host->state = HOST_HANDSHAKE;
+    // fall through
+
+  case HOST_HANDSHAKE:
+    rc = simplessh_handshake_step(session);
+    if(rc) return rc;
+    host->state = HOST_AUTH;
+    // fall through
+
+  case HOST_AUTH:
+    if(host->password != NULL)
+      rc = simplessh_authenticate_password_step(session, host->username,
+                                                host->password);
+    else if(host->key != NULL)
+      rc = simplessh_authenticate_key_handle_step(session, host->username,
+                                                  host->key);
+    else if(host->agent)
+      rc = simplessh_authenticate_agent_step(session, host->username);
+    else
+      rc = simplessh_authenticate_key_step(session, host->username,
+                                           host->public_key_path,
+                                           host->private_key_path,
+                                           host->passphrase);
+    if(rc) return rc;
+    host->state = HOST_EXEC;
+    // fall through
+
+  case HOST_EXEC:
+    rc = simplessh_exec_step(session, &host->exec);
+    if(rc) return rc;
+    host->state = HOST_DONE;
+    // fall through
+
+  case HOST_DONE:
+    return 0;
+  }
+
+  return 0;
+}
+
+/* Watch the socket of a host in the direction it is blocked on. */
+static void host_watch(int epfd, struct simplessh_host *host) {
+  struct epoll_event event;
+  int dir;
+
+  event.data.ptr = host;
+  event.events   = 0;
+
+  if(host->state == HOST_CONNECT) {
+    event.events = EPOLLOUT;
+  } else {
+    dir = libssh2_session_block_directions(host->session->lsession);
+    if(dir & LIBSSH2_SESSION_BLOCK_INBOUND)  event.events |= EPOLLIN;
+    if(dir & LIBSSH2_SESSION_BLOCK_OUTBOUND) event.events |= EPOLLOUT;
+    if(event.events == 0) event.events = EPOLLIN;
+  }
+
+  // The socket may be new since the last wait when an address failed
+  if(epoll_ctl(epfd, EPOLL_CTL_MOD, host->session->sock, &event) == -1 &&
+     errno == ENOENT)
+    epoll_ctl(epfd, EPOLL_CTL_ADD, host->session->sock, &event);
+}
+
+/* Resolve the host, through the cache, and start connecting to it. Names
+ * are resolved synchronously. */
+static int host_start(struct simplessh_host *host,
+                      const char *command,
+                      int timeout) {
+  host->deadline = now_ms() + timeout;
+  host->session  = simplessh_session_new(timeout);
+  host->state    = HOST_CONNECT;
+  simplessh_exec_init(&host->exec, command);
+  if(host->session->lsession == NULL) return INIT;
+
+  if(simplessh_resolve(host->hostname, host->port, &host->addresses,
+                       &host->address_count))
+    return CONNECT;
+
+  host->address = 0;
+  return host_step(host);
+}
+
+/* Record the outcome of a host and release everything it holds. */
+static void host_finish(int epfd, struct simplessh_host *host, int rc) {
+  struct simplessh_session *session = host->session;
+
+  if(session != NULL) {
+    if(session->sock != -1)
+      epoll_ctl(epfd, EPOLL_CTL_DEL, session->sock, NULL);
+
+    if(rc) {
+      simplessh_exec_cleanup(session, &host->exec);
+      if(host->exec.result != NULL) simplessh_free_result(host->exec.result);
+      host->exec.result = NULL;
+    }
+
+    simplessh_close_session(session);
+    host->session = NULL;
+  }
+
+  free(host->addresses);
+  host->addresses = NULL;
+
+  host->result = simplessh_either_new(rc, rc ? NULL : host->exec.result);
+  host->state  = HOST_DONE;
+}
+
+/* Run `command` on every host, with at most `concurrency` of them in
+ * progress at the same time. Each host has `timeout` milliseconds from the
+ * moment it starts to go from connection to the end of the command, failing
+ * with TIMEOUT otherwise.
+ *
+ * The outcome of each host is then available through
+ * simplessh_hosts_take_result. */
+void simplessh_exec_on_hosts(struct simplessh_hosts *hosts,
+                             const char *command,
+                             int concurrency,
+                             int timeout) {
+  struct epoll_event events[SIMPLESSH_FANOUT_EVENTS];
+  struct simplessh_host *host;
+  int64_t current, wait;
+  int epfd, i, n, rc, next = 0, oldest = 0, running = 0;
+
+  if(concurrency <= 0) concurrency = hosts->count;
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(epfd == -1) {
+    for(i = 0; i < hosts->count; i++)
+      host_finish(epfd, &hosts->hosts[i], CONNECT);
+    return;
+  }
+
+  for(;;) {
+    while(running < concurrency && next < hosts->count) {
+      host = &hosts->hosts[next++];
+      rc = host_start(host, command, timeout);
+      if(rc == LIBSSH2_ERROR_EAGAIN) {
+        host_watch(epfd, host);
+        running++;
+      } else {
+        host_finish(epfd, host, rc);
+      }
+    }
+
+    /* All the hosts have the same timeout, so the deadlines follow the order
+     * in which they were started and the oldest host running is the next one
+     * to expire. */
+    while(oldest < next && hosts->hosts[oldest].state == HOST_DONE) oldest++;
+    if(oldest == next) {
+      if(next == hosts->count) break;
+      continue;
+    }
+
+    wait = hosts->hosts[oldest].deadline - now_ms();
+    n = epoll_wait(epfd, events, SIMPLESSH_FANOUT_EVENTS,
+                   wait > 0 ? (int)wait : 0);
+    if(n == -1 && errno != EINTR) break;
+
+    for(i = 0; i < n; i++) {
+      host = events[i].data.ptr;
+      rc = host_step(host);
+      if(rc == LIBSSH2_ERROR_EAGAIN) {
+        host_watch(epfd, host);
+      } else {
+        host_finish(epfd, host, rc);
+        running--;
+      }
+    }
+
+    current = now_ms();
+    for(i = oldest; i < next && hosts->hosts[i].deadline <= current; i++) {
+      if(hosts->hosts[i].state == HOST_DONE) continue;
+      host_finish(epfd, &hosts->hosts[i], TIMEOUT);
+      running--;
+    }
+  }
+
+  // Only when epoll_wait failed
+  for(i = oldest; i < hosts->count; i++)
+    if(hosts->hosts[i].state != HOST_DONE)
+      host_finish(epfd, &hosts->hosts[i], TIMEOUT);
+
+  close(epfd);
+}
+
+/* Take the outcome of a host, an either of a simplessh_result. */
+struct simplessh_either *simplessh_hosts_take_result(
+    struct simplessh_hosts *hosts,
+    int i) {
+  struct simplessh_either *either = hosts->hosts[i].result;
+
+  hosts->hosts[i].result = NULL;
+  return either;
+}
+
+void simplessh_hosts_free(struct simplessh_hosts *hosts) {
+  struct simplessh_host *host;
+  int i;
+
+  for(i = 0; i < hosts->count; i++) {
+    host = &hosts->hosts[i];
+    free(host->hostname);
+    free(host->username);
+    free(host->password);
+    free(host->public_key_path);
+    free(host->private_key_path);
+    free(host->passphrase);
+    if(host->result != NULL) simplessh_free_either_result(host->result);
+  }
+
+  free(hosts->hosts);
+  free(hosts);
+}
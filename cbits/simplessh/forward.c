@@ -0,0 +1,738 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <libssh2.h>
+#include <simplessh.h>
+#include <simplessh/connect.h>
+#include <simplessh/forward.h>
+
+// Errors of libssh2 meaning the whole session is gone, not just a channel
+#define sessionError(rc) \
+  ((rc) == LIBSSH2_ERROR_SOCKET_SEND || (rc) == LIBSSH2_ERROR_SOCKET_RECV || \
+   (rc) == LIBSSH2_ERROR_SOCKET_DISCONNECT || (rc) == LIBSSH2_ERROR_TIMEOUT)
+
+#define wouldBlock() (errno == EAGAIN || errno == EWOULDBLOCK)
+
+static void set_nonblocking(int sock) {
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+}
+
+static struct simplessh_forward *forward_new(
+    struct simplessh_session *session,
+    enum simplessh_forward_kind kind,
+    const char *host,
+    uint16_t port) {
+  struct simplessh_forward *forward = malloc(sizeof(struct simplessh_forward));
+
+  forward->session     = session;
+  forward->kind        = kind;
+  forward->listen_sock = -1;
+  forward->listener    = NULL;
+  forward->bound_port  = 0;
+  forward->host        = strdup(host);
+  forward->port        = port;
+  forward->tunnels     = NULL;
+  forward->count       = 0;
+  forward->pending     = NULL;
+  forward->stopping    = 0;
+  pthread_mutex_init(&forward->lock, NULL);
+  pthread_cond_init(&forward->opened, NULL);
+
+  if(pipe(forward->wakeup) == -1) {
+    pthread_cond_destroy(&forward->opened);
+    pthread_mutex_destroy(&forward->lock);
+    free(forward->host);
+    free(forward);
+    return NULL;
+  }
+  set_nonblocking(forward->wakeup[0]);
+  set_nonblocking(forward->wakeup[1]);
+  return forward;
+}
+
+/* Listen on the first address of `hostname` which can be bound. Returns the
+ * socket, nonblocking, or -1. */
+static int listen_on(const char *hostname, uint16_t port, int *bound_port) {
+  struct simplessh_address *addresses;
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  int count, i, sock = -1, yes = 1;
+
+  if(simplessh_resolve(hostname, port, &addresses, &count)) return -1;
+
+  for(i = 0; i < count && sock == -1; i++) {
+    sock = socket(addresses[i].family, addresses[i].socktype,
+                  addresses[i].protocol);
+    if(sock == -1) continue;
+
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+    if(bind(sock, (struct sockaddr*)&addresses[i].addr, addresses[i].len) ||
+       listen(sock, SIMPLESSH_FORWARD_BACKLOG)) {
+      close(sock);
+      sock = -1;
+    }
+  }
+  free(addresses);
+  if(sock == -1) return -1;
+
+  set_nonblocking(sock);
+  getsockname(sock, (struct sockaddr*)&addr, &len);
+  *bound_port = ntohs(addr.ss_family == AF_INET6
+                        ? ((struct sockaddr_in6*)&addr)->sin6_port
+                        : ((struct sockaddr_in*)&addr)->sin_port);
+  return sock;
+}
+
+/* Listen on `listen_host`:`listen_port` and relay every connection to
+ * `remote_host`:`remote_port` as seen from the server. Port 0 picks a free
+ * port, see simplessh_forward_port. */
+struct simplessh_either *simplessh_forward_local(
+    struct simplessh_session *session,
+    const char *listen_host,
+    uint16_t listen_port,
+    const char *remote_host,
+    uint16_t remote_port) {
+  struct simplessh_forward *forward;
+
+  forward = forward_new(session, FORWARD_LOCAL, remote_host, remote_port);
+  if(forward == NULL) return simplessh_either_new(CONNECT, NULL);
+
+  forward->listen_sock = listen_on(listen_host, listen_port,
+                                   &forward->bound_port);
+  if(forward->listen_sock == -1) {
+    simplessh_forward_free(forward);
+    return simplessh_either_new(CONNECT, NULL);
+  }
+
+  return simplessh_either_new(0, forward);
+}
+
+/* Ask the server to listen on `bind_host`:`bind_port` and relay every
+ * connection it accepts to `local_host`:`local_port`. Port 0 lets the server
+ * pick the port. */
+struct simplessh_either *simplessh_forward_remote(
+    struct simplessh_session *session,
+    const char *bind_host,
+    uint16_t bind_port,
+    const char *local_host,
+    uint16_t local_port) {
+  struct simplessh_forward *forward;
+  int error;
+
+  forward = forward_new(session, FORWARD_REMOTE, local_host, local_port);
+  if(forward == NULL) return simplessh_either_new(CONNECT, NULL);
+
+  waitLoopPtr(session, forward->listener,
+              libssh2_channel_forward_listen_ex(session->lsession,
+                                                bind_host, bind_port,
+                                                &forward->bound_port,
+                                                SIMPLESSH_FORWARD_BACKLOG));
+  if(forward->listener == NULL) {
+    error = libssh2_session_last_errno(session->lsession)
+              == LIBSSH2_ERROR_EAGAIN ? TIMEOUT : CHANNEL_OPEN;
+    simplessh_forward_free(forward);
+    return simplessh_either_new(error, NULL);
+  }
+
+  return simplessh_either_new(0, forward);
+}
+
+int simplessh_forward_port(struct simplessh_forward *forward) {
+  return forward->bound_port;
+}
+
+// Number of connections being relayed
+int simplessh_forward_count(struct simplessh_forward *forward) {
+  return forward->count;
+}
+
+static void flow_init(struct simplessh_flow *flow) {
+  simplessh_buffer_init(&flow->buffer);
+  flow->data = NULL;
+  flow->size = flow->len = flow->pos = 0;
+  flow->eof  = flow->done = 0;
+}
+
+static struct simplessh_tunnel *tunnel_new(int sock, LIBSSH2_CHANNEL *channel) {
+  struct simplessh_tunnel *tunnel = malloc(sizeof(struct simplessh_tunnel));
+
+  tunnel->state   = channel != NULL ? TUNNEL_RELAY : TUNNEL_OPEN;
+  tunnel->sock    = sock;
+  tunnel->channel = channel;
+  tunnel->host    = NULL;
+  tunnel->port    = 0;
+  tunnel->waiter  = NULL;
+  strcpy(tunnel->peer_host, "127.0.0.1");
+  tunnel->peer_port = 0;
+
+  flow_init(&tunnel->up);
+  flow_init(&tunnel->down);
+  tunnel->next = NULL;
+  return tunnel;
+}
+
+/* Start relaying a tunnel. The slabs come from the arena of the session and
+ * so are only taken from the thread running the forward. */
+static struct simplessh_tunnel *tunnel_link(struct simplessh_forward *forward,
+                                            struct simplessh_tunnel *tunnel) {
+  struct simplessh_arena *arena = &forward->session->arena;
+
+  tunnel->up.data   = simplessh_buffer_reserve(&tunnel->up.buffer, arena,
+                                               &tunnel->up.size);
+  tunnel->down.data = simplessh_buffer_reserve(&tunnel->down.buffer, arena,
+                                               &tunnel->down.size);
+
+  tunnel->next     = forward->tunnels;
+  forward->tunnels = tunnel;
+  forward->count++;
+  return tunnel;
+}
+
+static struct simplessh_tunnel *tunnel_add(struct simplessh_forward *forward,
+                                           int sock,
+                                           LIBSSH2_CHANNEL *channel) {
+  return tunnel_link(forward, tunnel_new(sock, channel));
+}
+
+/* Tell the thread waiting in simplessh_jump_connect, if any, whether the
+ * channel of a tunnel could be opened. */
+static void tunnel_opened(struct simplessh_forward *forward,
+                          struct simplessh_tunnel *tunnel,
+                          int status) {
+  if(forward->kind != FORWARD_JUMP) return;
+
+  pthread_mutex_lock(&forward->lock);
+  if(tunnel->waiter != NULL) {
+    *tunnel->waiter = status;
+    tunnel->waiter  = NULL;
+    pthread_cond_broadcast(&forward->opened);
+  }
+  pthread_mutex_unlock(&forward->lock);
+}
+
+static void tunnel_free(struct simplessh_forward *forward,
+                        struct simplessh_tunnel *tunnel) {
+  struct simplessh_arena *arena = &forward->session->arena;
+
+  tunnel_opened(forward, tunnel, -1);
+  if(forward->session->opening == tunnel) forward->session->opening = NULL;
+  if(tunnel->channel != NULL) libssh2_channel_free(tunnel->channel);
+  if(tunnel->sock != -1) close(tunnel->sock);
+  simplessh_buffer_free(&tunnel->up.buffer, arena);
+  simplessh_buffer_free(&tunnel->down.buffer, arena);
+  free(tunnel->host);
+  free(tunnel);
+  forward->count--;
+}
+
+// Accept the pending local connections, their channels being opened later
+static int accept_local(struct simplessh_forward *forward) {
+  struct simplessh_tunnel *tunnel;
+  struct sockaddr_storage addr;
+  socklen_t len;
+  char port[6];
+  int sock, yes = 1, accepted = 0;
+
+  for(;;) {
+    len  = sizeof(addr);
+    sock = accept(forward->listen_sock, (struct sockaddr*)&addr, &len);
+    if(sock == -1) {
+      if(errno == EINTR || errno == ECONNABORTED) continue;
+      return accepted;
+    }
+
+    set_nonblocking(sock);
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(int));
+    tunnel = tunnel_add(forward, sock, NULL);
+    if(getnameinfo((struct sockaddr*)&addr, len,
+                   tunnel->peer_host, sizeof(tunnel->peer_host),
+                   port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) == 0)
+      tunnel->peer_port = atoi(port);
+    else
+      strcpy(tunnel->peer_host, "127.0.0.1");
+    accepted = 1;
+  }
+}
+
+/* Accept the channels opened by the server and connect each of them to the
+ * local target. The connection is made synchronously, the target being
+ * expected to be close. Returns 1 if something was accepted, 0 if not and an
+ * error if the session failed. */
+static int accept_remote(struct simplessh_forward *forward) {
+  struct simplessh_session *session = forward->session;
+  LIBSSH2_CHANNEL *channel;
+  int64_t resolve_time, connect_time;
+  int sock, yes = 1, rc, accepted = 0;
+
+  for(;;) {
+    channel = libssh2_channel_forward_accept(forward->listener);
+    if(channel == NULL) {
+      rc = libssh2_session_last_errno(session->lsession);
+      if(rc == LIBSSH2_ERROR_EAGAIN) return accepted;
+      return sessionError(rc) ? READ : accepted;
+    }
+
+    sock = simplessh_connect_socket(forward->host, forward->port,
+                                    session->timeout, NULL,
+                                    &resolve_time, &connect_time);
+    if(sock != -1) {
+      set_nonblocking(sock);
+      setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(int));
+    }
+
+    tunnel_add(forward, sock, channel)->state
+      = sock != -1 ? TUNNEL_RELAY : TUNNEL_CLOSE;
+    accepted = 1;
+  }
+}
+
+/* Move data from the socket to the channel, at most SIMPLESSH_DRAIN_BATCH
+ * bytes so that every tunnel gets its turn, and pass EOF on once the socket
+ * is done. Returns 1 if something moved, 0 if not and a libssh2 error, or -1
+ * for a socket error, if the tunnel is to be closed. */
+static int pump_up(struct simplessh_tunnel *tunnel) {
+  struct simplessh_flow *flow = &tunnel->up;
+  size_t total = 0;
+  ssize_t n, rc;
+
+  while(total < SIMPLESSH_DRAIN_BATCH) {
+    if(flow->pos == flow->len) {
+      if(flow->eof) break;
+
+      n = recv(tunnel->sock, flow->data, flow->size, 0);
+      if(n == -1 && errno == EINTR) continue;
+      if(n == -1 && wouldBlock()) break;
+      if(n == -1) return -1;
+      if(n == 0) {
+        flow->eof = 1;
+        break;
+      }
+      flow->len = n;
+      flow->pos = 0;
+    }
+
+    rc = libssh2_channel_write(tunnel->channel, flow->data + flow->pos,
+                               flow->len - flow->pos);
+    if(rc == LIBSSH2_ERROR_EAGAIN) break;
+    if(rc < 0) return rc;
+    flow->pos += rc;
+    total     += rc;
+  }
+
+  if(flow->eof && !flow->done && flow->pos == flow->len) {
+    rc = libssh2_channel_send_eof(tunnel->channel);
+    if(rc && rc != LIBSSH2_ERROR_EAGAIN) return rc;
+    if(rc == 0) {
+      flow->done = 1;
+      return 1;
+    }
+  }
+
+  return total > 0;
+}
+
+// Same as pump_up the other way round, EOF shutting the socket down for writes
+static int pump_down(struct simplessh_tunnel *tunnel) {
+  struct simplessh_flow *flow = &tunnel->down;
+  size_t total = 0;
+  ssize_t n, rc;
+
+  while(total < SIMPLESSH_DRAIN_BATCH) {
+    if(flow->pos == flow->len) {
+      if(flow->eof) break;
+
+      rc = libssh2_channel_read(tunnel->channel, flow->data, flow->size);
+      if(rc == LIBSSH2_ERROR_EAGAIN) break;
+      if(rc < 0) return rc;
+      if(rc == 0) {
+        if(libssh2_channel_eof(tunnel->channel)) flow->eof = 1;
+        break;
+      }
+      flow->len = rc;
+      flow->pos = 0;
+    }
+
+    n = send(tunnel->sock, flow->data + flow->pos, flow->len - flow->pos,
+             MSG_NOSIGNAL);
+    if(n == -1 && errno == EINTR) continue;
+    if(n == -1 && wouldBlock()) break;
+    if(n == -1) return -1;
+    flow->pos += n;
+    total     += n;
+  }
+
+  if(flow->eof && !flow->done && flow->pos == flow->len) {
+    shutdown(tunnel->sock, SHUT_WR);
+    flow->done = 1;
+    return 1;
+  }
+
+  return total > 0;
+}
+
+// Open, or go on opening, the direct-tcpip channel of a tunnel
+static LIBSSH2_CHANNEL *tunnel_channel(struct simplessh_forward *forward,
+                                       struct simplessh_tunnel *tunnel) {
+  return libssh2_channel_direct_tcpip_ex(
+           forward->session->lsession,
+           tunnel->host != NULL ? tunnel->host : forward->host,
+           tunnel->host != NULL ? tunnel->port : forward->port,
+           tunnel->peer_host, tunnel->peer_port);
+}
+
+/* Drive a tunnel as far as possible without blocking. Returns 1 if it made
+ * progress, 0 if not and READ if the session failed. The tunnel is freed
+ * once closed. */
+static int tunnel_step(struct simplessh_forward *forward,
+                       struct simplessh_tunnel **link) {
+  struct simplessh_tunnel *tunnel = *link;
+  struct simplessh_session *session = forward->session;
+  int rc, rc2;
+
+  switch(tunnel->state) {
+  case TUNNEL_OPEN:
+    if(session->opening != NULL && session->opening != tunnel) return 0;
+    session->opening = tunnel;
+
+    tunnel->channel = tunnel_channel(forward, tunnel);
+    if(tunnel->channel == NULL) {
+      rc = libssh2_session_last_errno(session->lsession);
+      if(rc == LIBSSH2_ERROR_EAGAIN) return 0;
+      session->opening = NULL;
+      if(sessionError(rc)) return READ;
+      tunnel_opened(forward, tunnel, -1);
+      tunnel->state = TUNNEL_CLOSE; // refused by the server
+      return 1;
+    }
+    session->opening = NULL;
+    tunnel_opened(forward, tunnel, 1);
+    tunnel->state = TUNNEL_RELAY;
+    // fall through
+
+  case TUNNEL_RELAY:
+    rc  = pump_up(tunnel);
+    rc2 = rc >= 0 ? pump_down(tunnel) : 0;
+    if(sessionError(rc) || sessionError(rc2)) return READ;
+
+    if(rc >= 0 && rc2 >= 0 && !(tunnel->up.done && tunnel->down.done))
+      return rc || rc2;
+    tunnel->state = TUNNEL_CLOSE;
+    // fall through
+
+  case TUNNEL_CLOSE:
+    if(tunnel->channel != NULL) {
+      rc = libssh2_channel_close(tunnel->channel);
+      if(rc == LIBSSH2_ERROR_EAGAIN) return 0;
+      if(sessionError(rc)) return READ;
+    }
+
+    *link = tunnel->next;
+    tunnel_free(forward, tunnel);
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Whether the session already holds data for the channel of a tunnel, read
+ * from the socket while another channel was being pumped. Reading a channel
+ * makes libssh2 read every packet waiting on the socket, queueing each on its
+ * own channel, so the socket may be empty while a tunnel stepped earlier in
+ * the round has data to pass on. */
+static int tunnel_pending(struct simplessh_tunnel *tunnel) {
+  struct simplessh_flow *flow = &tunnel->down;
+
+  if(tunnel->state != TUNNEL_RELAY || flow->eof || flow->pos < flow->len)
+    return 0;
+  return libssh2_poll_channel_read(tunnel->channel, 0) ||
+         libssh2_channel_eof(tunnel->channel);
+}
+
+/* Take the tunnels queued by simplessh_jump_connect. Returns 1 if the
+ * forward is to stop. */
+static int wakeup(struct simplessh_forward *forward) {
+  struct simplessh_tunnel *pending, *tunnel;
+  int stopping;
+
+  pthread_mutex_lock(&forward->lock);
+  stopping = forward->stopping;
+  pending  = forward->pending;
+  forward->pending = NULL;
+  pthread_mutex_unlock(&forward->lock);
+
+  while(pending != NULL) {
+    tunnel  = pending;
+    pending = tunnel->next;
+    tunnel_link(forward, tunnel);
+  }
+
+  return stopping;
+}
+
+// Add a descriptor to watch, returning its index
+static int watch(struct pollfd **fds, int *count, int *size,
+                 int fd, short events) {
+  if(*count == *size) {
+    *size = *size * 2 + 16;
+    *fds  = realloc(*fds, *size * sizeof(struct pollfd));
+  }
+
+  (*fds)[*count].fd      = fd;
+  (*fds)[*count].events  = events;
+  (*fds)[*count].revents = 0;
+  return (*count)++;
+}
+
+/* Relay the forwarded connections until simplessh_forward_stop is called,
+ * accepting new ones as they come. Every tunnel and the listener get a turn
+ * at each round, and the sockets are only waited on once none of them can
+ * make progress.
+ *
+ * The session must not be used by anything else in the meantime. Returns 0
+ * once stopped, READ if the session failed and TIMEOUT if keepalives went
+ * unanswered, see simplessh_set_keepalive. */
+int simplessh_forward_run(struct simplessh_forward *forward) {
+  struct simplessh_session *session = forward->session;
+  struct simplessh_tunnel **link, *tunnel;
+  struct pollfd *fds = NULL;
+  int count, size = 0, progress, rc, dir, next, unanswered = 0, error = 0;
+  int woken = 0;
+  short events;
+  char c;
+
+  while(!error) {
+    while(read(forward->wakeup[0], &c, 1) == 1) woken = 1;
+    if(woken && wakeup(forward)) break;
+    woken = 0;
+
+    progress = 0;
+    if(forward->kind == FORWARD_LOCAL) {
+      progress = accept_local(forward);
+    } else if(forward->kind == FORWARD_REMOTE) {
+      rc = accept_remote(forward);
+      if(rc == READ) error = READ;
+      progress = rc == 1;
+    }
+
+    for(link = &forward->tunnels; !error && *link != NULL;) {
+      tunnel = *link;
+      rc = tunnel_step(forward, link);
+      if(rc == READ) error = READ;
+      if(rc == 1) progress = 1;
+      if(*link == tunnel) link = &tunnel->next; // not freed
+    }
+
+    for(tunnel = forward->tunnels; !progress && tunnel != NULL;
+        tunnel = tunnel->next)
+      progress = tunnel_pending(tunnel);
+    if(error || progress) continue;
+
+    count = 0;
+    dir   = libssh2_session_block_directions(session->lsession);
+    watch(&fds, &count, &size, session->sock,
+          POLLIN | (dir & LIBSSH2_SESSION_BLOCK_OUTBOUND ? POLLOUT : 0));
+    watch(&fds, &count, &size, forward->wakeup[0], POLLIN);
+    if(forward->listen_sock != -1)
+      watch(&fds, &count, &size, forward->listen_sock, POLLIN);
+
+    for(tunnel = forward->tunnels; tunnel != NULL; tunnel = tunnel->next) {
+      if(tunnel->state != TUNNEL_RELAY) continue;
+
+      events = 0;
+      if(!tunnel->up.eof && tunnel->up.pos == tunnel->up.len)
+        events |= POLLIN;
+      if(tunnel->down.pos < tunnel->down.len) events |= POLLOUT;
+      if(events) watch(&fds, &count, &size, tunnel->sock, events);
+    }
+
+    next = simplessh_keepalive_tick(session);
+    if(next < 0) {
+      error = READ;
+      break;
+    }
+
+    do {
+      rc = poll(fds, count, next > 0 ? next : -1);
+    } while(rc == -1 && errno == EINTR);
+    if(rc == -1) {
+      error = READ;
+    } else if(rc == 0) {
+      if(session->keepalive_count_max > 0 &&
+         ++unanswered > session->keepalive_count_max)
+        error = TIMEOUT;
+    } else if(fds[0].revents) {
+      if(fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) error = READ;
+      unanswered = 0;
+    }
+  }
+
+  free(fds);
+  return error;
+}
+
+static void wake(struct simplessh_forward *forward) {
+  char c = 0;
+
+  while(write(forward->wakeup[1], &c, 1) == -1 && errno == EINTR);
+}
+
+/* Make simplessh_forward_run return. Can be called from any thread. */
+void simplessh_forward_stop(struct simplessh_forward *forward) {
+  pthread_mutex_lock(&forward->lock);
+  forward->stopping = 1;
+  pthread_mutex_unlock(&forward->lock);
+  wake(forward);
+}
+
+static void *jump_run(void *arg) {
+  struct simplessh_forward *forward = arg;
+  struct simplessh_tunnel *tunnel;
+
+  simplessh_forward_run(forward);
+
+  /* Stopped or the bastion is gone: refuse new connections and close the
+   * current ones, so that the sessions going through them fail now instead
+   * of timing out. */
+  pthread_mutex_lock(&forward->lock);
+  forward->stopping = 1;
+  pthread_mutex_unlock(&forward->lock);
+  wakeup(forward);
+
+  while(forward->tunnels != NULL) {
+    tunnel = forward->tunnels;
+    forward->tunnels = tunnel->next;
+    tunnel_free(forward, tunnel);
+  }
+
+  return NULL;
+}
+
+/* Relay connections to the hosts behind an authenticated bastion session, see
+ * simplessh_jump_connect. A thread is started to run the relay and owns the
+ * bastion session until simplessh_jump_free. */
+struct simplessh_either *simplessh_jump_new(struct simplessh_session *bastion) {
+  struct simplessh_forward *forward;
+
+  forward = forward_new(bastion, FORWARD_JUMP, "", 0);
+  if(forward == NULL) return simplessh_either_new(CONNECT, NULL);
+
+  if(pthread_create(&forward->thread, NULL, jump_run, forward)) {
+    simplessh_forward_free(forward);
+    return simplessh_either_new(CONNECT, NULL);
+  }
+
+  return simplessh_either_new(0, forward);
+}
+
+/* Open a direct-tcpip channel to `hostname`:`port` on the bastion and return
+ * a socket connected to it, in blocking mode, or -1 if the channel could not
+ * be opened within `timeout` milliseconds. The socket is one end of a socket
+ * pair whose other end is relayed, so it can be used as the socket of a
+ * session. Can be called from any thread. */
+int simplessh_jump_connect(struct simplessh_forward *forward,
+                           const char *hostname,
+                           uint16_t port,
+                           int timeout) {
+  struct simplessh_tunnel *tunnel;
+  struct timespec deadline;
+  int pair[2], status = 0, stopping;
+
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1) return -1;
+  set_nonblocking(pair[0]);
+
+  tunnel = tunnel_new(pair[0], NULL);
+  tunnel->host   = strdup(hostname);
+  tunnel->port   = port;
+  tunnel->waiter = &status;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec  += timeout / 1000;
+  deadline.tv_nsec += (timeout % 1000) * 1000000L;
+  if(deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&forward->lock);
+  stopping = forward->stopping;
+  if(!stopping) {
+    tunnel->next     = forward->pending;
+    forward->pending = tunnel;
+  }
+  pthread_mutex_unlock(&forward->lock);
+
+  if(stopping) {
+    close(pair[0]);
+    close(pair[1]);
+    free(tunnel->host);
+    free(tunnel);
+    return -1;
+  }
+  wake(forward);
+
+  pthread_mutex_lock(&forward->lock);
+  while(status == 0 &&
+        pthread_cond_timedwait(&forward->opened, &forward->lock, &deadline)
+          != ETIMEDOUT);
+  if(status == 0) tunnel->waiter = NULL; // given up, the relay closes it
+  pthread_mutex_unlock(&forward->lock);
+
+  if(status != 1) {
+    close(pair[1]);
+    return -1;
+  }
+
+  return pair[1];
+}
+
+/* Stop the relay, closing the connections going through the bastion. The
+ * bastion session is left open. */
+void simplessh_jump_free(struct simplessh_forward *forward) {
+  simplessh_forward_stop(forward);
+  pthread_join(forward->thread, NULL);
+  simplessh_forward_free(forward);
+}
+
+/* Close the forwarded connections and stop listening. */
+void simplessh_forward_free(struct simplessh_forward *forward) {
+  struct simplessh_tunnel *tunnel;
+  int rc;
+
+  wakeup(forward); // tunnels queued but never relayed
+
+  while(forward->tunnels != NULL) {
+    tunnel = forward->tunnels;
+    forward->tunnels = tunnel->next;
+
+    /* libssh2 is left in the middle of opening the channel until the call
+     * is made again, to success or failure. */
+    if(tunnel->state == TUNNEL_OPEN && forward->session->opening == tunnel)
+      waitLoopPtr(forward->session, tunnel->channel,
+                  tunnel_channel(forward, tunnel));
+
+    if(tunnel->channel != NULL)
+      waitLoop(forward->session, rc, libssh2_channel_close(tunnel->channel));
+    tunnel_free(forward, tunnel);
+  }
+
+  if(forward->listener != NULL)
+    waitLoop(forward->session, rc,
+             libssh2_channel_forward_cancel(forward->listener));
+  if(forward->listen_sock != -1) close(forward->listen_sock);
+
+  close(forward->wakeup[0]);
+  close(forward->wakeup[1]);
+  pthread_cond_destroy(&forward->opened);
+  pthread_mutex_destroy(&forward->lock);
+  free(forward->host);
+  free(forward);
+}
@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <simplessh.h>
+#include <simplessh/knownhosts.h>
+
+#define MATCHED 1
+#define CHANGED 2
+#define REVOKED 4
+
+static pthread_mutex_t stores_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct simplessh_knownhosts *stores = NULL;
+
+// FNV-1a
+static size_t hash(const char *s) {
+  uint64_t h = 14695981039346656037ULL;
+
+  for(; *s; s++) h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+  return (size_t)h;
+}
+
+static char *lower_dup(const char *s, size_t len) {
+  char *copy = malloc(len + 1);
+  size_t i;
+
+  for(i = 0; i < len; i++) copy[i] = tolower((unsigned char)s[i]);
+  copy[len] = '\0';
+  return copy;
+}
+
+static int base64_value(char c) {
+  if(c >= 'A' && c <= 'Z') return c - 'A';
+  if(c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if(c >= '0' && c <= '9') return c - '0' + 52;
+  if(c == '+') return 62;
+  if(c == '/') return 63;
+  return -1;
+}
+
+static unsigned char *base64_decode(const char *in, size_t *out_len) {
+  size_t len = strlen(in), n = 0, i;
+  unsigned char *out = malloc(len / 4 * 3 + 3);
+  uint32_t acc = 0;
+  int bits = 0, value;
+
+  for(i = 0; i < len && in[i] != '='; i++) {
+    value = base64_value(in[i]);
+    if(value < 0) {
+      free(out);
+      return NULL;
+    }
+    acc  = (acc << 6 | value) & 0xffffff;
+    bits += 6;
+    if(bits >= 8) {
+      bits -= 8;
+      out[n++] = acc >> bits & 0xff;
+    }
+  }
+
+  *out_len = n;
+  return out;
+}
+
+// Key blobs start with the name of their type
+static int same_type(const unsigned char *a, size_t a_len,
+                     const unsigned char *b, size_t b_len) {
+  size_t len;
+
+  if(a_len < 4 || b_len < 4) return 0;
+  len = 4 + ((size_t)a[0] << 24 | (size_t)a[1] << 16 | a[2] << 8 | a[3]);
+  return len <= a_len && len <= b_len && memcmp(a, b, len) == 0;
+}
+
+/* Match `s` against a pattern ending at `end`, '*' matching any number of
+ * characters and '?' exactly one. */
+static int glob(const char *pattern, const char *end, const char *s) {
+  for(; pattern < end; pattern++, s++) {
+    if(*pattern == '*') {
+      for(;; s++) {
+        if(glob(pattern + 1, end, s)) return 1;
+        if(*s == '\0') return 0;
+      }
+    }
+    if(*s == '\0' || (*pattern != '?' && *pattern != *s)) return 0;
+  }
+  return *s == '\0';
+}
+
+/* A list of patterns matches when one of them does and none of the negated
+ * ones ("!pattern") do, as in OpenSSH. */
+static int match_list(const char *list, const char *host) {
+  const char *end;
+  int negated, matched = 0;
+
+  for(; *list; list = *end ? end + 1 : end) {
+    end = strchr(list, ',');
+    if(end == NULL) end = list + strlen(list);
+    negated = *list == '!';
+    if(glob(list + negated, end, host)) {
+      if(negated) return 0;
+      matched = 1;
+    }
+  }
+  return matched;
+}
+
+static struct simplessh_knownhost *entry_new(char *host,
+                                             const unsigned char *key,
+                                             size_t key_len,
+                                             int revoked) {
+  struct simplessh_knownhost *entry;
+
+  entry = malloc(sizeof(struct simplessh_knownhost));
+  entry->host    = host;
+  entry->key     = malloc(key_len);
+  entry->key_len = key_len;
+  entry->revoked = revoked;
+  entry->next    = NULL;
+  memcpy(entry->key, key, key_len);
+  return entry;
+}
+
+static void entries_free(struct simplessh_knownhost *entry) {
+  struct simplessh_knownhost *tmp;
+
+  while(entry != NULL) {
+    tmp = entry;
+    entry = entry->next;
+    free(tmp->host);
+    free(tmp->key);
+    free(tmp);
+  }
+}
+
+static void index_add(struct simplessh_knownhosts *store,
+                      struct simplessh_knownhost *entry) {
+  struct simplessh_knownhost **buckets, *tmp;
+  size_t i, b;
+
+  if(store->count >= store->bucket_count * 2) {
+    buckets = calloc(store->bucket_count * 2,
+                     sizeof(struct simplessh_knownhost*));
+    for(i = 0; i < store->bucket_count; i++) {
+      while(store->buckets[i] != NULL) {
+        tmp = store->buckets[i];
+        store->buckets[i] = tmp->next;
+        b = hash(tmp->host) & (store->bucket_count * 2 - 1);
+        tmp->next  = buckets[b];
+        buckets[b] = tmp;
+      }
+    }
+    free(store->buckets);
+    store->buckets = buckets;
+    store->bucket_count *= 2;
+  }
+
+  b = hash(entry->host) & (store->bucket_count - 1);
+  entry->next = store->buckets[b];
+  store->buckets[b] = entry;
+  store->count++;
+}
+
+static void index_clear(struct simplessh_knownhosts *store) {
+  size_t i;
+
+  for(i = 0; i < store->bucket_count; i++) {
+    entries_free(store->buckets[i]);
+    store->buckets[i] = NULL;
+  }
+  entries_free(store->patterns);
+  store->patterns = NULL;
+  store->count    = 0;
+
+  libssh2_knownhost_free(store->hashed);
+  store->hashed       = libssh2_knownhost_init(store->lsession);
+  store->hashed_count = 0;
+}
+
+static char *token(char **p) {
+  char *start;
+
+  while(**p == ' ' || **p == '\t') (*p)++;
+  if(**p == '\0') return NULL;
+
+  start = *p;
+  while(**p != '\0' && **p != ' ' && **p != '\t') (*p)++;
+  if(**p != '\0') *(*p)++ = '\0';
+  return start;
+}
+
+/* Add a line of the file, `line` being NUL terminated. Certificate
+ * authorities are not supported and neither are revoked hashed entries. */
+static void parse_line(struct simplessh_knownhosts *store, char *line) {
+  struct simplessh_knownhost *entry;
+  char *p = line, *hosts, *type, *key, *end;
+  unsigned char *blob;
+  size_t blob_len, len = strlen(line);
+  int revoked = 0;
+
+  if(len > 0 && line[len - 1] == '\r') line[--len] = '\0';
+  while(*p == ' ' || *p == '\t') p++;
+  if(*p == '\0' || *p == '#') return;
+
+  if(*p == '@') {
+    if(strcmp(token(&p), "@revoked") != 0) return;
+    revoked = 1;
+    while(*p == ' ' || *p == '\t') p++;
+  }
+
+  if(*p == '|') {
+    if(!revoked &&
+       libssh2_knownhost_readline(store->hashed, p, strlen(p),
+                                  LIBSSH2_KNOWNHOST_FILE_OPENSSH) == 0)
+      store->hashed_count++;
+    return;
+  }
+
+  hosts = token(&p);
+  type  = token(&p);
+  key   = token(&p);
+  if(type == NULL || key == NULL) return;
+
+  blob = base64_decode(key, &blob_len);
+  if(blob == NULL) return;
+
+  if(strpbrk(hosts, "*?!") != NULL) {
+    entry = entry_new(lower_dup(hosts, strlen(hosts)), blob, blob_len,
+                      revoked);
+    entry->next = store->patterns;
+    store->patterns = entry;
+  } else {
+    for(; *hosts; hosts = *end ? end + 1 : end) {
+      end = strchr(hosts, ',');
+      if(end == NULL) end = hosts + strlen(hosts);
+      if(end > hosts)
+        index_add(store, entry_new(lower_dup(hosts, end - hosts), blob,
+                                   blob_len, revoked));
+    }
+  }
+
+  free(blob);
+}
+
+/* Parse the file from `offset`, which is 0 or the end of a line. Only the
+ * complete lines are taken when appending, the last one may still be being
+ * written. A full load also takes a last line without a newline, but the
+ * size recorded stops before it so that the next append parses it whole. */
+static int load(struct simplessh_knownhosts *store, int fd,
+                const struct stat *st, off_t offset) {
+  char *data, *line, *end;
+  size_t size = st->st_size - offset, len = 0;
+  ssize_t n = 0;
+
+  data = malloc(size + 1);
+  while(len < size) {
+    n = pread(fd, data + len, size - len, offset + len);
+    if(n == -1 && errno == EINTR) continue;
+    if(n <= 0) break;
+    len += n;
+  }
+  if(n == -1) {
+    free(data);
+    return -1;
+  }
+
+  for(line = data; (end = memchr(line, '\n', data + len - line)) != NULL;
+      line = end + 1) {
+    *end = '\0';
+    parse_line(store, line);
+  }
+  if(offset == 0 && line < data + len) {
+    data[len] = '\0';
+    parse_line(store, line);
+  }
+
+  store->size  = offset + (line - data);
+  store->dev   = st->st_dev;
+  store->ino   = st->st_ino;
+  store->mtime = st->st_mtime;
+  free(data);
+
+  store->tail_len = store->size < SIMPLESSH_KNOWNHOSTS_TAIL
+                    ? store->size : SIMPLESSH_KNOWNHOSTS_TAIL;
+  if(pread(fd, store->tail, store->tail_len, store->size - store->tail_len)
+     != (ssize_t)store->tail_len)
+    store->tail_len = 0;
+
+  return 0;
+}
+
+// Whether the bytes parsed last are still there, e.g. after an append
+static int unchanged(struct simplessh_knownhosts *store, int fd) {
+  char tail[SIMPLESSH_KNOWNHOSTS_TAIL];
+
+  return pread(fd, tail, store->tail_len, store->size - store->tail_len)
+           == (ssize_t)store->tail_len
+         && memcmp(tail, store->tail, store->tail_len) == 0;
+}
+
+// Must be called with the store's lock held
+static int refresh(struct simplessh_knownhosts *store) {
+  struct stat st;
+  int fd, rc = 0;
+
+  fd = open(store->path, O_RDONLY);
+  if(fd == -1) return -1;
+
+  if(fstat(fd, &st) == -1)
+    rc = -1;
+  else if(st.st_dev == store->dev && st.st_ino == store->ino &&
+          st.st_size > store->size && unchanged(store, fd))
+    rc = load(store, fd, &st, store->size);
+  else if(st.st_dev != store->dev || st.st_ino != store->ino ||
+          st.st_size != store->size || st.st_mtime != store->mtime) {
+    index_clear(store);
+    rc = load(store, fd, &st, 0);
+  }
+
+  close(fd);
+  return rc;
+}
+
+static struct simplessh_knownhosts *store_new(const char *path) {
+  struct simplessh_knownhosts *store;
+
+  // Stores are never freed so they keep libssh2 initialised for good
+  if(simplessh_init()) return NULL;
+
+  store = calloc(1, sizeof(struct simplessh_knownhosts));
+  store->lsession = libssh2_session_init();
+  if(store->lsession == NULL) {
+    free(store);
+    simplessh_exit();
+    return NULL;
+  }
+
+  store->path = strdup(path);
+  pthread_mutex_init(&store->lock, NULL);
+  store->bucket_count = SIMPLESSH_KNOWNHOSTS_BUCKETS;
+  store->buckets = calloc(store->bucket_count,
+                          sizeof(struct simplessh_knownhost*));
+  store->hashed  = libssh2_knownhost_init(store->lsession);
+  return store;
+}
+
+/* Get the store of a known_hosts file, loading the file the first time and
+ * taking its changes into account afterwards. Returns NULL if the file could
+ * not be read. */
+struct simplessh_knownhosts *simplessh_knownhosts_get(const char *path) {
+  struct simplessh_knownhosts *store;
+  int rc;
+
+  pthread_mutex_lock(&stores_lock);
+  for(store = stores; store != NULL; store = store->next)
+    if(strcmp(store->path, path) == 0) break;
+  if(store == NULL) {
+    store = store_new(path);
+    if(store != NULL) {
+      store->next = stores;
+      stores = store;
+    }
+  }
+  pthread_mutex_unlock(&stores_lock);
+  if(store == NULL) return NULL;
+
+  pthread_mutex_lock(&store->lock);
+  rc = refresh(store);
+  pthread_mutex_unlock(&store->lock);
+
+  return rc == 0 ? store : NULL;
+}
+
+static void compare(const struct simplessh_knownhost *entry,
+                    const unsigned char *key,
+                    size_t key_len,
+                    int *flags) {
+  if(entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0)
+    *flags |= entry->revoked ? REVOKED : MATCHED;
+  else if(!entry->revoked && same_type(entry->key, entry->key_len, key, key_len))
+    *flags |= CHANGED;
+}
+
+static int key_typemask(int key_type) {
+  switch(key_type) {
+  case LIBSSH2_HOSTKEY_TYPE_RSA:       return LIBSSH2_KNOWNHOST_KEY_SSHRSA;
+  case LIBSSH2_HOSTKEY_TYPE_DSS:       return LIBSSH2_KNOWNHOST_KEY_SSHDSS;
+  case LIBSSH2_HOSTKEY_TYPE_ECDSA_256: return LIBSSH2_KNOWNHOST_KEY_ECDSA_256;
+  case LIBSSH2_HOSTKEY_TYPE_ECDSA_384: return LIBSSH2_KNOWNHOST_KEY_ECDSA_384;
+  case LIBSSH2_HOSTKEY_TYPE_ECDSA_521: return LIBSSH2_KNOWNHOST_KEY_ECDSA_521;
+  case LIBSSH2_HOSTKEY_TYPE_ED25519:   return LIBSSH2_KNOWNHOST_KEY_ED25519;
+  default:                             return LIBSSH2_KNOWNHOST_KEY_UNKNOWN;
+  }
+}
+
+/* Look the key sent by a server up. Hosts on another port than 22 are known
+ * as "[hostname]:port". A matching key wins over a changed one unless it is
+ * revoked, and keys of other types are ignored. */
+enum simplessh_knownhost_status simplessh_knownhosts_check(
+    struct simplessh_knownhosts *store,
+    const char *hostname,
+    uint16_t port,
+    const char *key,
+    size_t key_len,
+    int key_type) {
+  const unsigned char *blob = (const unsigned char*)key;
+  struct simplessh_knownhost *entry;
+  char *name;
+  size_t len = strlen(hostname) + 9;
+  int flags = 0, rc;
+
+  name = malloc(len);
+  if(port == 22) snprintf(name, len, "%s", hostname);
+  else snprintf(name, len, "[%s]:%u", hostname, port);
+  for(rc = 0; name[rc]; rc++) name[rc] = tolower((unsigned char)name[rc]);
+
+  pthread_mutex_lock(&store->lock);
+
+  for(entry = store->buckets[hash(name) & (store->bucket_count - 1)];
+      entry != NULL; entry = entry->next)
+    if(strcmp(entry->host, name) == 0) compare(entry, blob, key_len, &flags);
+
+  for(entry = store->patterns; entry != NULL; entry = entry->next)
+    if(match_list(entry->host, name)) compare(entry, blob, key_len, &flags);
+
+  if(!(flags & (MATCHED | REVOKED)) && store->hashed_count > 0) {
+    rc = libssh2_knownhost_checkp(store->hashed, hostname, port, key, key_len,
+                                  LIBSSH2_KNOWNHOST_TYPE_PLAIN
+                                    | LIBSSH2_KNOWNHOST_KEYENC_RAW
+                                    | key_typemask(key_type),
+                                  NULL);
+    if(rc == LIBSSH2_KNOWNHOST_CHECK_MATCH) flags |= MATCHED;
+    else if(rc == LIBSSH2_KNOWNHOST_CHECK_MISMATCH) flags |= CHANGED;
+  }
+
+  pthread_mutex_unlock(&store->lock);
+  free(name);
+
+  if(flags & REVOKED) return KNOWNHOST_MISMATCH;
+  if(flags & MATCHED) return KNOWNHOST_MATCH;
+  if(flags & CHANGED) return KNOWNHOST_MISMATCH;
+  return KNOWNHOST_NOTFOUND;
+}
@@ -0,0 +1,267 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <libssh2.h>
+#include <simplessh.h>
+#include <simplessh/pool.h>
+
+static void now(struct timespec *ts) {
+  clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+static struct simplessh_pool_host *find_host(struct simplessh_pool *pool,
+                                             const char *address) {
+  struct simplessh_pool_host *host;
+
+  for(host = pool->hosts; host != NULL; host = host->next)
+    if(strcmp(host->address, address) == 0) return host;
+
+  host = malloc(sizeof(struct simplessh_pool_host));
+  host->address = strdup(address);
+  host->live    = 0;
+  host->next    = pool->hosts;
+  pool->hosts   = host;
+  return host;
+}
+
+static struct simplessh_pool_key *find_key(struct simplessh_pool *pool,
+                                           const char *address,
+                                           const char *key) {
+  struct simplessh_pool_key *k;
+
+  for(k = pool->keys; k != NULL; k = k->next)
+    if(strcmp(k->key, key) == 0 && strcmp(k->host->address, address) == 0)
+      return k;
+
+  k = malloc(sizeof(struct simplessh_pool_key));
+  k->key  = strdup(key);
+  k->host = find_host(pool, address);
+  k->idle = NULL;
+  k->next = pool->keys;
+  pool->keys = k;
+  return k;
+}
+
+/* Take an idle session of a host kept for any key, the oldest one of the
+ * first key having some, to make room for another key at the cap. */
+static struct simplessh_pool_entry *take_idle(struct simplessh_pool *pool,
+                                              struct simplessh_pool_host *host) {
+  struct simplessh_pool_key *k;
+  struct simplessh_pool_entry **entry, *tmp;
+
+  for(k = pool->keys; k != NULL; k = k->next) {
+    if(k->host != host || k->idle == NULL) continue;
+
+    for(entry = &k->idle; (*entry)->next != NULL; entry = &(*entry)->next);
+    tmp = *entry;
+    *entry = NULL;
+    return tmp;
+  }
+
+  return NULL;
+}
+
+/* Move the sessions idle for too long to `victims`. Must be called with the
+ * lock held, the victims being closed once it is released. */
+static void sweep(struct simplessh_pool *pool,
+                  struct simplessh_pool_entry **victims) {
+  struct simplessh_pool_key *k;
+  struct simplessh_pool_entry **entry, *tmp;
+  struct timespec ts;
+
+  if(pool->idle_timeout <= 0) return;
+  now(&ts);
+
+  for(k = pool->keys; k != NULL; k = k->next) {
+    entry = &k->idle;
+    while(*entry != NULL) {
+      if(ts.tv_sec - (*entry)->last_used.tv_sec >= pool->idle_timeout) {
+        tmp = *entry;
+        *entry = tmp->next;
+        tmp->next = *victims;
+        *victims = tmp;
+        k->host->live--;
+      } else {
+        entry = &(*entry)->next;
+      }
+    }
+  }
+}
+
+static void close_victims(struct simplessh_pool_entry *victims) {
+  struct simplessh_pool_entry *tmp;
+
+  while(victims != NULL) {
+    tmp = victims;
+    victims = victims->next;
+    simplessh_close_session(tmp->session);
+    free(tmp);
+  }
+}
+
+struct simplessh_pool *simplessh_pool_new(int max_per_host, int idle_timeout) {
+  struct simplessh_pool *pool = malloc(sizeof(struct simplessh_pool));
+  pthread_condattr_t attr;
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&pool->released, &attr);
+  pthread_condattr_destroy(&attr);
+
+  pool->max_per_host = max_per_host;
+  pool->idle_timeout = idle_timeout;
+  pool->hosts        = NULL;
+  pool->keys         = NULL;
+
+  return pool;
+}
+
+/* Get a session of `host` for `key`.
+ *
+ * On success, `*session` is either an idle session which passed the health
+ * check or NULL, in which case a slot has been reserved and the caller is
+ * expected to open and authenticate a new session. When the host is at its
+ * cap, an idle session kept for another key is closed to make room, or this
+ * waits up to `timeout` milliseconds for a slot and returns TIMEOUT if none
+ * frees up. */
+int simplessh_pool_acquire(struct simplessh_pool *pool,
+                           const char *host,
+                           const char *key,
+                           int timeout,
+                           struct simplessh_session **session) {
+  struct simplessh_pool_key *k;
+  struct simplessh_pool_entry *entry, *victims = NULL;
+  struct timespec deadline;
+
+  now(&deadline);
+  deadline.tv_sec  += timeout / 1000;
+  deadline.tv_nsec += (timeout % 1000) * 1000000L;
+  if(deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  sweep(pool, &victims);
+  k = find_key(pool, host, key);
+
+  for(;;) {
+    if(k->idle != NULL) {
+      entry = k->idle;
+      k->idle = entry->next;
+      pthread_mutex_unlock(&pool->lock);
+
+      *session = entry->session;
+      free(entry);
+      if(simplessh_session_alive(*session)) {
+        close_victims(victims);
+        return 0;
+      }
+
+      simplessh_close_session(*session);
+      pthread_mutex_lock(&pool->lock);
+      k->host->live--;
+      continue;
+    }
+
+    if(pool->max_per_host <= 0 || k->host->live < pool->max_per_host) {
+      k->host->live++;
+      pthread_mutex_unlock(&pool->lock);
+      close_victims(victims);
+      *session = NULL;
+      return 0;
+    }
+
+    entry = take_idle(pool, k->host);
+    if(entry != NULL) {
+      entry->next = victims;
+      victims     = entry;
+      k->host->live--;
+      continue;
+    }
+
+    if(pthread_cond_timedwait(&pool->released, &pool->lock, &deadline)
+        == ETIMEDOUT) {
+      pthread_mutex_unlock(&pool->lock);
+      close_victims(victims);
+      *session = NULL;
+      return TIMEOUT;
+    }
+  }
+}
+
+/* Give a healthy session back to the pool. */
+void simplessh_pool_release(struct simplessh_pool *pool,
+                            const char *host,
+                            const char *key,
+                            struct simplessh_session *session) {
+  struct simplessh_pool_key *k;
+  struct simplessh_pool_entry *entry, *victims = NULL;
+
+  entry = malloc(sizeof(struct simplessh_pool_entry));
+  entry->session = session;
+  now(&entry->last_used);
+
+  pthread_mutex_lock(&pool->lock);
+  k = find_key(pool, host, key);
+  entry->next = k->idle;
+  k->idle     = entry;
+  sweep(pool, &victims);
+  pthread_cond_broadcast(&pool->released);
+  pthread_mutex_unlock(&pool->lock);
+
+  close_victims(victims);
+}
+
+/* Close a session which should not be reused, or give back a slot reserved
+ * by simplessh_pool_acquire if `session` is NULL. */
+void simplessh_pool_discard(struct simplessh_pool *pool,
+                            const char *host,
+                            const char *key,
+                            struct simplessh_session *session) {
+  pthread_mutex_lock(&pool->lock);
+  find_key(pool, host, key)->host->live--;
+  pthread_cond_broadcast(&pool->released);
+  pthread_mutex_unlock(&pool->lock);
+
+  if(session != NULL) simplessh_close_session(session);
+}
+
+void simplessh_pool_evict_idle(struct simplessh_pool *pool) {
+  struct simplessh_pool_entry *victims = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  sweep(pool, &victims);
+  pthread_cond_broadcast(&pool->released);
+  pthread_mutex_unlock(&pool->lock);
+
+  close_victims(victims);
+}
+
+/* Close every idle session and free the pool. Sessions still in use are left
+ * to their owners. */
+void simplessh_pool_free(struct simplessh_pool *pool) {
+  struct simplessh_pool_host *host;
+  struct simplessh_pool_key *k;
+
+  while(pool->keys != NULL) {
+    k = pool->keys;
+    pool->keys = k->next;
+    close_victims(k->idle);
+    free(k->key);
+    free(k);
+  }
+
+  while(pool->hosts != NULL) {
+    host = pool->hosts;
+    pool->hosts = host->next;
+    free(host->address);
+    free(host);
+  }
+
+  pthread_cond_destroy(&pool->released);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool);
+}
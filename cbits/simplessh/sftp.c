@@ -0,0 +1,419 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <simplessh.h>
+#include <simplessh/sftp.h>
+
+#define sftpError(rc) ((rc) == LIBSSH2_ERROR_TIMEOUT ? TIMEOUT : SFTP)
+
+#define ptrError(session) \
+  (libssh2_session_last_errno((session)->lsession) == LIBSSH2_ERROR_EAGAIN \
+   ? TIMEOUT : SFTP)
+
+struct simplessh_either *simplessh_sftp_open(
+    struct simplessh_session *session) {
+  struct simplessh_sftp *sftp;
+  LIBSSH2_SFTP *lsftp;
+
+  waitLoopPtr(session, lsftp, libssh2_sftp_init(session->lsession));
+  if(lsftp == NULL)
+    return simplessh_either_new(ptrError(session) == SFTP ? SFTP_INIT : TIMEOUT,
+                                NULL);
+
+  sftp = malloc(sizeof(struct simplessh_sftp));
+  sftp->session = session;
+  sftp->lsftp   = lsftp;
+  sftp->window  = SIMPLESSH_SFTP_WINDOW;
+  return simplessh_either_new(0, sftp);
+}
+
+void simplessh_sftp_set_window(struct simplessh_sftp *sftp, int window) {
+  sftp->window = window > 0 ? window : 1;
+}
+
+struct simplessh_session *simplessh_sftp_session(struct simplessh_sftp *sftp) {
+  return sftp->session;
+}
+
+void simplessh_sftp_close(struct simplessh_sftp *sftp) {
+  int rc;
+
+  waitLoop(sftp->session, rc, libssh2_sftp_shutdown(sftp->lsftp));
+  free(sftp);
+}
+
+struct simplessh_either *simplessh_sftp_stat(struct simplessh_sftp *sftp,
+                                             const char *path) {
+  LIBSSH2_SFTP_ATTRIBUTES *attributes;
+  int rc;
+
+  attributes = malloc(sizeof(LIBSSH2_SFTP_ATTRIBUTES));
+  waitLoop(sftp->session, rc,
+           libssh2_sftp_stat(sftp->lsftp, path, attributes));
+  if(rc) {
+    free(attributes);
+    return simplessh_either_new(sftpError(rc), NULL);
+  }
+
+  return simplessh_either_new(0, attributes);
+}
+
+struct simplessh_sftp_entries *simplessh_sftp_entries_new(void) {
+  return calloc(1, sizeof(struct simplessh_sftp_entries));
+}
+
+void simplessh_sftp_entries_add(struct simplessh_sftp_entries *entries,
+                                const char *name,
+                                LIBSSH2_SFTP_ATTRIBUTES *attributes) {
+  if(entries->count == entries->size) {
+    entries->size = entries->size * 2 + 16;
+    entries->names = realloc(entries->names,
+                             entries->size * sizeof(char*));
+    entries->attributes = realloc(entries->attributes,
+                                  entries->size
+                                    * sizeof(LIBSSH2_SFTP_ATTRIBUTES));
+  }
+
+  entries->names[entries->count]      = strdup(name);
+  entries->attributes[entries->count] = *attributes;
+  entries->count++;
+}
+
+void simplessh_sftp_entries_free(struct simplessh_sftp_entries *entries) {
+  int i;
+
+  for(i = 0; i < entries->count; i++) free(entries->names[i]);
+  free(entries->names);
+  free(entries->attributes);
+  free(entries);
+}
+
+/* List a directory, leaving out "." and "..". */
+struct simplessh_either *simplessh_sftp_readdir(struct simplessh_sftp *sftp,
+                                                const char *path) {
+  struct simplessh_sftp_entries *entries;
+  LIBSSH2_SFTP_HANDLE *handle;
+  LIBSSH2_SFTP_ATTRIBUTES attributes;
+  char name[1024];
+  int rc, rc2;
+
+  waitLoopPtr(sftp->session, handle, libssh2_sftp_opendir(sftp->lsftp, path));
+  if(handle == NULL) return simplessh_either_new(ptrError(sftp->session), NULL);
+
+  entries = simplessh_sftp_entries_new();
+
+  for(;;) {
+    waitLoop(sftp->session, rc,
+             libssh2_sftp_readdir(handle, name, sizeof(name) - 1,
+                                  &attributes));
+    if(rc <= 0) break;
+
+    name[rc] = '\0';
+    if(strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+      simplessh_sftp_entries_add(entries, name, &attributes);
+  }
+
+  waitLoop(sftp->session, rc2, libssh2_sftp_closedir(handle));
+
+  if(rc < 0) {
+    simplessh_sftp_entries_free(entries);
+    return simplessh_either_new(sftpError(rc), NULL);
+  }
+
+  return simplessh_either_new(0, entries);
+}
+
+int simplessh_sftp_rename(struct simplessh_sftp *sftp,
+                          const char *source_path,
+                          const char *destination_path) {
+  int rc;
+
+  waitLoop(sftp->session, rc,
+           libssh2_sftp_rename(sftp->lsftp, source_path, destination_path));
+  return rc ? sftpError(rc) : 0;
+}
+
+int simplessh_sftp_unlink(struct simplessh_sftp *sftp, const char *path) {
+  int rc;
+
+  waitLoop(sftp->session, rc, libssh2_sftp_unlink(sftp->lsftp, path));
+  return rc ? sftpError(rc) : 0;
+}
+
+int simplessh_sftp_mkdir(struct simplessh_sftp *sftp,
+                         const char *path,
+                         int mode) {
+  int rc;
+
+  waitLoop(sftp->session, rc, libssh2_sftp_mkdir(sftp->lsftp, path,
+                                                 mode & 0777));
+  return rc ? sftpError(rc) : 0;
+}
+
+/* Send a local file. libssh2 splits each buffer given to libssh2_sftp_write
+ * into requests sent without waiting for the previous acknowledgements, so
+ * giving it `window` chunks at once keeps that many requests in flight. */
+struct simplessh_either *simplessh_sftp_upload(struct simplessh_sftp *sftp,
+                                               int mode,
+                                               const char *source_path,
+                                               const char *destination_path) {
+  LIBSSH2_SFTP_HANDLE *handle;
+  size_t size = (size_t)sftp->window * SIMPLESSH_SFTP_CHUNK;
+  int64_t *transferred;
+  char *buffer, *current;
+  ssize_t n, rc;
+  int fd, error = 0;
+
+  fd = open(source_path, O_RDONLY);
+  if(fd == -1) return simplessh_either_new(FILEOPEN, NULL);
+
+  waitLoopPtr(sftp->session, handle,
+              libssh2_sftp_open(sftp->lsftp, destination_path,
+                                LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT
+                                  | LIBSSH2_FXF_TRUNC,
+                                mode & 0777));
+  if(handle == NULL) {
+    close(fd);
+    return simplessh_either_new(ptrError(sftp->session), NULL);
+  }
+
+  transferred  = malloc(sizeof(int64_t));
+  *transferred = 0;
+  buffer       = malloc(size);
+
+  while(!error) {
+    do {
+      n = read(fd, buffer, size);
+    } while(n == -1 && errno == EINTR);
+    if(n == 0) break;
+    if(n == -1) { error = READ; break; }
+
+    for(current = buffer; n > 0; current += rc, n -= rc) {
+      waitLoop(sftp->session, rc, libssh2_sftp_write(handle, current, n));
+      if(rc < 0) { error = sftpError(rc); break; }
+      *transferred += rc;
+    }
+  }
+
+  free(buffer);
+  close(fd);
+  waitLoop(sftp->session, rc, libssh2_sftp_close_handle(handle));
+  if(!error && rc) error = sftpError(rc);
+
+  if(error) free(transferred);
+  return simplessh_either_new(error, error ? NULL : transferred);
+}
+
+/* Write `len` bytes of a local file from `offset` at the same offset of a
+ * remote one, `buffer` holding `size` bytes. Each write must be acknowledged
+ * before the handle is moved to another offset, which libssh2_sftp_write
+ * ensures by only counting acknowledged bytes. */
+static int send_range(struct simplessh_sftp *sftp,
+                      LIBSSH2_SFTP_HANDLE *handle,
+                      int fd,
+                      char *buffer,
+                      size_t size,
+                      int64_t offset,
+                      int64_t len,
+                      int64_t *transferred) {
+  char *current;
+  ssize_t n, rc;
+
+  libssh2_sftp_seek64(handle, offset);
+
+  while(len > 0) {
+    do {
+      n = pread(fd, buffer, len < (int64_t)size ? (size_t)len : size, offset);
+    } while(n == -1 && errno == EINTR);
+    if(n <= 0) return READ; // the file shrank under us
+
+    offset += n;
+    len    -= n;
+    for(current = buffer; n > 0; current += rc, n -= rc) {
+      waitLoop(sftp->session, rc, libssh2_sftp_write(handle, current, n));
+      if(rc < 0) return sftpError(rc);
+      *transferred += rc;
+    }
+  }
+
+  return 0;
+}
+
+/* Bring a remote file up to date with a local one, writing in place only the
+ * blocks of `block_size` bytes flagged in `changed`, or the whole file when
+ * it is NULL. Runs of changed blocks are written with the same pipelining as
+ * simplessh_sftp_upload.
+ *
+ * The remote file then gets the size, mode and times of the local one, so
+ * that their metadata compare equal afterwards. Returns the number of bytes
+ * transferred. */
+struct simplessh_either *simplessh_sftp_sync_blocks(
+    struct simplessh_sftp *sftp,
+    const char *source_path,
+    const char *destination_path,
+    int64_t block_size,
+    const char *changed,
+    int64_t count) {
+  LIBSSH2_SFTP_HANDLE *handle;
+  LIBSSH2_SFTP_ATTRIBUTES attributes;
+  size_t size = (size_t)sftp->window * SIMPLESSH_SFTP_CHUNK;
+  struct stat st;
+  int64_t *transferred, start, end, i;
+  char *buffer;
+  int fd, rc, error = 0;
+
+  fd = open(source_path, O_RDONLY);
+  if(fd == -1) return simplessh_either_new(FILEOPEN, NULL);
+  if(fstat(fd, &st) == -1) {
+    close(fd);
+    return simplessh_either_new(READ, NULL);
+  }
+
+  waitLoopPtr(sftp->session, handle,
+              libssh2_sftp_open(sftp->lsftp, destination_path,
+                                LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT
+                                  | (changed == NULL ? LIBSSH2_FXF_TRUNC : 0),
+                                st.st_mode & 0777));
+  if(handle == NULL) {
+    close(fd);
+    return simplessh_either_new(ptrError(sftp->session), NULL);
+  }
+
+  transferred  = malloc(sizeof(int64_t));
+  *transferred = 0;
+  buffer       = malloc(size);
+
+  if(changed == NULL) {
+    error = send_range(sftp, handle, fd, buffer, size, 0, st.st_size,
+                       transferred);
+  } else {
+    for(i = 0; i < count && !error; i = end) {
+      for(; i < count && !changed[i]; i++);
+      for(end = i; end < count && changed[end]; end++);
+      if(i == end) break;
+
+      start = i * block_size;
+      error = send_range(sftp, handle, fd, buffer, size, start,
+                         (end * block_size < st.st_size
+                            ? end * block_size : st.st_size) - start,
+                         transferred);
+    }
+  }
+
+  if(!error) {
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.flags       = LIBSSH2_SFTP_ATTR_SIZE
+                           | LIBSSH2_SFTP_ATTR_PERMISSIONS
+                           | LIBSSH2_SFTP_ATTR_ACMODTIME;
+    attributes.filesize    = st.st_size;
+    attributes.permissions = st.st_mode & 0777;
+    attributes.atime       = st.st_atime;
+    attributes.mtime       = st.st_mtime;
+    waitLoop(sftp->session, rc, libssh2_sftp_fsetstat(handle, &attributes));
+    if(rc) error = sftpError(rc);
+  }
+
+  free(buffer);
+  close(fd);
+  waitLoop(sftp->session, rc, libssh2_sftp_close_handle(handle));
+  if(!error && rc) error = sftpError(rc);
+
+  if(error) free(transferred);
+  return simplessh_either_new(error, error ? NULL : transferred);
+}
+
+/* Receive a remote file. libssh2_sftp_read prefetches as many requests as
+ * fit in the buffer it is given, `window` chunks here. */
+struct simplessh_either *simplessh_sftp_download(struct simplessh_sftp *sftp,
+                                                 const char *source_path,
+                                                 const char *destination_path) {
+  LIBSSH2_SFTP_HANDLE *handle;
+  LIBSSH2_SFTP_ATTRIBUTES attributes;
+  size_t size = (size_t)sftp->window * SIMPLESSH_SFTP_CHUNK;
+  int64_t *transferred;
+  char *buffer, *current;
+  ssize_t n, written;
+  int fd, rc, error = 0;
+
+  waitLoopPtr(sftp->session, handle,
+              libssh2_sftp_open(sftp->lsftp, source_path, LIBSSH2_FXF_READ, 0));
+  if(handle == NULL) return simplessh_either_new(ptrError(sftp->session), NULL);
+
+  waitLoop(sftp->session, rc, libssh2_sftp_fstat(handle, &attributes));
+  fd = open(destination_path, O_WRONLY | O_CREAT | O_TRUNC,
+            rc == 0 && (attributes.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS)
+              ? attributes.permissions & 0777 : 0644);
+  if(fd == -1) {
+    waitLoop(sftp->session, rc, libssh2_sftp_close_handle(handle));
+    return simplessh_either_new(FILEOPEN, NULL);
+  }
+
+  transferred  = malloc(sizeof(int64_t));
+  *transferred = 0;
+  buffer       = malloc(size);
+
+  while(!error) {
+    waitLoop(sftp->session, n, libssh2_sftp_read(handle, buffer, size));
+    if(n == 0) break;
+    if(n < 0) { error = sftpError(n); break; }
+
+    for(current = buffer; n > 0; current += written, n -= written) {
+      do {
+        written = write(fd, current, n);
+      } while(written == -1 && errno == EINTR);
+      if(written == -1) { error = WRITE; break; }
+      *transferred += written;
+    }
+  }
+
+  free(buffer);
+  if(close(fd) == -1 && !error) error = WRITE;
+  waitLoop(sftp->session, rc, libssh2_sftp_close_handle(handle));
+
+  if(error) free(transferred);
+  return simplessh_either_new(error, error ? NULL : transferred);
+}
+
+void simplessh_sftp_get_attributes(LIBSSH2_SFTP_ATTRIBUTES *attributes,
+                                   uint64_t *size,
+                                   unsigned long *permissions,
+                                   unsigned long *uid,
+                                   unsigned long *gid,
+                                   unsigned long *atime,
+                                   unsigned long *mtime) {
+  *size        = attributes->filesize;
+  *permissions = attributes->permissions;
+  *uid         = attributes->uid;
+  *gid         = attributes->gid;
+  *atime       = attributes->atime;
+  *mtime       = attributes->mtime;
+}
+
+int simplessh_sftp_entries_count(struct simplessh_sftp_entries *entries) {
+  return entries->count;
+}
+
+char *simplessh_sftp_entry_name(struct simplessh_sftp_entries *entries, int i) {
+  return entries->names[i];
+}
+
+LIBSSH2_SFTP_ATTRIBUTES *simplessh_sftp_entry_attributes(
+    struct simplessh_sftp_entries *entries,
+    int i) {
+  return &entries->attributes[i];
+}
+
+void simplessh_free_either_attributes(struct simplessh_either *either) {
+  if(either->side == RIGHT && either->u.value != NULL) free(either->u.value);
+  free(either);
+}
+
+void simplessh_free_either_entries(struct simplessh_either *either) {
+  if(either->side == RIGHT && either->u.value != NULL)
+    simplessh_sftp_entries_free(either->u.value);
+  free(either);
+}
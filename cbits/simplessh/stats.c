@@ -0,0 +1,110 @@
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include <libssh2.h>
+#include <simplessh/stats.h>
+#include <simplessh/trace.h>
+
+int64_t simplessh_now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* libssh2's own I/O functions, counting the bytes on the way. They return
+ * -errno on error as libssh2 expects. */
+static LIBSSH2_RECV_FUNC(stats_recv) {
+  struct simplessh_session *session = *abstract;
+  ssize_t rc = recv(socket, buffer, length, flags);
+
+  if(rc < 0) return -errno;
+  session->stats.bytes_in += rc;
+  return rc;
+}
+
+static LIBSSH2_SEND_FUNC(stats_send) {
+  struct simplessh_session *session = *abstract;
+  ssize_t rc = send(socket, buffer, length, flags);
+
+  if(rc < 0) return -errno;
+  session->stats.bytes_out += rc;
+  return rc;
+}
+
+/* Start measuring a session. Bytes are only counted from now on, so this is
+ * best done before the handshake, see the stats field of simplessh_options. */
+void simplessh_stats_enable(struct simplessh_session *session) {
+  if(session->stats.enabled || session->lsession == NULL) return;
+
+  session->stats.enabled = 1;
+  *libssh2_session_abstract(session->lsession) = session;
+  libssh2_session_callback_set2(session->lsession, LIBSSH2_CALLBACK_RECV,
+                                (libssh2_cb_generic*)stats_recv);
+  libssh2_session_callback_set2(session->lsession, LIBSSH2_CALLBACK_SEND,
+                                (libssh2_cb_generic*)stats_send);
+}
+
+/* Account for a wait on the socket, by simplessh_waitsocket or the caller,
+ * which is also traced. */
+void simplessh_stats_wait_begin(struct simplessh_session *session) {
+  simplessh_trace(session, TRACE_WAIT, NULL,
+                  libssh2_session_block_directions(session->lsession));
+  if(!session->stats.enabled) return;
+  session->stats.waits++;
+  session->stats.wait_started = simplessh_now_us();
+}
+
+void simplessh_stats_wait_end(struct simplessh_session *session) {
+  simplessh_trace(session, TRACE_WAKE, NULL, 0);
+  if(!session->stats.enabled || session->stats.wait_started == 0) return;
+  session->stats.blocked += simplessh_now_us() - session->stats.wait_started;
+  session->stats.wait_started = 0;
+}
+
+/* The waits of a command are those of its session while it ran, shared with
+ * the commands running at the same time. */
+void simplessh_exec_stats_begin(struct simplessh_session *session,
+                                struct simplessh_exec_stats *stats) {
+  if(!session->stats.enabled || stats->started != 0) return;
+  stats->started = simplessh_now_us();
+  stats->waits   = session->stats.waits;
+  stats->blocked = session->stats.blocked;
+}
+
+void simplessh_exec_stats_end(struct simplessh_session *session,
+                              struct simplessh_exec_stats *stats) {
+  if(!session->stats.enabled) return;
+  stats->closed  = simplessh_now_us();
+  stats->waits   = session->stats.waits - stats->waits;
+  stats->blocked = session->stats.blocked - stats->blocked;
+}
+
+void simplessh_get_stats(struct simplessh_session *session, int64_t *fields) {
+  struct simplessh_stats *stats = &session->stats;
+
+  fields[0] = stats->started;
+  fields[1] = stats->resolved;
+  fields[2] = stats->connected;
+  fields[3] = stats->handshaken;
+  fields[4] = stats->auth_started;
+  fields[5] = stats->authenticated;
+  fields[6] = stats->bytes_in;
+  fields[7] = stats->bytes_out;
+  fields[8] = stats->waits;
+  fields[9] = stats->blocked;
+}
+
+void simplessh_get_exec_stats(struct simplessh_result *result,
+                              int64_t *fields) {
+  struct simplessh_exec_stats *stats = &result->stats;
+
+  fields[0] = stats->started;
+  fields[1] = stats->opened;
+  fields[2] = stats->executed;
+  fields[3] = stats->drained;
+  fields[4] = stats->closed;
+  fields[5] = stats->waits;
+  fields[6] = stats->blocked;
+}
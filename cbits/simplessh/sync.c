@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <simplessh/sftp.h>
+#include <simplessh/sync.h>
+
+static void attributes_from_stat(LIBSSH2_SFTP_ATTRIBUTES *attributes,
+                                 const struct stat *st) {
+  memset(attributes, 0, sizeof(LIBSSH2_SFTP_ATTRIBUTES));
+  attributes->flags       = LIBSSH2_SFTP_ATTR_SIZE
+                          | LIBSSH2_SFTP_ATTR_UIDGID
+                          | LIBSSH2_SFTP_ATTR_PERMISSIONS
+                          | LIBSSH2_SFTP_ATTR_ACMODTIME;
+  attributes->filesize    = st->st_size;
+  attributes->uid         = st->st_uid;
+  attributes->gid         = st->st_gid;
+  attributes->permissions = st->st_mode;
+  attributes->atime       = st->st_atime;
+  attributes->mtime       = st->st_mtime;
+}
+
+// Attributes of a local file as simplessh_sftp_stat gives them
+struct simplessh_either *simplessh_local_stat(const char *path) {
+  LIBSSH2_SFTP_ATTRIBUTES *attributes;
+  struct stat st;
+
+  if(stat(path, &st) == -1) return simplessh_either_new(FILEOPEN, NULL);
+
+  attributes = malloc(sizeof(LIBSSH2_SFTP_ATTRIBUTES));
+  attributes_from_stat(attributes, &st);
+  return simplessh_either_new(0, attributes);
+}
+
+/* List a local directory as simplessh_sftp_readdir does. Symbolic links are
+ * followed, the entries which cannot be stat'ed being left out. */
+struct simplessh_either *simplessh_local_readdir(const char *path) {
+  struct simplessh_sftp_entries *entries;
+  LIBSSH2_SFTP_ATTRIBUTES attributes;
+  struct dirent *entry;
+  struct stat st;
+  DIR *dir;
+  int fd;
+
+  dir = opendir(path);
+  if(dir == NULL) return simplessh_either_new(FILEOPEN, NULL);
+  fd = dirfd(dir);
+
+  entries = simplessh_sftp_entries_new();
+
+  for(;;) {
+    errno = 0;
+    entry = readdir(dir);
+    if(entry == NULL) break;
+
+    if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+       fstatat(fd, entry->d_name, &st, 0) == -1)
+      continue;
+
+    attributes_from_stat(&attributes, &st);
+    simplessh_sftp_entries_add(entries, entry->d_name, &attributes);
+  }
+
+  closedir(dir);
+
+  if(errno) {
+    simplessh_sftp_entries_free(entries);
+    return simplessh_either_new(READ, NULL);
+  }
+
+  return simplessh_either_new(0, entries);
+}
+
+/* Digest a local file in blocks of `block_size` bytes, the last one being
+ * shorter, or as a whole when `block_size` is 0. `digests` receives
+ * SIMPLESSH_SHA256_SIZE bytes for each of the `count` blocks expected and
+ * `*written` the number of them actually digested, fewer if the file is now
+ * shorter. Returns 0, FILEOPEN or READ. */
+int simplessh_sync_digests(const char *path,
+                           int64_t block_size,
+                           int64_t count,
+                           unsigned char *digests,
+                           int64_t *written) {
+  struct simplessh_sha256 ctx;
+  int64_t block = 0, in_block = 0;
+  char *buffer;
+  ssize_t n, len;
+  int fd, error = 0;
+
+  *written = 0;
+  fd = open(path, O_RDONLY);
+  if(fd == -1) return FILEOPEN;
+
+  buffer = malloc(SIMPLESSH_SYNC_READ);
+  simplessh_sha256_init(&ctx);
+
+  while(block < count) {
+    len = SIMPLESSH_SYNC_READ;
+    if(block_size > 0 && block_size - in_block < len)
+      len = block_size - in_block;
+
+    do {
+      n = read(fd, buffer, len);
+    } while(n == -1 && errno == EINTR);
+    if(n == -1) { error = READ; break; }
+    if(n == 0) break;
+
+    simplessh_sha256_update(&ctx, buffer, n);
+    in_block += n;
+    if(block_size > 0 && in_block == block_size) {
+      simplessh_sha256_final(&ctx, digests + block * SIMPLESSH_SHA256_SIZE);
+      simplessh_sha256_init(&ctx);
+      block++;
+      in_block = 0;
+    }
+  }
+
+  // The last partial block, or the whole file
+  if(!error && block < count && (in_block > 0 || block_size == 0))
+    simplessh_sha256_final(&ctx, digests + block++ * SIMPLESSH_SHA256_SIZE);
+
+  *written = block;
+  free(buffer);
+  close(fd);
+  return error;
+}
@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <libssh2.h>
+#include <simplessh/stats.h>
+#include <simplessh/trace.h>
+
+static pthread_mutex_t sample_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long sessions = 0;
+
+/* Whether the next session is traced when one session in `sample` is, the
+ * sessions being counted across the whole process. */
+int simplessh_trace_sampled(int sample) {
+  unsigned long n;
+
+  if(sample <= 1) return 1;
+
+  pthread_mutex_lock(&sample_lock);
+  n = sessions++;
+  pthread_mutex_unlock(&sample_lock);
+  return n % sample == 0;
+}
+
+static void libssh2_handler(LIBSSH2_SESSION *lsession,
+                            void *context,
+                            const char *data,
+                            size_t len) {
+  (void)lsession;
+  simplessh_trace_emit(context, TRACE_LIBSSH2, NULL, 0, data, len);
+}
+
+/* Start tracing a session, keeping its last `size` events. `libssh2_mask`
+ * also records the LIBSSH2_TRACE_* messages of libssh2, which only emits
+ * them when built with debugging. Nothing is done if the session is already
+ * traced or the ring cannot be allocated. */
+void simplessh_trace_enable(struct simplessh_session *session,
+                            size_t size,
+                            int libssh2_mask) {
+  struct simplessh_trace *trace;
+
+  if(session->trace != NULL || size == 0) return;
+
+  trace = malloc(sizeof(struct simplessh_trace));
+  if(trace == NULL) return;
+  trace->events = malloc(size * sizeof(struct simplessh_trace_event));
+  if(trace->events == NULL) {
+    free(trace);
+    return;
+  }
+  pthread_mutex_init(&trace->lock, NULL);
+  trace->size    = size;
+  trace->count   = 0;
+  trace->hook    = NULL;
+  trace->context = NULL;
+  session->trace = trace;
+
+  if(libssh2_mask && session->lsession != NULL) {
+    libssh2_trace_sethandler(session->lsession, trace, libssh2_handler);
+    libssh2_trace(session->lsession, libssh2_mask);
+  }
+}
+
+// Hand every event of a traced session to `hook`, NULL for none
+void simplessh_trace_set_hook(struct simplessh_session *session,
+                              simplessh_trace_hook hook,
+                              void *context) {
+  if(session->trace == NULL) return;
+
+  pthread_mutex_lock(&session->trace->lock);
+  session->trace->hook    = hook;
+  session->trace->context = context;
+  pthread_mutex_unlock(&session->trace->lock);
+}
+
+void simplessh_trace_emit(struct simplessh_trace *trace,
+                          int kind,
+                          const void *subject,
+                          int64_t value,
+                          const char *message,
+                          size_t message_len) {
+  struct simplessh_trace_event event;
+  simplessh_trace_hook hook;
+  void *context;
+
+  while(message_len > 0 && (message[message_len - 1] == '\n' ||
+                            message[message_len - 1] == '\r'))
+    message_len--;
+  if(message_len >= SIMPLESSH_TRACE_MESSAGE)
+    message_len = SIMPLESSH_TRACE_MESSAGE - 1;
+
+  event.time    = simplessh_now_us();
+  event.kind    = kind;
+  event.subject = (uintptr_t)subject;
+  event.value   = value;
+  if(message_len > 0) memcpy(event.message, message, message_len);
+  event.message[message_len] = '\0';
+
+  pthread_mutex_lock(&trace->lock);
+  trace->events[trace->count % trace->size] = event;
+  trace->count++;
+  hook    = trace->hook;
+  context = trace->context;
+  pthread_mutex_unlock(&trace->lock);
+
+  if(hook != NULL) hook(context, &event);
+}
+
+// Number of events kept, 0 when the session is not traced
+size_t simplessh_trace_size(struct simplessh_session *session) {
+  return session->trace != NULL ? session->trace->size : 0;
+}
+
+// Number of events recorded since tracing started, older ones included
+int64_t simplessh_trace_count(struct simplessh_session *session) {
+  struct simplessh_trace *trace = session->trace;
+  int64_t count;
+
+  if(trace == NULL) return 0;
+
+  pthread_mutex_lock(&trace->lock);
+  count = trace->count;
+  pthread_mutex_unlock(&trace->lock);
+  return count;
+}
+
+/* Copy the last `max` events at most, oldest first, and return how many were
+ * copied. `fields` receives SIMPLESSH_TRACE_FIELDS values per event: the
+ * time, the kind, the subject and the value. `messages` receives
+ * SIMPLESSH_TRACE_MESSAGE bytes per event. Safe to call from any thread
+ * while the session is in use. */
+size_t simplessh_trace_dump(struct simplessh_session *session,
+                            int64_t *fields,
+                            char *messages,
+                            size_t max) {
+  struct simplessh_trace *trace = session->trace;
+  struct simplessh_trace_event *event;
+  uint64_t first;
+  size_t i, n;
+
+  if(trace == NULL) return 0;
+
+  pthread_mutex_lock(&trace->lock);
+  n = trace->count < trace->size ? trace->count : trace->size;
+  if(n > max) n = max;
+  first = trace->count - n;
+
+  for(i = 0; i < n; i++) {
+    event = &trace->events[(first + i) % trace->size];
+    fields[i * SIMPLESSH_TRACE_FIELDS]     = event->time;
+    fields[i * SIMPLESSH_TRACE_FIELDS + 1] = event->kind;
+    fields[i * SIMPLESSH_TRACE_FIELDS + 2] = event->subject;
+    fields[i * SIMPLESSH_TRACE_FIELDS + 3] = event->value;
+    memcpy(messages + i * SIMPLESSH_TRACE_MESSAGE, event->message,
+           SIMPLESSH_TRACE_MESSAGE);
+  }
+  pthread_mutex_unlock(&trace->lock);
+
+  return n;
+}
+
+void simplessh_trace_free(struct simplessh_trace *trace) {
+  if(trace == NULL) return;
+
+  pthread_mutex_destroy(&trace->lock);
+  free(trace->events);
+  free(trace);
+}
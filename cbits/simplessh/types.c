@@ -2,6 +2,22 @@
 #include <stdio.h>
 
 #include <simplessh/types.h>
+#include <simplessh/stats.h>
+
+// A Left with `error` if it is not 0, a Right with `value` otherwise
+struct simplessh_either *simplessh_either_new(int error, void *value) {
+  struct simplessh_either *either = malloc(sizeof(struct simplessh_either));
+
+  if(error) {
+    either->side    = LEFT;
+    either->u.error = error;
+  } else {
+    either->side    = RIGHT;
+    either->u.value = value;
+  }
+
+  return either;
+}
 
 int simplessh_is_left(struct simplessh_either *either) {
   return either->side == LEFT;
@@ -26,14 +42,38 @@ void *simplessh_get_value(struct simplessh_either *either) {
   return either->u.value;
 }
 
+/* Read an either in a single call: its error for a Left, 0 for a Right whose
+ * value is stored in `value`. The either still has to be freed. */
+int simplessh_either_unwrap(struct simplessh_either *either, void **value) {
+  if(either->side == LEFT) return either->u.error;
+  *value = either->u.value;
+  return 0;
+}
+
+void simplessh_free_result(struct simplessh_result *result) {
+  if(result->out != NULL) free(result->out);
+  if(result->err != NULL) free(result->err);
+  if(result->exit_signal != NULL) free(result->exit_signal);
+  free(result);
+}
+
+void simplessh_free_results(struct simplessh_results *results) {
+  int i;
+  for(i = 0; i < results->count; i++)
+    if(results->results[i] != NULL) simplessh_free_result(results->results[i]);
+  free(results->results);
+  free(results);
+}
+
 void simplessh_free_either_result(struct simplessh_either *either) {
   struct simplessh_result *result = either->u.value;
-  if(either->side == RIGHT && result != NULL) {
-    if(result->out != NULL) free(result->out);
-    if(result->err != NULL) free(result->err);
-    if(result->exit_signal != NULL) free(result->exit_signal);
-    free(result);
-  }
+  if(either->side == RIGHT && result != NULL) simplessh_free_result(result);
+  free(either);
+}
+
+void simplessh_free_either_results(struct simplessh_either *either) {
+  struct simplessh_results *results = either->u.value;
+  if(either->side == RIGHT && results != NULL) simplessh_free_results(results);
   free(either);
 }
 
@@ -50,6 +90,36 @@ char *simplessh_get_err(struct simplessh_result *result) {
   return result->err;
 }
 
+size_t simplessh_get_out_len(struct simplessh_result *result) {
+  return result->out_len;
+}
+
+size_t simplessh_get_err_len(struct simplessh_result *result) {
+  return result->err_len;
+}
+
+size_t simplessh_get_out_dropped(struct simplessh_result *result) {
+  return result->out_dropped;
+}
+
+size_t simplessh_get_err_dropped(struct simplessh_result *result) {
+  return result->err_dropped;
+}
+
+/* Give the ownership of stdout to the caller, it won't be freed with the
+ * result anymore. */
+char *simplessh_take_out(struct simplessh_result *result) {
+  char *out = result->out;
+  result->out = NULL;
+  return out;
+}
+
+char *simplessh_take_err(struct simplessh_result *result) {
+  char *err = result->err;
+  result->err = NULL;
+  return err;
+}
+
 int simplessh_get_exit_code(struct simplessh_result *result) {
   return result->exit_code;
 }
@@ -58,6 +128,34 @@ char *simplessh_get_exit_signal(struct simplessh_result *result) {
   return result->exit_signal;
 }
 
-int simplessh_get_count(int *ptr) {
+/* Read a whole result in a single call. `strings` receives stdout, stderr and
+ * the exit signal, the ownership of the first two going to the caller as with
+ * simplessh_take_out. `fields` receives SIMPLESSH_RESULT_FIELDS values: the
+ * lengths of stdout and stderr, the exit code, the bytes dropped from stdout
+ * and stderr and the fields of simplessh_get_exec_stats. */
+void simplessh_result_read(struct simplessh_result *result,
+                           char **strings,
+                           int64_t *fields) {
+  strings[0] = simplessh_take_out(result);
+  strings[1] = simplessh_take_err(result);
+  strings[2] = result->exit_signal;
+  fields[0]  = result->out_len;
+  fields[1]  = result->err_len;
+  fields[2]  = result->exit_code;
+  fields[3]  = result->out_dropped;
+  fields[4]  = result->err_dropped;
+  simplessh_get_exec_stats(result, fields + 5);
+}
+
+int simplessh_get_results_count(struct simplessh_results *results) {
+  return results->count;
+}
+
+struct simplessh_result *simplessh_get_result(struct simplessh_results *results,
+                                              int i) {
+  return results->results[i];
+}
+
+int64_t simplessh_get_count(int64_t *ptr) {
   return *ptr;
 }
@@ -5,11 +5,22 @@
 
 #include <simplessh/types.h>
 
+int simplessh_init(void);
+void simplessh_exit(void);
+
+struct simplessh_session *simplessh_session_new(int timeout);
+
 struct simplessh_either *simplessh_open_session(
   const char*,
   uint16_t,
   int timeout);
 
+struct simplessh_either *simplessh_open_session_with(
+  const char*,
+  uint16_t,
+  int timeout,
+  const struct simplessh_options*);
+
 struct simplessh_either *simplessh_authenticate_password(
   struct simplessh_session*,
   const char *username,
@@ -22,17 +33,244 @@ struct simplessh_either *simplessh_authenticate_key(
   const char*,
   const char*);
 
+struct simplessh_either *simplessh_authenticate_key_handle(
+  struct simplessh_session*,
+  const char *username,
+  const struct simplessh_key*);
+
+struct simplessh_either *simplessh_authenticate_agent(
+  struct simplessh_session*,
+  const char *username);
+
+struct simplessh_either *simplessh_key_load(
+  const char *public_key_path,
+  const char *private_key_path,
+  const char *passphrase);
+
+void simplessh_key_free(struct simplessh_key*);
+
+/* Resumable execution of a command, see simplessh_exec_step. */
+void simplessh_exec_init(struct simplessh_exec*, const char *command);
+int simplessh_exec_step(struct simplessh_session*, struct simplessh_exec*);
+void simplessh_exec_cleanup(struct simplessh_session*, struct simplessh_exec*);
+
 struct simplessh_either *simplessh_exec_command(
   struct simplessh_session*,
   const char *);
 
+struct simplessh_either *simplessh_exec_command_with(
+  struct simplessh_session*,
+  const char *,
+  size_t size_hint);
+
+struct simplessh_either *simplessh_exec_command_stream(
+  struct simplessh_session*,
+  const char *,
+  simplessh_chunk_callback);
+
+struct simplessh_either *simplessh_exec_commands(
+  struct simplessh_session*,
+  const char **commands,
+  int count,
+  int max_channels);
+
 struct simplessh_either *simplessh_send_file(
   struct simplessh_session*,
   int,
   const char*,
-  int,
+  int64_t,
   const char*);
 
+struct simplessh_either *simplessh_send_file_from_path(
+  struct simplessh_session*,
+  int mode,
+  const char *source_path,
+  const char *destination_path);
+
+struct simplessh_either *simplessh_send_file_callback(
+  struct simplessh_session*,
+  int mode,
+  int64_t size,
+  simplessh_read_callback,
+  const char *destination_path);
+
+struct simplessh_either *simplessh_receive_file(
+  struct simplessh_session*,
+  const char *source_path,
+  const char *destination_path);
+
+void simplessh_set_transfer_options(
+  struct simplessh_session*,
+  size_t chunk_size,
+  unsigned int window_size,
+  unsigned int packet_size);
+
+struct simplessh_options *simplessh_options_new(void);
+
+void simplessh_options_set_socket(
+  struct simplessh_options*,
+  int nodelay,
+  int sndbuf,
+  int rcvbuf,
+  int keepalive,
+  int keepalive_interval,
+  int user_timeout);
+
+void simplessh_options_set_keepalive(
+  struct simplessh_options*,
+  int interval,
+  int count_max);
+
+void simplessh_options_set_known_hosts(
+  struct simplessh_options*,
+  const char *path,
+  int accept_new);
+
+void simplessh_options_set_methods(
+  struct simplessh_options*,
+  const char *kex,
+  const char *hostkey,
+  const char *ciphers,
+  const char *macs,
+  int compress);
+
+void simplessh_options_set_stats(struct simplessh_options*, int stats);
+void simplessh_options_set_jump(
+  struct simplessh_options*,
+  struct simplessh_forward*);
+void simplessh_options_set_trace(
+  struct simplessh_options*,
+  int size,
+  int sample,
+  int libssh2_mask);
+
+void simplessh_options_free(struct simplessh_options*);
+
+int simplessh_set_socket_options(
+  struct simplessh_session*,
+  const struct simplessh_options*);
+
+void simplessh_set_timeout(struct simplessh_session*, int timeout);
+
+int simplessh_waitsocket(struct simplessh_session*);
+
+int simplessh_keepalive_tick(struct simplessh_session*);
+void simplessh_set_keepalive(
+  struct simplessh_session*,
+  int interval,
+  int count_max);
+int simplessh_session_alive(struct simplessh_session*);
+
+/* Call `call` until it stops returning LIBSSH2_ERROR_EAGAIN, waiting on the
+ * socket in between. `rc` is set to LIBSSH2_ERROR_TIMEOUT if the wait fails. */
+#define waitLoop(session, rc, call) \
+  while(((rc) = (call)) == LIBSSH2_ERROR_EAGAIN) { \
+    if(simplessh_waitsocket(session) <= 0) { \
+      (rc) = LIBSSH2_ERROR_TIMEOUT; \
+      break; \
+    } \
+  }
+
+/* Same as waitLoop for calls returning NULL on failure. When `ptr` is NULL
+ * afterwards, the last error of the session is LIBSSH2_ERROR_EAGAIN if and
+ * only if the wait failed. */
+#define waitLoopPtr(session, ptr, call) \
+  while(((ptr) = (call)) == NULL && \
+        libssh2_session_last_errno((session)->lsession) \
+          == LIBSSH2_ERROR_EAGAIN) { \
+    if(simplessh_waitsocket(session) <= 0) break; \
+  }
+
+/* Nonblocking interface, see simplessh.c. */
+int simplessh_get_socket(struct simplessh_session*);
+int simplessh_block_directions(struct simplessh_session*);
+int simplessh_get_timeout(struct simplessh_session*);
+int simplessh_get_keepalive_count_max(struct simplessh_session*);
+const char *simplessh_get_method(struct simplessh_session*, int method);
+
+void simplessh_get_connect_timing(
+  struct simplessh_session*,
+  int64_t *resolve_time,
+  int64_t *connect_time);
+
+struct simplessh_either *simplessh_connect(
+  const char *hostname,
+  uint16_t port,
+  int timeout);
+
+struct simplessh_either *simplessh_connect_with(
+  const char *hostname,
+  uint16_t port,
+  int timeout,
+  const struct simplessh_options*);
+
+int simplessh_handshake_step(struct simplessh_session*);
+
+int simplessh_authenticate_password_step(
+  struct simplessh_session*,
+  const char *username,
+  const char *password);
+
+int simplessh_authenticate_key_step(
+  struct simplessh_session*,
+  const char *username,
+  const char *public_key_path,
+  const char *private_key_path,
+  const char *passphrase);
+
+int simplessh_authenticate_memory_step(
+  struct simplessh_session*,
+  const char *username,
+  const char *public_key,
+  int public_key_len,
+  const char *private_key,
+  int private_key_len,
+  const char *passphrase);
+
+int simplessh_authenticate_key_handle_step(
+  struct simplessh_session*,
+  const char *username,
+  const struct simplessh_key*);
+
+int simplessh_authenticate_agent_step(
+  struct simplessh_session*,
+  const char *username);
+
+struct simplessh_exec *simplessh_exec_new(const char *command, size_t size_hint);
+void simplessh_exec_set_limits(
+  struct simplessh_exec*,
+  int out_mode,
+  size_t out_size,
+  int err_mode,
+  size_t err_size);
+void simplessh_exec_set_input(struct simplessh_exec*, simplessh_read_callback);
+int simplessh_exec_start_step(struct simplessh_session*, struct simplessh_exec*);
+void simplessh_exec_cancel(struct simplessh_exec*);
+struct simplessh_result *simplessh_exec_get_result(struct simplessh_exec*);
+struct simplessh_result *simplessh_exec_take_result(struct simplessh_exec*);
+void simplessh_exec_free(struct simplessh_session*, struct simplessh_exec*);
+
+size_t simplessh_exec_size(void);
+void simplessh_exec_setup(
+  struct simplessh_exec*,
+  const char *command,
+  size_t command_len,
+  size_t size_hint,
+  int out_mode,
+  size_t out_size,
+  int err_mode,
+  size_t err_size);
+void simplessh_exec_release(struct simplessh_session*, struct simplessh_exec*);
+
+struct simplessh_batch *simplessh_batch_new(
+  const char **commands,
+  const size_t *command_lens,
+  int count,
+  int max_channels);
+int simplessh_batch_step(struct simplessh_session*, struct simplessh_batch*);
+struct simplessh_results *simplessh_batch_take_results(struct simplessh_batch*);
+void simplessh_batch_free(struct simplessh_session*, struct simplessh_batch*);
+
 void simplessh_close_session(struct simplessh_session*);
 
 #endif
@@ -0,0 +1,22 @@
+#ifndef __SIMPLESSH_BCRYPT_HEADER
+#define __SIMPLESSH_BCRYPT_HEADER 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* bcrypt_pbkdf, the key derivation of the private keys of OpenSSH, which
+ * OpenSSL does not provide. */
+
+#define SIMPLESSH_BCRYPT_HASH 32      // bytes of each round of hashes
+#define SIMPLESSH_BCRYPT_MAX_SALT 256 // bytes of salt used at most
+
+void simplessh_bcrypt_pbkdf(
+  const char *passphrase,
+  size_t passphrase_len,
+  const uint8_t *salt,
+  size_t salt_len,
+  uint8_t *key,
+  size_t key_len,
+  unsigned int rounds);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef __SIMPLESSH_BUFFER_HEADER
+#define __SIMPLESSH_BUFFER_HEADER 1
+
+#include <stddef.h>
+
+/* Output buffers are ropes of slabs so that growing them never copies what
+ * has already been read. Slabs of the standard size are recycled through a
+ * per-session arena instead of going back to malloc. */
+
+#define SIMPLESSH_SLAB_SIZE 65536
+#define SIMPLESSH_ARENA_MAX 64 // slabs kept by an arena
+
+struct simplessh_slab {
+  char *data;
+  size_t size;
+  size_t len;
+  struct simplessh_slab *next;
+};
+
+struct simplessh_arena {
+  struct simplessh_slab *free;
+  int count;
+};
+
+struct simplessh_buffer {
+  struct simplessh_slab *head;
+  struct simplessh_slab *tail;
+  size_t skip; // bytes at the start of the first slab dropped from the content
+  size_t len;  // not counting `skip`
+};
+
+void simplessh_arena_init(struct simplessh_arena*);
+void simplessh_arena_free(struct simplessh_arena*);
+
+void simplessh_buffer_init(struct simplessh_buffer*);
+void simplessh_buffer_preallocate(struct simplessh_buffer*, size_t size);
+
+char *simplessh_buffer_reserve(
+  struct simplessh_buffer*,
+  struct simplessh_arena*,
+  size_t *room);
+void simplessh_buffer_commit(struct simplessh_buffer*, size_t len);
+void simplessh_buffer_clear(struct simplessh_buffer*);
+size_t simplessh_buffer_keep_tail(
+  struct simplessh_buffer*,
+  struct simplessh_arena*,
+  size_t size);
+
+char *simplessh_buffer_finish(
+  struct simplessh_buffer*,
+  struct simplessh_arena*,
+  size_t *len);
+void simplessh_buffer_free(struct simplessh_buffer*, struct simplessh_arena*);
+
+#endif
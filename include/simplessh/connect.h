@@ -0,0 +1,47 @@
+#ifndef __SIMPLESSH_CONNECT_HEADER
+#define __SIMPLESSH_CONNECT_HEADER 1
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <simplessh/types.h>
+
+/* Connection establishment: names are resolved through a process-wide cache
+ * and the addresses are tried in parallel, IPv6 and IPv4 alternating, a new
+ * attempt starting every SIMPLESSH_ATTEMPT_DELAY milliseconds or as soon as
+ * one fails (RFC 8305). The first connection to succeed wins. */
+
+#define SIMPLESSH_ATTEMPT_DELAY 250
+#define SIMPLESSH_DNS_TTL 60   // default, in seconds
+#define SIMPLESSH_DNS_MAX 1024 // entries kept in the cache
+
+struct simplessh_address {
+  int family;
+  int socktype;
+  int protocol;
+  socklen_t len;
+  struct sockaddr_storage addr;
+};
+
+int simplessh_resolve(
+  const char *hostname,
+  uint16_t port,
+  struct simplessh_address **addresses,
+  int *count);
+
+int simplessh_apply_socket_options(
+  int sock,
+  const struct simplessh_socket_options*);
+
+int simplessh_connect_socket(
+  const char *hostname,
+  uint16_t port,
+  int timeout,
+  const struct simplessh_socket_options*,
+  int64_t *resolve_time,
+  int64_t *connect_time);
+
+void simplessh_set_dns_ttl(int ttl);
+void simplessh_flush_dns_cache(void);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef __SIMPLESSH_FANOUT_HEADER
+#define __SIMPLESSH_FANOUT_HEADER 1
+
+#include <stdint.h>
+
+#include <simplessh/types.h>
+#include <simplessh/connect.h>
+
+/* Run the same command on many hosts from a single thread. Every host goes
+ * through connection, handshake, authentication and execution as a state
+ * machine, all the sockets being watched by one epoll instance. */
+
+enum simplessh_host_state {
+  HOST_PENDING,
+  HOST_CONNECT,
+  HOST_HANDSHAKE,
+  HOST_AUTH,
+  HOST_EXEC,
+  HOST_DONE
+};
+
+struct simplessh_host {
+  char *hostname;
+  uint16_t port;
+  char *username;
+  char *password; // NULL to authenticate with a key
+  char *public_key_path;
+  char *private_key_path;
+  char *passphrase;
+  const struct simplessh_key *key; // borrowed, used instead of the paths
+  int agent; // authenticate with the agent instead
+
+  enum simplessh_host_state state;
+  struct simplessh_address *addresses;
+  int address_count;
+  int address; // index of the one being connected to
+  struct simplessh_session *session;
+  struct simplessh_exec exec;
+  int64_t deadline; // in milliseconds on the monotonic clock
+  struct simplessh_either *result;
+};
+
+struct simplessh_hosts {
+  int count;
+  struct simplessh_host *hosts;
+};
+
+struct simplessh_hosts *simplessh_hosts_new(int count);
+
+void simplessh_hosts_set_password(
+  struct simplessh_hosts*,
+  int i,
+  const char *hostname,
+  uint16_t port,
+  const char *username,
+  const char *password);
+
+void simplessh_hosts_set_key(
+  struct simplessh_hosts*,
+  int i,
+  const char *hostname,
+  uint16_t port,
+  const char *username,
+  const char *public_key_path,
+  const char *private_key_path,
+  const char *passphrase);
+
+void simplessh_hosts_set_key_handle(
+  struct simplessh_hosts*,
+  int i,
+  const char *hostname,
+  uint16_t port,
+  const char *username,
+  const struct simplessh_key*);
+
+void simplessh_hosts_set_agent(
+  struct simplessh_hosts*,
+  int i,
+  const char *hostname,
+  uint16_t port,
+  const char *username);
+
+void simplessh_exec_on_hosts(
+  struct simplessh_hosts*,
+  const char *command,
+  int concurrency,
+  int timeout);
+
+struct simplessh_either *simplessh_hosts_take_result(
+  struct simplessh_hosts*,
+  int i);
+
+void simplessh_hosts_free(struct simplessh_hosts*);
+
+#endif
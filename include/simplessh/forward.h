@@ -0,0 +1,114 @@
+#ifndef __SIMPLESSH_FORWARD_HEADER
+#define __SIMPLESSH_FORWARD_HEADER 1
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include <libssh2.h>
+
+#include <simplessh/types.h>
+#include <simplessh/buffer.h>
+
+/* TCP port forwarding over a session. Every connection accepted by a forward
+ * gets its own channel and all of them are relayed by simplessh_forward_run
+ * from a single thread, which owns the session until simplessh_forward_stop
+ * is called. Each direction of a connection moves through one slab taken
+ * from the arena of the session and reused for the whole connection: data
+ * read from one side is written to the other straight from it, without being
+ * copied again. */
+
+#define SIMPLESSH_FORWARD_BACKLOG 16 // pending connections, on either side
+
+/* A jump forward relays the sessions opened through a bastion instead: each
+ * of them gets a socket pair, one end being used as its socket and the other
+ * relayed through a direct-tcpip channel by a thread owning the bastion
+ * session. Many sessions share the connection to the bastion, none of them
+ * having to authenticate to it again. */
+
+enum simplessh_forward_kind {
+  FORWARD_LOCAL,  // listen locally, connect from the server (direct-tcpip)
+  FORWARD_REMOTE, // listen on the server, connect locally (tcpip-forward)
+  FORWARD_JUMP    // relay the sessions of simplessh_jump_connect
+};
+
+enum simplessh_tunnel_state {
+  TUNNEL_OPEN,  // waiting for the direct-tcpip channel
+  TUNNEL_RELAY,
+  TUNNEL_CLOSE
+};
+
+// One direction of a connection
+struct simplessh_flow {
+  struct simplessh_buffer buffer; // owns the slab
+  char *data;
+  size_t size;
+  size_t len;  // bytes in `data`
+  size_t pos;  // bytes of them already written to the other side
+  int eof;     // nothing more to read from the source
+  int done;    // EOF passed on to the other side
+};
+
+struct simplessh_tunnel {
+  enum simplessh_tunnel_state state;
+  int sock;
+  LIBSSH2_CHANNEL *channel;
+  char *host; // target of the channel, NULL for the one of the forward
+  uint16_t port;
+  int *waiter; // set to 1 or -1 once the channel is open or refused
+  char peer_host[INET6_ADDRSTRLEN]; // originator of a direct-tcpip channel
+  uint16_t peer_port;
+  struct simplessh_flow up;   // socket to channel
+  struct simplessh_flow down; // channel to socket
+  struct simplessh_tunnel *next;
+};
+
+struct simplessh_forward {
+  struct simplessh_session *session;
+  enum simplessh_forward_kind kind;
+  int listen_sock;            // local forwarding, -1 otherwise
+  LIBSSH2_LISTENER *listener; // remote forwarding, NULL otherwise
+  int bound_port;             // the port listened on
+  char *host;                 // where the forwarded connections go
+  uint16_t port;
+  int wakeup[2];              // pipe written to by simplessh_forward_stop
+  struct simplessh_tunnel *tunnels;
+  int count;                  // number of tunnels
+  pthread_mutex_t lock;       // protects the fields below and the waiters
+  pthread_cond_t opened;      // a waiter was set
+  struct simplessh_tunnel *pending; // queued by other threads
+  int stopping;
+  pthread_t thread;           // running a jump forward
+};
+
+struct simplessh_either *simplessh_forward_local(
+  struct simplessh_session*,
+  const char *listen_host,
+  uint16_t listen_port,
+  const char *remote_host,
+  uint16_t remote_port);
+
+struct simplessh_either *simplessh_forward_remote(
+  struct simplessh_session*,
+  const char *bind_host,
+  uint16_t bind_port,
+  const char *local_host,
+  uint16_t local_port);
+
+int simplessh_forward_port(struct simplessh_forward*);
+int simplessh_forward_count(struct simplessh_forward*);
+int simplessh_forward_run(struct simplessh_forward*);
+void simplessh_forward_stop(struct simplessh_forward*);
+void simplessh_forward_free(struct simplessh_forward*);
+
+struct simplessh_either *simplessh_jump_new(struct simplessh_session *bastion);
+
+int simplessh_jump_connect(
+  struct simplessh_forward*,
+  const char *hostname,
+  uint16_t port,
+  int timeout);
+
+void simplessh_jump_free(struct simplessh_forward*);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef __SIMPLESSH_KEYFILE_HEADER
+#define __SIMPLESSH_KEYFILE_HEADER 1
+
+#include <stddef.h>
+
+/* Decryption of private key files, done once when a key is loaded since
+ * libssh2 would otherwise derive the key from the passphrase, and decrypt,
+ * at each authentication. The OpenSSH format is decrypted with bcrypt_pbkdf
+ * and PEM keys through OpenSSL, the unencrypted key being written back in
+ * the same format. */
+
+#define SIMPLESSH_KEYFILE_LINE 70 // base64 characters per line, as OpenSSH
+
+char *simplessh_key_decrypt(
+  const char *key,
+  size_t key_len,
+  const char *passphrase,
+  size_t *decrypted_len,
+  int *error);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef __SIMPLESSH_KNOWNHOSTS_HEADER
+#define __SIMPLESSH_KNOWNHOSTS_HEADER 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <libssh2.h>
+
+/* known_hosts files are loaded once per process into an index shared by all
+ * the sessions. Plain host names are hashed, entries with wildcards are kept
+ * aside and hashed names (|1|salt|hash) are handed to libssh2. Each lookup
+ * stats the file: lines appended since the last load are parsed on their
+ * own, any other change reloads the whole file. */
+
+#define SIMPLESSH_KNOWNHOSTS_BUCKETS 1024 // initial size of the index
+#define SIMPLESSH_KNOWNHOSTS_TAIL 64      // bytes checked before appending
+
+enum simplessh_knownhost_status {
+  KNOWNHOST_MATCH,
+  KNOWNHOST_MISMATCH, // another key of the same type, or a revoked key
+  KNOWNHOST_NOTFOUND
+};
+
+struct simplessh_knownhost {
+  char *host; // lower case name, "[name]:port" or a list of patterns
+  unsigned char *key; // key blob as sent by the server
+  size_t key_len;
+  int revoked;
+  struct simplessh_knownhost *next;
+};
+
+struct simplessh_knownhosts {
+  char *path;
+  pthread_mutex_t lock;
+  dev_t dev;
+  ino_t ino;
+  off_t size; // bytes parsed, up to the end of the last complete line
+  time_t mtime;
+  char tail[SIMPLESSH_KNOWNHOSTS_TAIL]; // the last bytes parsed
+  size_t tail_len;
+  struct simplessh_knownhost **buckets;
+  size_t bucket_count;
+  size_t count;
+  struct simplessh_knownhost *patterns;
+  LIBSSH2_SESSION *lsession; // only used to own `hashed`
+  LIBSSH2_KNOWNHOSTS *hashed;
+  int hashed_count;
+  struct simplessh_knownhosts *next;
+};
+
+struct simplessh_knownhosts *simplessh_knownhosts_get(const char *path);
+
+enum simplessh_knownhost_status simplessh_knownhosts_check(
+  struct simplessh_knownhosts*,
+  const char *hostname,
+  uint16_t port,
+  const char *key,
+  size_t key_len,
+  int key_type);
+
+#endif
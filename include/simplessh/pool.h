@@ -0,0 +1,73 @@
+#ifndef __SIMPLESSH_POOL_HEADER
+#define __SIMPLESSH_POOL_HEADER 1
+
+#include <pthread.h>
+#include <time.h>
+
+#include <simplessh/types.h>
+
+/* A pool of authenticated sessions. Idle sessions are kept by a key which
+ * has to identify the host, the user and the credentials used to
+ * authenticate exactly, while the cap applies to all the sessions of a host,
+ * whatever their key.
+ *
+ * The pool itself never opens sessions: simplessh_pool_acquire either hands
+ * out an idle session or reserves a slot for the caller to open one, which
+ * must then be given back with simplessh_pool_release or
+ * simplessh_pool_discard. */
+
+struct simplessh_pool_entry {
+  struct simplessh_session *session;
+  struct timespec last_used;
+  struct simplessh_pool_entry *next;
+};
+
+// What the cap applies to, typically "hostname:port"
+struct simplessh_pool_host {
+  char *address;
+  int live; // sessions of this host, idle or in use (including reserved slots)
+  struct simplessh_pool_host *next;
+};
+
+struct simplessh_pool_key {
+  char *key;
+  struct simplessh_pool_host *host;
+  struct simplessh_pool_entry *idle;
+  struct simplessh_pool_key *next;
+};
+
+struct simplessh_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t released;
+  int max_per_host;
+  int idle_timeout; // in seconds
+  struct simplessh_pool_host *hosts;
+  struct simplessh_pool_key *keys;
+};
+
+struct simplessh_pool *simplessh_pool_new(int max_per_host, int idle_timeout);
+
+int simplessh_pool_acquire(
+  struct simplessh_pool*,
+  const char *host,
+  const char *key,
+  int timeout,
+  struct simplessh_session **session);
+
+void simplessh_pool_release(
+  struct simplessh_pool*,
+  const char *host,
+  const char *key,
+  struct simplessh_session*);
+
+void simplessh_pool_discard(
+  struct simplessh_pool*,
+  const char *host,
+  const char *key,
+  struct simplessh_session*);
+
+void simplessh_pool_evict_idle(struct simplessh_pool*);
+
+void simplessh_pool_free(struct simplessh_pool*);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef __SIMPLESSH_SFTP_HEADER
+#define __SIMPLESSH_SFTP_HEADER 1
+
+#include <stdint.h>
+
+#include <libssh2.h>
+#include <libssh2_sftp.h>
+
+#include <simplessh/types.h>
+
+/* Size of a single read or write request as sent by libssh2. Transfers keep
+ * `window` of them in flight by giving libssh2 buffers of window * chunk
+ * bytes. */
+#define SIMPLESSH_SFTP_CHUNK 30000
+#define SIMPLESSH_SFTP_WINDOW 16
+
+struct simplessh_sftp {
+  struct simplessh_session *session;
+  LIBSSH2_SFTP *lsftp;
+  int window;
+};
+
+struct simplessh_sftp_entries {
+  int count;
+  int size;
+  char **names;
+  LIBSSH2_SFTP_ATTRIBUTES *attributes;
+};
+
+struct simplessh_either *simplessh_sftp_open(struct simplessh_session*);
+void simplessh_sftp_set_window(struct simplessh_sftp*, int window);
+void simplessh_sftp_close(struct simplessh_sftp*);
+struct simplessh_session *simplessh_sftp_session(struct simplessh_sftp*);
+
+struct simplessh_either *simplessh_sftp_stat(
+  struct simplessh_sftp*,
+  const char *path);
+
+struct simplessh_either *simplessh_sftp_readdir(
+  struct simplessh_sftp*,
+  const char *path);
+
+int simplessh_sftp_rename(
+  struct simplessh_sftp*,
+  const char *source_path,
+  const char *destination_path);
+
+int simplessh_sftp_unlink(struct simplessh_sftp*, const char *path);
+int simplessh_sftp_mkdir(struct simplessh_sftp*, const char *path, int mode);
+
+struct simplessh_either *simplessh_sftp_upload(
+  struct simplessh_sftp*,
+  int mode,
+  const char *source_path,
+  const char *destination_path);
+
+struct simplessh_either *simplessh_sftp_download(
+  struct simplessh_sftp*,
+  const char *source_path,
+  const char *destination_path);
+
+struct simplessh_either *simplessh_sftp_sync_blocks(
+  struct simplessh_sftp*,
+  const char *source_path,
+  const char *destination_path,
+  int64_t block_size,
+  const char *changed,
+  int64_t count);
+
+void simplessh_sftp_get_attributes(
+  LIBSSH2_SFTP_ATTRIBUTES*,
+  uint64_t *size,
+  unsigned long *permissions,
+  unsigned long *uid,
+  unsigned long *gid,
+  unsigned long *atime,
+  unsigned long *mtime);
+
+struct simplessh_sftp_entries *simplessh_sftp_entries_new(void);
+void simplessh_sftp_entries_add(
+  struct simplessh_sftp_entries*,
+  const char *name,
+  LIBSSH2_SFTP_ATTRIBUTES*);
+void simplessh_sftp_entries_free(struct simplessh_sftp_entries*);
+
+int simplessh_sftp_entries_count(struct simplessh_sftp_entries*);
+char *simplessh_sftp_entry_name(struct simplessh_sftp_entries*, int);
+LIBSSH2_SFTP_ATTRIBUTES *simplessh_sftp_entry_attributes(
+  struct simplessh_sftp_entries*,
+  int);
+
+void simplessh_free_either_attributes(struct simplessh_either*);
+void simplessh_free_either_entries(struct simplessh_either*);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __SIMPLESSH_SHA256_HEADER
+#define __SIMPLESSH_SHA256_HEADER 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SHA-256 as computed by sha256sum, to compare local files with remote ones
+
+#define SIMPLESSH_SHA256_SIZE 32
+
+struct simplessh_sha256 {
+  uint32_t state[8];
+  uint64_t length; // bytes hashed so far
+  unsigned char block[64];
+  size_t used;     // bytes in `block`
+};
+
+void simplessh_sha256_init(struct simplessh_sha256*);
+void simplessh_sha256_update(
+  struct simplessh_sha256*,
+  const void *data,
+  size_t len);
+void simplessh_sha256_final(
+  struct simplessh_sha256*,
+  unsigned char digest[SIMPLESSH_SHA256_SIZE]);
+void simplessh_sha256(
+  const void *data,
+  size_t len,
+  unsigned char digest[SIMPLESSH_SHA256_SIZE]);
+
+#endif
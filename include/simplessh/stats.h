@@ -0,0 +1,35 @@
+#ifndef __SIMPLESSH_STATS_HEADER
+#define __SIMPLESSH_STATS_HEADER 1
+
+#include <stdint.h>
+
+#include <simplessh/types.h>
+
+/* Opt-in instrumentation of sessions and commands. Nothing is measured, not
+ * even the clock read, unless simplessh_stats_enable has been called on the
+ * session. */
+
+#define SIMPLESSH_STATS_FIELDS 10      // as filled by simplessh_get_stats
+#define SIMPLESSH_EXEC_STATS_FIELDS 7  // by simplessh_get_exec_stats
+
+#define simplessh_stamp(session, field) { \
+  if((session)->stats.enabled) (field) = simplessh_now_us(); \
+}
+
+int64_t simplessh_now_us(void);
+
+void simplessh_stats_enable(struct simplessh_session*);
+void simplessh_stats_wait_begin(struct simplessh_session*);
+void simplessh_stats_wait_end(struct simplessh_session*);
+
+void simplessh_exec_stats_begin(
+  struct simplessh_session*,
+  struct simplessh_exec_stats*);
+void simplessh_exec_stats_end(
+  struct simplessh_session*,
+  struct simplessh_exec_stats*);
+
+void simplessh_get_stats(struct simplessh_session*, int64_t *fields);
+void simplessh_get_exec_stats(struct simplessh_result*, int64_t *fields);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef __SIMPLESSH_SYNC_HEADER
+#define __SIMPLESSH_SYNC_HEADER 1
+
+#include <stdint.h>
+
+#include <simplessh/types.h>
+#include <simplessh/sha256.h>
+
+/* The local half of file synchronisation: local files are described with
+ * the same attributes and entries as remote ones, and digested block by
+ * block to find what differs from a remote copy, see
+ * simplessh_sftp_sync_blocks for the remote half. */
+
+#define SIMPLESSH_SYNC_READ (256 * 1024) // read from a file at a time
+
+struct simplessh_either *simplessh_local_stat(const char *path);
+struct simplessh_either *simplessh_local_readdir(const char *path);
+
+int simplessh_sync_digests(
+  const char *path,
+  int64_t block_size,
+  int64_t count,
+  unsigned char *digests,
+  int64_t *written);
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef __SIMPLESSH_TRACE_HEADER
+#define __SIMPLESSH_TRACE_HEADER 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <simplessh/types.h>
+
+/* Opt-in tracing of sessions. A traced session records an event at each
+ * phase boundary in a ring keeping the most recent ones, which can be dumped
+ * at any time, including from another thread while the session is stuck.
+ * Each event is also handed to the hook of the session if it has one. The
+ * trace points of a session which is not traced cost a NULL check. */
+
+#define SIMPLESSH_TRACE_MESSAGE 112 // bytes kept of a message, NUL included
+#define SIMPLESSH_TRACE_FIELDS 4    // per event, see simplessh_trace_dump
+
+// `value` depends on the kind, error values being those of simplessh_error
+enum simplessh_trace_kind {
+  TRACE_CONNECT      = 1,  // message: hostname, value: port
+  TRACE_CONNECTED    = 2,  // value: 0 or the error
+  TRACE_HANDSHAKE    = 3,  // value: 0 or the error, host key check included
+  TRACE_AUTH         = 4,  // value: 0 or the error
+  TRACE_CHANNEL_OPEN = 5,  // value: 0 or the error
+  TRACE_EXEC         = 6,  // value: 0 or the error
+  TRACE_EOF          = 7,  // end of the output, value: 0 or the error
+  TRACE_CLOSE        = 8,  // value: exit code
+  TRACE_CANCEL       = 9,  // channel closed by simplessh_exec_cancel
+  TRACE_WAIT         = 10, // value: LIBSSH2_SESSION_BLOCK_* directions
+  TRACE_WAKE         = 11, // end of the wait
+  TRACE_LIBSSH2      = 12  // message: from libssh2's own tracing
+};
+
+struct simplessh_trace_event {
+  int64_t time;    // microseconds on the monotonic clock
+  int kind;
+  uintptr_t subject; // the exec concerned, 0 for the session itself
+  int64_t value;
+  char message[SIMPLESSH_TRACE_MESSAGE]; // empty for most kinds
+};
+
+/* Called for each event from the thread driving the session, which may be
+ * inside one of the steps imported as unsafe in Haskell, such as the
+ * password authentication, so it must not call into Haskell. */
+typedef void (*simplessh_trace_hook)(
+  void *context,
+  const struct simplessh_trace_event*);
+
+struct simplessh_trace {
+  pthread_mutex_t lock; // taken around each event, for the dumps
+  struct simplessh_trace_event *events;
+  size_t size;
+  uint64_t count; // events ever recorded, the last `size` of them being kept
+  simplessh_trace_hook hook;
+  void *context;
+};
+
+#define simplessh_trace(session, kind, subject, value) { \
+  if((session)->trace != NULL) \
+    simplessh_trace_emit((session)->trace, (kind), (subject), (value), \
+                         NULL, 0); \
+}
+
+int simplessh_trace_sampled(int sample);
+
+void simplessh_trace_enable(
+  struct simplessh_session*,
+  size_t size,
+  int libssh2_mask);
+
+void simplessh_trace_set_hook(
+  struct simplessh_session*,
+  simplessh_trace_hook,
+  void *context);
+
+void simplessh_trace_emit(
+  struct simplessh_trace*,
+  int kind,
+  const void *subject,
+  int64_t value,
+  const char *message,
+  size_t message_len);
+
+size_t simplessh_trace_size(struct simplessh_session*);
+int64_t simplessh_trace_count(struct simplessh_session*);
+
+size_t simplessh_trace_dump(
+  struct simplessh_session*,
+  int64_t *fields,
+  char *messages,
+  size_t max);
+
+void simplessh_trace_free(struct simplessh_trace*);
+
+#endif
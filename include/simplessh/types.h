@@ -1,8 +1,18 @@
 #ifndef __SIMPLESSH_TYPES_HEADER
 #define __SIMPLESSH_TYPES_HEADER 1
 
+#include <stdint.h>
+#include <sys/types.h>
+
 #include <libssh2.h>
 
+#include <simplessh/buffer.h>
+
+#define SIMPLESSH_DEFAULT_CHUNK_SIZE (16 * 1024)
+#define SIMPLESSH_DRAIN_BATCH (256 * 1024) // read from a stream at a time
+#define SIMPLESSH_RESULT_FIELDS 12 // see simplessh_result_read
+#define SIMPLESSH_ALIVE_WAIT 2000 // ms for a keepalive to be answered
+
 enum simplessh_left_right {
   LEFT,
   RIGHT
@@ -20,7 +30,11 @@ enum simplessh_error {
   CHANNEL_EXEC       = 9,
   READ               = 10,
   FILEOPEN           = 11,
-  WRITE              = 12
+  WRITE              = 12,
+  TIMEOUT            = 13,
+  SFTP_INIT          = 14,
+  SFTP               = 15,
+  CANCELLED          = 16
 };
 
 struct simplessh_either {
@@ -31,30 +45,227 @@ struct simplessh_either {
   } u;
 };
 
+// TCP tuning, 0 meaning the system default unless noted otherwise
+struct simplessh_socket_options {
+  int nodelay;            // TCP_NODELAY, 0 to leave Nagle's algorithm on
+  int sndbuf;             // SO_SNDBUF in bytes
+  int rcvbuf;             // SO_RCVBUF in bytes
+  int keepalive;          // idle seconds before TCP keepalive probes, 0 for none
+  int keepalive_interval; // seconds between probes
+  int user_timeout;       // TCP_USER_TIMEOUT in milliseconds
+};
+
+// Options applied when opening a session
+struct simplessh_options {
+  struct simplessh_socket_options socket;
+  int keepalive_interval;  // see simplessh_set_keepalive
+  int keepalive_count_max;
+  char *known_hosts; // file the host key is checked against, NULL for none
+  int accept_new;    // accept the hosts missing from `known_hosts`
+  // Comma separated algorithms in order of preference, NULL for the default
+  char *kex;
+  char *hostkey;
+  char *ciphers; // both directions
+  char *macs;    // both directions
+  int compress;  // zlib compression when the server agrees to it
+  int stats;     // measure the session, see simplessh/stats.h
+  struct simplessh_forward *jump; // bastion to go through, NULL for none
+  int trace;         // events kept by the trace ring, 0 for no tracing
+  int trace_sample;  // trace one session in that many, 0 or 1 for all
+  int trace_libssh2; // LIBSSH2_TRACE_* messages recorded, see trace.h
+};
+
+/* Timestamps are in microseconds on the monotonic clock, 0 for the phases
+ * not reached or when the session is not measured. */
+struct simplessh_stats {
+  int enabled;
+  int64_t started;       // connection requested
+  int64_t resolved;
+  int64_t connected;
+  int64_t handshaken;    // including the host key check
+  int64_t auth_started;
+  int64_t authenticated;
+  int64_t bytes_in;      // read from the socket, encrypted
+  int64_t bytes_out;
+  int64_t waits;         // times the socket had to be waited on
+  int64_t blocked;       // microseconds spent waiting
+  int64_t wait_started;  // of the wait in progress, 0 if none
+};
+
+struct simplessh_exec_stats {
+  int64_t started;  // first step
+  int64_t opened;   // channel open
+  int64_t executed; // command accepted
+  int64_t drained;  // end of the output
+  int64_t closed;
+  int64_t waits;    // of the session while the command ran
+  int64_t blocked;
+};
+
+struct simplessh_knownhosts;
+struct simplessh_trace;
+
 struct simplessh_session {
   LIBSSH2_SESSION *lsession;
   int sock;
+  int timeout;   // in milliseconds, used for every wait on the socket
+  void *opening; // the exec currently opening a channel, if any
+  struct simplessh_arena arena; // slabs recycled between output buffers
+  struct simplessh_stats stats;
+  struct simplessh_trace *trace; // NULL unless traced, see simplessh/trace.h
+  size_t chunk_size;        // size of the writes of SCP uploads
+  unsigned int window_size; // window of the channels opened for commands
+  unsigned int packet_size; // maximum packet size of these channels
+  int64_t resolve_time;     // in microseconds
+  int64_t connect_time;     // in microseconds, not counting resolution
+  int keepalive_interval;   // in seconds, 0 when disabled
+  int keepalive_count_max;  // keepalives missed before giving up, 0 for none
+  char *hostname;           // as given to connect, for the host key check
+  uint16_t port;
+  struct simplessh_knownhosts *known_hosts; // NULL for no check
+  int accept_new;
+  LIBSSH2_AGENT *agent; // while authenticating with the agent
+  struct libssh2_agent_publickey *identity; // the identity being tried
+};
+
+// A key pair read once and used by any number of sessions
+struct simplessh_key {
+  char *public_key;   // NULL to derive it from the private key
+  size_t public_key_len;
+  char *private_key;
+  size_t private_key_len;
+  char *passphrase;   // NULL once the private key is decrypted
 };
 
 struct simplessh_result {
   char *out;
+  size_t out_len; // not counting the terminating NUL
   char *err;
+  size_t err_len;
   int exit_code;
   char *exit_signal;
+  size_t out_dropped; // see simplessh_exec_set_limits
+  size_t err_dropped;
+  struct simplessh_exec_stats stats;
+};
+
+struct simplessh_results {
+  int count;
+  struct simplessh_result **results;
+};
+
+enum simplessh_stream {
+  STREAM_OUT = 0,
+  STREAM_ERR = 1
 };
 
+/* Receives the output of a streamed command chunk by chunk, returning non-zero
+ * aborts the command. */
+typedef int (*simplessh_chunk_callback)(int stream, const char *data, size_t len);
+
+/* Fills `buffer` with up to `size` bytes and returns how many, 0 at the end
+ * of the data or -1 on error. */
+typedef ssize_t (*simplessh_read_callback)(char *buffer, size_t size);
+
+enum simplessh_limit_mode {
+  LIMIT_NONE,
+  LIMIT_HEAD, // keep the first bytes of the stream
+  LIMIT_TAIL  // keep the last ones
+};
+
+// Bound on what is kept of an output stream, the rest being read and dropped
+struct simplessh_limit {
+  enum simplessh_limit_mode mode;
+  size_t size;
+};
+
+enum simplessh_exec_state {
+  EXEC_OPEN,
+  EXEC_START,
+  EXEC_READ,
+  EXEC_CLOSE,
+  EXEC_CANCEL, // see simplessh_exec_cancel
+  EXEC_DONE
+};
+
+enum simplessh_input_state {
+  INPUT_OPEN,
+  INPUT_EOF,  // the source is exhausted, EOF is still to be sent
+  INPUT_DONE
+};
+
+// A command being executed on its own channel
+struct simplessh_exec {
+  LIBSSH2_CHANNEL *channel;
+  const char *command; // not necessarily NUL-terminated
+  size_t command_len;
+  enum simplessh_exec_state state;
+  simplessh_chunk_callback callback; // NULL to accumulate the output
+  size_t size_hint; // expected size of stdout, 0 if unknown
+  struct simplessh_buffer out;
+  struct simplessh_buffer err;
+  struct simplessh_limit out_limit;
+  struct simplessh_limit err_limit;
+  size_t out_dropped; // bytes read but not kept because of the limits
+  size_t err_dropped;
+  int signal_pending; // while cancelling
+  simplessh_read_callback input; // source of stdin, NULL to send nothing
+  enum simplessh_input_state input_state;
+  struct simplessh_buffer in; // holds the chunk being written to stdin
+  char *in_data;
+  size_t in_size;
+  size_t in_len;
+  size_t in_pos;
+  struct simplessh_result *result;
+  struct simplessh_exec_stats stats;
+  uint64_t moved; // bytes read or written, for a batch to tell progress
+};
+
+// Commands run concurrently on the channels of a session
+struct simplessh_batch {
+  const char **commands;
+  const size_t *command_lens; // NULL if the commands are NUL-terminated
+  int count;
+  int max_channels;
+  int started;
+  int running;
+  int finished;
+  struct simplessh_exec *execs; // the first `started` are initialised
+  struct simplessh_results *results;
+};
+
+struct simplessh_either *simplessh_either_new(int error, void *value);
+
 int simplessh_is_left(struct simplessh_either*);
 int simplessh_get_error(struct simplessh_either*);
 void *simplessh_get_value(struct simplessh_either*);
+int simplessh_either_unwrap(struct simplessh_either*, void **value);
+
+void simplessh_free_result(struct simplessh_result*);
+void simplessh_free_results(struct simplessh_results*);
 
 void simplessh_free_either_result(struct simplessh_either*);
+void simplessh_free_either_results(struct simplessh_either*);
 void simplessh_free_either_count(struct simplessh_either*);
 
 char *simplessh_get_out(struct simplessh_result*);
 char *simplessh_get_err(struct simplessh_result*);
+size_t simplessh_get_out_len(struct simplessh_result*);
+size_t simplessh_get_err_len(struct simplessh_result*);
+size_t simplessh_get_out_dropped(struct simplessh_result*);
+size_t simplessh_get_err_dropped(struct simplessh_result*);
+char *simplessh_take_out(struct simplessh_result*);
+char *simplessh_take_err(struct simplessh_result*);
 int simplessh_get_exit_code(struct simplessh_result*);
 char *simplessh_get_exit_signal(struct simplessh_result*);
+void simplessh_result_read(
+  struct simplessh_result*,
+  char **strings,
+  int64_t *fields);
+
+int simplessh_get_results_count(struct simplessh_results*);
+struct simplessh_result *simplessh_get_result(struct simplessh_results*, int);
 
-int simplessh_get_count(int*);
+int64_t simplessh_get_count(int64_t*);
 
 #endif
@@ -7,17 +7,92 @@ module Network.SSH.Client.SimpleSSH
   , Session
   , Result(..)
   , ResultExit(..)
+  , ExecOptions(..)
+  , OutputLimit(..)
+  , defaultExecOptions
+  , TransferOptions(..)
+  , defaultTransferOptions
+  , HostSpec(..)
+  , HostAuth(..)
+  , Key
+  , Concurrency(..)
+  , defaultConcurrency
+  , ConnectTiming(..)
+  , Methods(..)
+  , Stats(..)
+  , ExecStats(..)
+  , TraceKind(..)
+  , TraceEvent(..)
+  , SessionOptions(..)
+  , defaultSessionOptions
+  , SocketOptions(..)
+  , defaultSocketOptions
+  , interactiveSocketOptions
+  , bulkSocketOptions
   -- * Main functions
   , runSimpleSSH
+  , withSimpleSSH
   , withSessionPassword
   , withSessionKey
   , withSessionMemory
+  , withSessionWith
   , execCommand
+  , execCommandWith
+  , execCommandBytes
+  , execCommandBytesWith
+  , execCommandStream
+  , execCommandInput
+  , execCommandInputWith
+  , execCommands
+  , execCommandsWith
+  , execCommandsBytes
+  , execCommandsBytesWith
+  -- * Background commands
+  , Job
+  , startCommand
+  , startCommandWith
+  , pollCommand
+  , waitCommand
+  , cancelCommand
   , sendFile
+  , sendFileBytes
+  , sendFileFromPath
+  , sendFileLazy
+  , receiveFile
+  -- * Multiple hosts
+  , execOnHosts
+  -- * Session pool
+  , Pool
+  , newPool
+  , destroyPool
+  , evictIdleSessions
+  , withPooledSessionPassword
+  , withPooledSessionKey
+  , withPooledSessionMemory
+  , withPooledSession
   -- * Lower-level functions
   , openSession
+  , openSessionWith
   , authenticateWithPassword
   , authenticateWithKey
+  , authenticateWithKeyHandle
+  , authenticateWithAgent
+  , loadKey
+  , freeKey
+  , withKey
+  , setTimeout
+  , setTransferOptions
+  , setSocketOptions
+  , setKeepAlive
+  , isSessionAlive
+  , getConnectTiming
+  , getMethods
+  , getStats
+  , enableStats
+  , getTrace
+  , enableTrace
+  , setDnsCacheTtl
+  , flushDnsCache
   , closeSession
   ) where
 
@@ -25,121 +100,163 @@ import           Control.Applicative
 import           Control.Exception
 import           Control.Monad.Except
 
+import           Data.Bits ((.|.))
 import           Data.ByteString (ByteString)
 import qualified Data.ByteString.Char8 as BS
+import qualified Data.ByteString.Lazy as BL
 import qualified Data.ByteString.Unsafe as BS
+import           Data.Char (intToDigit, ord)
+import           Data.IORef
+import           Data.List (intercalate)
 
 import           Foreign.C.String
+import           Foreign.C.Types
 import           Foreign.Marshal.Alloc
+import           Foreign.Marshal.Array
+import           Foreign.Marshal.Utils (copyBytes, withMany)
 import           Foreign.Ptr
+import           Foreign.Storable
 
 import           Network.SSH.Client.SimpleSSH.Foreign
+import           Network.SSH.Client.SimpleSSH.Internal
 import           Network.SSH.Client.SimpleSSH.Types
 
-getValue :: CEither -> (Ptr () -> IO b) -> IO b
-getValue eitherC builder = builder =<< getValueC eitherC
+-- | Take the ownership of an output buffer from C. It is freed by the
+-- 'ByteString' finalizer instead of being copied.
+takeOutput :: CString -> Integer -> IO BS.ByteString
+takeOutput ptr len
+  | ptr == nullPtr = return BS.empty
+  | otherwise      = BS.unsafePackMallocCStringLen (ptr, fromInteger len)
 
-getError :: CEither -> IO SimpleSSHError
-getError eitherC = readError <$> getErrorC eitherC
-
-getOut :: CResult -> IO BS.ByteString
-getOut ptr = BS.packCString =<< getOutC ptr
-
-getErr :: CResult -> IO BS.ByteString
-getErr ptr = BS.packCString =<< getErrC ptr
+-- | Read a result with a single call to C, see @simplessh_result_read@.
+readResult :: CResult -> IO Result
+readResult resultC =
+  allocaArray 3 $ \stringsPtr -> allocaArray resultFields $ \fieldsPtr -> do
+    resultReadC resultC stringsPtr fieldsPtr
+    [outC, errC, signalC] <- peekArray 3 stringsPtr
+    fields <- map toInteger <$> peekArray resultFields fieldsPtr
+    let (outLen : errLen : exitCode : outDropped : errDropped : stats) = fields
 
-getExitCode :: CResult -> IO Integer
-getExitCode ptr = toInteger <$> getExitCodeC ptr
+    out    <- takeOutput outC outLen
+    err    <- takeOutput errC errLen
+    signal <- if signalC == nullPtr then return "" else BS.packCString signalC
 
-getExitSignal :: CResult -> IO BS.ByteString
-getExitSignal ptr = do
-  signalPtr <- getExitSignalC ptr
-  if signalPtr == nullPtr
-    then return ""
-    else BS.packCString signalPtr
+    let exit = case (exitCode, signal) of
+          (0, _)  -> ExitSuccess
+          (_, "") -> ExitFailure exitCode
+          _       -> ExitSignal signal
 
-readResult :: CResult -> IO Result
-readResult resultC =  Result
-                  <$> getOut resultC
-                  <*> getErr resultC
-                  <*> readResultExit resultC
+    return $ Result out err exit outDropped errDropped $ case stats of
+      [started, opened, executed, drained, closed, waits, blocked]
+        | started /= 0 ->
+            Just $ ExecStats started opened executed drained closed waits
+                             blocked
+      _ -> Nothing
+  where
+    resultFields = fromIntegral resultFieldsC
 
 readResultExit :: CResult -> IO ResultExit
-readResultExit resultC = do
-  exitCode   <- getExitCode   resultC
-  exitSignal <- getExitSignal resultC
-  return $ case (exitCode, exitSignal) of
-    (0, _)  -> ExitSuccess
-    (_, "") -> ExitFailure exitCode
-    _       -> ExitSignal exitSignal
+readResultExit resultC = resultExit <$> readResult resultC
+
+readResults :: CResults -> IO [Result]
+readResults resultsC = do
+  count <- getResultsCountC resultsC
+  mapM (readResult <=< getResultC resultsC) [0 .. count - 1]
 
 readCount :: CCount -> IO Integer
 readCount countC = toInteger <$> getCountC countC
 
--- | Helper which lifts IO actions into 'SimpleSSH'. This is used all over the
--- place.
-liftIOEither :: IO (Either SimpleSSHError a) -> SimpleSSH a
-liftIOEither ioAction = do
-  eRes <- liftIO ioAction
-  case eRes of
-    Left err  -> throwError err
-    Right res -> return res
-
--- | Helper which interprets a result coming from C.
---
--- Functions in the C part return pointers to a structure mimicking 'Either'.
-liftEitherCFree :: (CEither -> IO ()) -- ^ A custom function to free the CEither
-                -> (Ptr () -> IO a)   -- ^ A function to transform the pointer
-                                      -- contained in the C structure
-                -> IO CEither         -- ^ An action returning the structure,
-                                      -- typically a call to C
-                -> IO (Either SimpleSSHError a)
-liftEitherCFree customFree builder action = do
-  eitherC   <- action
-  checkLeft <- isLeftC eitherC
-  res <- if checkLeft == 0
-    then Right <$> getValue eitherC builder
-    else Left  <$> getError eitherC
-  customFree eitherC
-  return res
-
--- | Version of 'liftEitherCFree' using the normal 'free'.
-liftEitherC :: (Ptr () -> IO a) -> IO CEither -> IO (Either SimpleSSHError a)
-liftEitherC = liftEitherCFree free
+-- | Keep the global state of libssh2 initialised while running some action.
+--
+-- Sessions initialise it when none is open and tear it down when the last
+-- one is closed, which is safe from any thread. Wrapping the program (e.g.
+-- @main@) in 'withSimpleSSH' avoids doing it over and over again when
+-- sessions are opened one after the other.
+withSimpleSSH :: SimpleSSH a -> SimpleSSH a
+withSimpleSSH action = do
+  liftIOEither $ liftStatusC initC
+  ExceptT $ runExceptT action `finally` exitC
 
 -- | Open a SSH session. The next step is to authenticate.
+--
+-- The addresses of the host are tried in parallel, IPv6 and IPv4
+-- alternating, a new attempt starting every 250 ms until one of them
+-- connects. The timeout bounds the whole connection, not each attempt.
 openSession :: String  -- ^ Hostname
             -> Integer -- ^ Port
             -> Integer -- ^ Timeout in seconds
             -> SimpleSSH Session
-openSession hostname port timeout = liftIOEither $ do
-  hostnameC <- newCString hostname
-  let portC = fromInteger port
-  let timeoutC = fromInteger timeout
+openSession = openSessionWith defaultSessionOptions
 
-  res <- liftEitherC (return . Session) $
-    openSessionC hostnameC portC timeoutC
+-- | Version of 'openSession' with custom options.
+--
+-- With 'sessionKnownHosts', the host key is checked right after the key
+-- exchange and a host which is unknown or whose key changed fails with
+-- 'KnownhostsCheck', or 'KnownhostsInit' if the file cannot be read. The
+-- file is loaded once per process and shared by all the sessions, lines
+-- appended to it later being picked up by the next sessions.
+openSessionWith :: SessionOptions -- ^ Options
+                -> String         -- ^ Hostname
+                -> Integer        -- ^ Port
+                -> Integer        -- ^ Timeout in seconds
+                -> SimpleSSH Session
+openSessionWith options hostname port timeout = liftIOEither $
+  withCString hostname $ \hostnameC -> withOptions options $ \optionsC -> do
+    eSession <- liftEitherC (return . Session) $
+      connectWithC hostnameC (fromInteger port) (fromInteger timeout) optionsC
 
-  free hostnameC
+    case eSession of
+      Left err -> return $ Left err
+      Right session -> do
+        res <- stepLoop session (handshakeStepC session)
+          `onException` closeSessionC session
+        either (const (closeSessionC session)) return res
+        return $ session <$ res
 
-  return res
+-- | Marshal options for the duration of an action.
+withOptions :: SessionOptions -> (COptions -> IO a) -> IO a
+withOptions options action = bracket optionsNewC optionsFreeC $ \optionsC -> do
+  let socket = sessionSocket options
+  optionsSetSocketC optionsC
+                    (if socketNoDelay socket then 1 else 0)
+                    (fromIntegral (socketSendBuffer socket))
+                    (fromIntegral (socketReceiveBuffer socket))
+                    (fromIntegral (socketKeepAlive socket))
+                    (fromIntegral (socketKeepAliveInterval socket))
+                    (fromIntegral (socketUserTimeout socket))
+  optionsSetKeepaliveC optionsC
+                       (fromIntegral (sessionKeepAlive options))
+                       (fromIntegral (sessionKeepAliveCountMax options))
+  optionsSetStatsC optionsC (if sessionStats options then 1 else 0)
+  mapM_ (optionsSetJumpC optionsC) $ sessionJump options
+  optionsSetTraceC optionsC
+                   (fromIntegral (sessionTrace options))
+                   (fromIntegral (sessionTraceSample options))
+                   (if sessionTraceLibssh2 options then libssh2Trace else 0)
+  withCString (methods sessionKex) $ \kexC ->
+    withCString (methods sessionHostKeys) $ \hostKeysC ->
+    withCString (methods sessionCiphers) $ \ciphersC ->
+    withCString (methods sessionMacs) $ \macsC ->
+      optionsSetMethodsC optionsC kexC hostKeysC ciphersC macsC
+                         (if sessionCompression options then 1 else 0)
+  case sessionKnownHosts options of
+    Nothing   -> action optionsC
+    Just path -> withCString path $ \pathC -> do
+      optionsSetKnownHostsC optionsC pathC
+                            (if sessionAcceptNewHosts options then 1 else 0)
+      action optionsC
+  where
+    methods field = intercalate "," (field options)
 
 -- | Authenticate a session with a pair username / password.
 authenticateWithPassword :: Session -- ^ Session to use
                          -> String  -- ^ Username
                          -> String  -- ^ Password
                          -> SimpleSSH Session
-authenticateWithPassword session username password = liftIOEither $ do
-  usernameC <- newCString username
-  passwordC <- newCString password
-
-  res <- liftEitherC (return . Session) $
-    authenticatePasswordC session usernameC passwordC
-
-  free usernameC
-  free passwordC
-
-  return res
+authenticateWithPassword session username password = liftIOEither $
+  withCString username $ \usernameC -> withCString password $ \passwordC ->
+    fmap (const session) <$>
+      stepLoop session (authenticatePasswordStepC session usernameC passwordC)
 
 -- ^ Authenticate with a public key for a given username.
 --
@@ -153,20 +270,15 @@ authenticateWithKey :: Session  -- ^ Session to use
                     -> String   -- ^ Passphrase
                     -> SimpleSSH Session
 authenticateWithKey session username publicKeyPath privateKeyPath passphrase =
-  liftIOEither $ do
-    (usernameC, publicKeyPathC, privateKeyPathC, passphraseC) <-
-      (,,,) <$> newCString username
-            <*> newCString publicKeyPath
-            <*> newCString privateKeyPath
-            <*> newCString passphrase
-
-    res <- liftEitherC (return . Session) $
-      authenticateKeyC session usernameC publicKeyPathC privateKeyPathC
-                       passphraseC
-
-    mapM_ free [usernameC, publicKeyPathC, privateKeyPathC, passphraseC]
-
-    return res
+  liftIOEither $
+    withCString username $ \usernameC ->
+    withCString publicKeyPath $ \publicKeyPathC ->
+    withCString privateKeyPath $ \privateKeyPathC ->
+    withCString passphrase $ \passphraseC ->
+      fmap (const session) <$>
+        stepLoop session (authenticateKeyStepC session usernameC
+                                               publicKeyPathC privateKeyPathC
+                                               passphraseC)
 
 -- ^ Authenticate with a public key for a given username.
 --
@@ -178,20 +290,111 @@ authenticateWithMemory :: Session  -- ^ Session to use
                        -> String   -- ^ Passphrase
                        -> SimpleSSH Session
 authenticateWithMemory session username publicKey privateKey passphrase =
-  liftIOEither $ do
-    (usernameC, passphraseC) <-
-      (,) <$> newCString username
-          <*> newCString passphrase
+  liftIOEither $
+    withCString username $ \usernameC ->
+    withCString passphrase $ \passphraseC ->
+    BS.unsafeUseAsCStringLen publicKey $ \(publicC, publicLen) ->
+    BS.unsafeUseAsCStringLen privateKey $ \(privateC, privateLen) ->
+      fmap (const session) <$>
+        stepLoop session (authenticateMemoryStepC session usernameC
+                                                  publicC
+                                                  (fromIntegral publicLen)
+                                                  privateC
+                                                  (fromIntegral privateLen)
+                                                  passphraseC)
 
-    res <- BS.unsafeUseAsCStringLen publicKey $
-      \(publicC, publicLen) -> BS.unsafeUseAsCStringLen privateKey $
-      \(privateC, privateLen) -> liftEitherC (return . Session) $
-        authenticateMemoryC session usernameC publicC (fromIntegral publicLen) privateC (fromIntegral privateLen)
-          passphraseC
+-- | Read a key pair once to authenticate any number of sessions with it.
+--
+-- Leave the path of the public key empty to derive it from the private key.
+-- The private key is decrypted here, once, failing with 'Authentication' if
+-- the passphrase is wrong, so that each authentication only parses it.
+loadKey :: FilePath -- ^ Path to the public key
+        -> FilePath -- ^ Path to the private key
+        -> String   -- ^ Passphrase
+        -> SimpleSSH Key
+loadKey publicKeyPath privateKeyPath passphrase = liftIOEither $
+  withCString publicKeyPath $ \publicKeyPathC ->
+  withCString privateKeyPath $ \privateKeyPathC ->
+  withCString passphrase $ \passphraseC ->
+    liftEitherC (return . Key) $
+      keyLoadC publicKeyPathC privateKeyPathC passphraseC
 
-    mapM_ free [usernameC, passphraseC]
+-- | Free a key, which must not be used afterwards.
+freeKey :: Key -> IO ()
+freeKey = keyFreeC
 
-    return res
+-- | Load a key, execute some action and free it.
+withKey :: FilePath -- ^ Path to the public key
+        -> FilePath -- ^ Path to the private key
+        -> String   -- ^ Passphrase
+        -> (Key -> SimpleSSH a)
+        -> SimpleSSH a
+withKey publicKeyPath privateKeyPath passphrase action = do
+  key <- loadKey publicKeyPath privateKeyPath passphrase
+  ExceptT $ runExceptT (action key) `finally` freeKey key
+
+-- | Authenticate with a key loaded by 'loadKey' for a given username.
+authenticateWithKeyHandle :: Session -- ^ Session to use
+                          -> String  -- ^ Username
+                          -> Key
+                          -> SimpleSSH Session
+authenticateWithKeyHandle session username key = liftIOEither $
+  withCString username $ \usernameC ->
+    fmap (const session) <$>
+      stepLoop session (authenticateKeyHandleStepC session usernameC key)
+
+-- | Authenticate with the identities of the agent at SSH_AUTH_SOCK, tried
+-- one after the other, for a given username.
+authenticateWithAgent :: Session -- ^ Session to use
+                      -> String  -- ^ Username
+                      -> SimpleSSH Session
+authenticateWithAgent session username = liftIOEither $
+  withCString username $ \usernameC ->
+    fmap (const session) <$>
+      stepLoop session (authenticateAgentStepC session usernameC)
+
+-- | Run a command through the nonblocking interface, the command being used
+-- in place by C until it is done.
+execNonBlocking :: Session -> CStringLen -> ExecOptions
+                -> Maybe (FunPtr ReadCallback)
+                -> IO (Either SimpleSSHError Result)
+execNonBlocking session command options input =
+  allocaBytesAligned (fromIntegral execSize) 16 $ \exec ->
+  bracket_ (setupExec exec command options) (execReleaseC session exec) $ do
+      res <- case input of
+        Nothing -> stepLoop session $ execStepC session exec
+        Just inputC -> do
+          execSetInputC exec inputC
+          stepLoop session $ execStepC session exec
+      case res of
+        Left err -> return $ Left err
+        Right () ->
+          Right <$> (readResult =<< execGetResultC exec)
+
+-- | Initialise an exec kept in Haskell memory, with a single call to C.
+setupExec :: CExec -> CStringLen -> ExecOptions -> IO ()
+setupExec exec (commandC, commandLen) options =
+  execSetupC exec commandC (fromIntegral commandLen)
+             (fromIntegral (execSizeHint options))
+             outMode outSize errMode errSize
+  where
+    (outMode, outSize, errMode, errSize) = execLimits options
+
+setLimits :: CExec -> ExecOptions -> IO ()
+setLimits exec options = execSetLimitsC exec outMode outSize errMode errSize
+  where
+    (outMode, outSize, errMode, errSize) = execLimits options
+
+execLimits :: ExecOptions -> (CInt, CSize, CInt, CSize)
+execLimits options = (outMode, outSize, errMode, errSize)
+  where
+    (outMode, outSize) = limit $ execStdoutLimit options
+    (errMode, errSize) = limit $ execStderrLimit options
+
+    -- LIMIT_NONE, LIMIT_HEAD and LIMIT_TAIL
+    limit NoLimit        = (0, 0)
+    limit (KeepHead len) = (1, fromIntegral len)
+    limit (KeepTail len) = (2, fromIntegral len)
 
 -- | Send a command to the server.
 --
@@ -199,13 +402,237 @@ authenticateWithMemory session username publicKey privateKey passphrase =
 execCommand :: Session -- ^ Session to use
             -> String  -- ^ Command
             -> SimpleSSH Result
-execCommand session command = do
-  liftIOEither $ do
-    commandC <- newCString command
-    res <- liftEitherCFree freeEitherResultC readResult $
-      execCommandC session commandC
-    free commandC
-    return res
+execCommand = execCommandWith defaultExecOptions
+
+-- | Version of 'execCommand' with custom options.
+execCommandWith :: ExecOptions -- ^ Options
+                -> Session     -- ^ Session to use
+                -> String      -- ^ Command
+                -> SimpleSSH Result
+execCommandWith options session command = liftIOEither $
+  withCStringLen command $ \commandC ->
+    execNonBlocking session commandC options Nothing
+
+-- | Version of 'execCommand' taking the command as raw bytes.
+--
+-- The bytes are handed to the server as they are, without being encoded nor
+-- copied, which suits long commands generated by programs. They can hold
+-- any byte, NUL included.
+execCommandBytes :: Session    -- ^ Session to use
+                 -> ByteString -- ^ Command
+                 -> SimpleSSH Result
+execCommandBytes = execCommandBytesWith defaultExecOptions
+
+-- | Version of 'execCommandBytes' with custom options.
+execCommandBytesWith :: ExecOptions -- ^ Options
+                     -> Session     -- ^ Session to use
+                     -> ByteString  -- ^ Command
+                     -> SimpleSSH Result
+execCommandBytesWith options session command = liftIOEither $
+  BS.unsafeUseAsCStringLen command $ \commandC ->
+    execNonBlocking session commandC options Nothing
+
+-- | Send a command to the server, streaming the given data to its stdin
+-- while its output is read, and EOF once the data is exhausted.
+--
+-- This pipes data into a remote command (e.g. @tar x@ or @sort@) in a single
+-- pass. The data is only forced as the channel accepts it, so it can come
+-- from 'BL.hGetContents' on a file or a pipe without being loaded in memory.
+-- An exception raised while producing it aborts the command and is
+-- rethrown.
+execCommandInput :: Session       -- ^ Session to use
+                 -> String        -- ^ Command
+                 -> BL.ByteString -- ^ Data sent to stdin
+                 -> SimpleSSH Result
+execCommandInput = execCommandInputWith defaultExecOptions
+
+-- | Version of 'execCommandInput' with custom options.
+execCommandInputWith :: ExecOptions   -- ^ Options
+                     -> Session       -- ^ Session to use
+                     -> String        -- ^ Command
+                     -> BL.ByteString -- ^ Data sent to stdin
+                     -> SimpleSSH Result
+execCommandInputWith options session command input = do
+  (failure, callback) <- liftIO $ lazySource input
+
+  res <- liftIO $ bracket (mkReadCallback callback) freeHaskellFunPtr $
+    \callbackC -> withCStringLen command $ \commandC ->
+      execNonBlocking session commandC options (Just callbackC)
+
+  liftIO $ readIORef failure >>= mapM_ throwIO
+  either throwError return res
+
+-- | Send a command to the server and hand its output to the given functions
+-- chunk by chunk as it arrives, instead of accumulating it.
+--
+-- Memory usage is bounded by the chunk size whatever the size of the output.
+-- An exception thrown by one of the functions aborts the command and is
+-- rethrown.
+execCommandStream :: Session               -- ^ Session to use
+                  -> String                -- ^ Command
+                  -> (ByteString -> IO ()) -- ^ Consumer of stdout
+                  -> (ByteString -> IO ()) -- ^ Consumer of stderr
+                  -> SimpleSSH ResultExit
+execCommandStream session command onOut onErr = do
+  failure <- liftIO $ newIORef Nothing
+
+  let callback stream dataC len = do
+        chunk <- BS.packCStringLen (dataC, fromIntegral len)
+        res   <- try $ if stream == 0 then onOut chunk else onErr chunk
+        case res of
+          Right () -> return 0
+          Left e   -> writeIORef failure (Just (e :: SomeException)) >> return 1
+
+  res <- liftIO $ bracket (mkChunkCallback callback) freeHaskellFunPtr $
+    \callbackC -> withCString command $ \commandC ->
+      liftEitherCFree freeEitherResultC readResultExit $
+        execCommandStreamC session commandC callbackC
+
+  liftIO $ readIORef failure >>= mapM_ throwIO
+  either throwError return res
+
+-- | Start a command and return as soon as the server accepted it, leaving it
+-- to run on its own channel.
+--
+-- The session can meanwhile be used for other commands. The output of the
+-- job is only read while it is polled or waited on, or while another command
+-- runs on the session, and the server pauses it once the window of its
+-- channel is full. As any use of a 'Session', the job must not be driven
+-- from several threads at the same time.
+startCommand :: Session -- ^ Session to use
+             -> String  -- ^ Command
+             -> SimpleSSH Job
+startCommand = startCommandWith defaultExecOptions
+
+-- | Version of 'startCommand' with custom options.
+startCommandWith :: ExecOptions -- ^ Options
+                 -> Session     -- ^ Session to use
+                 -> String      -- ^ Command
+                 -> SimpleSSH Job
+startCommandWith options session command = liftIOEither $ mask_ $ do
+  commandC <- newCString command
+  exec     <- execNewC commandC (fromIntegral (execSizeHint options))
+  let release = execFreeC session exec >> free commandC
+
+  res <- (setLimits exec options >>
+          stepLoop session (execStartStepC session exec))
+         `onException` release
+  case res of
+    Left err -> release >> return (Left err)
+    Right () -> Right . Job session exec commandC <$> newIORef Nothing
+
+-- | Record how a job ended and free its exec.
+finishJob :: Job -> Either SimpleSSHError () -> IO (Either SimpleSSHError Result)
+finishJob job res = do
+  outcome <- case res of
+    Left err -> return $ Left err
+    Right () -> do
+      resultC <- execTakeResultC (jobExec job)
+      if resultC == nullPtr
+        then return $ Left Cancelled
+        else Right <$> (readResult resultC `finally` freeResultC resultC)
+  execFreeC (jobSession job) (jobExec job)
+  free $ jobCommand job
+  writeIORef (jobOutcome job) (Just outcome)
+  return outcome
+
+-- | Read what is available of the output of a job without waiting, and
+-- return its result if it is done.
+pollCommand :: Job -> SimpleSSH (Maybe Result)
+pollCommand job = liftIOEither $ mask_ $ do
+  outcome <- readIORef $ jobOutcome job
+  case outcome of
+    Just done -> return $ Just <$> done
+    Nothing -> do
+      rc <- execStepC (jobSession job) (jobExec job)
+      case rc of
+        0 -> fmap Just <$> finishJob job (Right ())
+        _ | rc == eagainC -> return $ Right Nothing
+          | otherwise -> fmap Just <$> finishJob job (Left $ readError rc)
+
+-- | Wait until a job is done and return its result.
+--
+-- The timeout of the session applies to each wait on the socket, so a job
+-- running longer without output fails with 'Timeout', see 'setTimeout'. The
+-- job is then left running, as it is when an exception interrupts the
+-- wait, and can be waited on again.
+waitCommand :: Job -> SimpleSSH Result
+waitCommand job = liftIOEither $ mask $ \restore -> do
+  outcome <- readIORef $ jobOutcome job
+  case outcome of
+    Just done -> return done
+    Nothing -> do
+      res <- restore $ stepLoop (jobSession job) $
+               execStepC (jobSession job) (jobExec job)
+      case res of
+        Left Timeout -> return $ Left Timeout
+        _            -> finishJob job res
+
+-- | Send SIGTERM to a job and close its channel. This does nothing if the
+-- job is already done, otherwise waiting on it then fails with 'Cancelled'.
+cancelCommand :: Job -> SimpleSSH ()
+cancelCommand job = liftIOEither $ mask_ $ do
+  outcome <- readIORef $ jobOutcome job
+  case outcome of
+    Just _  -> return $ Right ()
+    Nothing -> do
+      execCancelC $ jobExec job
+      res <- stepLoop (jobSession job) $
+               execStepC (jobSession job) (jobExec job)
+      fmap (const ()) <$> finishJob job res
+
+-- | Send several commands to the server, running them concurrently over the
+-- same connection, each on its own channel.
+--
+-- The results are in the same order as the commands. At most 10 channels are
+-- open at the same time, which is the default limit of OpenSSH (see
+-- @MaxSessions@ in sshd_config), use 'execCommandsWith' to change it.
+execCommands :: Session  -- ^ Session to use
+             -> [String] -- ^ Commands
+             -> SimpleSSH [Result]
+execCommands = execCommandsWith 10
+
+-- | Version of 'execCommands' with a custom limit on the number of channels
+-- open at the same time, 0 meaning no limit.
+execCommandsWith :: Int      -- ^ Maximum number of channels
+                 -> Session  -- ^ Session to use
+                 -> [String] -- ^ Commands
+                 -> SimpleSSH [Result]
+execCommandsWith _ _ [] = return []
+execCommandsWith maxChannels session commands = liftIOEither $
+  bracket (mapM newCStringLen commands) (mapM_ (free . fst)) $
+    runBatch maxChannels session
+
+-- | Version of 'execCommands' taking the commands as raw bytes, which are
+-- neither encoded nor copied.
+execCommandsBytes :: Session      -- ^ Session to use
+                  -> [ByteString] -- ^ Commands
+                  -> SimpleSSH [Result]
+execCommandsBytes = execCommandsBytesWith 10
+
+-- | Version of 'execCommandsBytes' with a custom limit on the number of
+-- channels open at the same time, 0 meaning no limit.
+execCommandsBytesWith :: Int          -- ^ Maximum number of channels
+                      -> Session      -- ^ Session to use
+                      -> [ByteString] -- ^ Commands
+                      -> SimpleSSH [Result]
+execCommandsBytesWith _ _ [] = return []
+execCommandsBytesWith maxChannels session commands = liftIOEither $
+  withMany BS.unsafeUseAsCStringLen commands $ runBatch maxChannels session
+
+runBatch :: Int -> Session -> [CStringLen]
+         -> IO (Either SimpleSSHError [Result])
+runBatch maxChannels session commandsC =
+  withArrayLen (map fst commandsC) $ \count commandsPtr ->
+  withArray (map (fromIntegral . snd) commandsC) $ \lensPtr ->
+  bracket (batchNewC commandsPtr lensPtr (fromIntegral count)
+                     (fromIntegral maxChannels))
+          (batchFreeC session) $ \batch -> do
+    res <- stepLoop session $ batchStepC session batch
+    case res of
+      Left err -> return $ Left err
+      Right () ->
+        Right <$> bracket (batchTakeResultsC batch) freeResultsC readResults
 
 -- | Send a file to the server and returns the number of bytes transferred.
 --
@@ -215,18 +642,262 @@ sendFile :: Session -- ^ Session to use
          -> ByteString -- ^ Data to send
          -> String  -- ^ Target path
          -> SimpleSSH Integer
-sendFile session mode sourceData target = do
-  liftIOEither $ do
-    targetC <- newCString target
-    let modeC = fromInteger mode
+sendFile session mode sourceData target =
+  liftIOEither $ withCString target $ sendData session mode sourceData
+
+-- | Version of 'sendFile' taking the target path as raw bytes, which are not
+-- encoded. SCP needs a NUL-terminated path, the bytes must not contain any
+-- NUL.
+sendFileBytes :: Session    -- ^ Session to use
+              -> Integer    -- ^ File mode (e.g. 0o777, note the octal
+                            -- notation)
+              -> ByteString -- ^ Data to send
+              -> ByteString -- ^ Target path
+              -> SimpleSSH Integer
+sendFileBytes session mode sourceData target =
+  liftIOEither $ BS.useAsCString target $ sendData session mode sourceData
+
+sendData :: Session -> Integer -> ByteString -> CString
+         -> IO (Either SimpleSSHError Integer)
+sendData session mode sourceData targetC = do
+  let modeC = fromInteger mode
+
+  liftEitherCFree freeEitherCountC readCount $
+    BS.unsafeUseAsCStringLen sourceData $
+      \(sourceC, len) -> sendFileC session modeC sourceC (fromIntegral len) targetC
+
+-- | Send a local file to the server and returns the number of bytes
+-- transferred.
+--
+-- The file is streamed through a fixed buffer instead of being loaded in
+-- memory.
+sendFileFromPath :: Session  -- ^ Session to use
+                 -> Integer  -- ^ File mode (e.g. 0o777, note the octal
+                             -- notation)
+                 -> FilePath -- ^ Local path
+                 -> String   -- ^ Target path
+                 -> SimpleSSH Integer
+sendFileFromPath session mode source target = do
+  liftIOEither $ withCString source $ \sourceC ->
+    withCString target $ \targetC ->
+      liftEitherCFree freeEitherCountC readCount $
+        sendFileFromPathC session (fromInteger mode) sourceC targetC
+
+-- | Send a lazy 'BL.ByteString' to the server chunk by chunk and returns the
+-- number of bytes transferred.
+--
+-- SCP needs the size upfront, it is given separately so that the data can be
+-- produced while it is sent. An exception raised while producing it aborts
+-- the transfer and is rethrown.
+sendFileLazy :: Session       -- ^ Session to use
+             -> Integer       -- ^ File mode (e.g. 0o777, note the octal
+                              -- notation)
+             -> Integer       -- ^ Size of the data
+             -> BL.ByteString -- ^ Data to send
+             -> String        -- ^ Target path
+             -> SimpleSSH Integer
+sendFileLazy session mode size sourceData target = do
+  (failure, callback) <- liftIO $ lazySource sourceData
+
+  res <- liftIO $ bracket (mkReadCallback callback) freeHaskellFunPtr $
+    \callbackC -> withCString target $ \targetC ->
+      liftEitherCFree freeEitherCountC readCount $
+        sendFileCallbackC session (fromInteger mode) (fromInteger size)
+                          callbackC targetC
+
+  liftIO $ readIORef failure >>= mapM_ throwIO
+  either throwError return res
+
+-- | Callback handing out a lazy 'BL.ByteString' chunk by chunk, along with
+-- where an exception raised while forcing it is kept.
+lazySource :: BL.ByteString -> IO (IORef (Maybe SomeException), ReadCallback)
+lazySource sourceData = do
+  source  <- newIORef $ BL.toChunks sourceData
+  failure <- newIORef Nothing
 
-    res <- liftEitherCFree freeEitherCountC readCount $
-      BS.unsafeUseAsCStringLen sourceData $
-        \(sourceC, len) -> sendFileC session modeC sourceC (fromIntegral len) targetC
+  let abort e = writeIORef failure (Just (e :: SomeException)) >> return (-1)
+      callback buffer room = handle abort $ do
+        chunks <- readIORef source
+        case chunks of
+          [] -> return 0
+          chunk : rest -> do
+            let (now, later) = BS.splitAt (fromIntegral room) chunk
+            BS.unsafeUseAsCStringLen now $ \(nowC, len) ->
+              copyBytes buffer nowC len
+            writeIORef source $ if BS.null later then rest else later : rest
+            return $ fromIntegral $ BS.length now
 
-    free targetC
+  return (failure, callback)
+
+-- | Receive a file from the server and returns the number of bytes
+-- transferred.
+--
+-- The file is streamed to disk through a fixed buffer and created with the
+-- mode of the remote file.
+receiveFile :: Session  -- ^ Session to use
+            -> String   -- ^ Remote path
+            -> FilePath -- ^ Local path
+            -> SimpleSSH Integer
+receiveFile session source target = do
+  liftIOEither $ withCString source $ \sourceC ->
+    withCString target $ \targetC ->
+      liftEitherCFree freeEitherCountC readCount $
+        receiveFileC session sourceC targetC
+
+-- | Change the timeout used by the following operations on a session.
+--
+-- Every operation fails with 'Timeout' when the socket stays idle for longer
+-- than this, the initial value being the one given to 'openSession'.
+setTimeout :: Session -- ^ Session to use
+           -> Integer -- ^ Timeout in seconds
+           -> SimpleSSH ()
+setTimeout session timeout = lift $
+  setTimeoutC session (fromInteger (timeout * 1000))
 
-    return res
+-- | Change the sizes used by the following transfers on a session.
+--
+-- Larger writes and windows reduce the per-packet overhead on fast links.
+setTransferOptions :: Session -> TransferOptions -> SimpleSSH ()
+setTransferOptions session options = lift $
+  setTransferOptionsC session
+                      (fromIntegral (transferChunkSize options))
+                      (fromIntegral (transferWindowSize options))
+                      (fromIntegral (transferPacketSize options))
+
+-- | Change the TCP options of a session, e.g. 'interactiveSocketOptions'
+-- before a series of short commands and 'bulkSocketOptions' before a large
+-- transfer.
+--
+-- Buffer sizes set after the connection may not raise the TCP window above
+-- what was negotiated when connecting, so they are better given to
+-- 'openSessionWith'.
+setSocketOptions :: Session -> SocketOptions -> SimpleSSH ()
+setSocketOptions session socket = liftIOEither $
+  withOptions defaultSessionOptions { sessionSocket = socket } $
+    liftStatusC . setSocketOptionsC session
+
+-- | Send SSH keepalives while waiting on the server, see
+-- 'sessionKeepAlive'.
+--
+-- A dead connection is then detected after the given number of unanswered
+-- keepalives instead of the full timeout. Since the server answers them, a
+-- command staying silent for longer than the timeout does not fail while its
+-- connection is alive.
+setKeepAlive :: Session -- ^ Session to use
+             -> Int     -- ^ Interval in seconds, 0 to disable
+             -> Int     -- ^ Unanswered keepalives before giving up, 0 for no
+                        -- limit
+             -> SimpleSSH ()
+setKeepAlive session interval countMax = lift $
+  setKeepaliveC session (fromIntegral interval) (fromIntegral countMax)
+
+-- | Check that the connection of a session has not been closed and that the
+-- server answers a keepalive, waiting for the answer for at most the timeout
+-- of the session or 2 seconds, whichever is shorter.
+--
+-- This is what pools check before handing out an idle session.
+isSessionAlive :: Session -> IO Bool
+isSessionAlive session = (/= 0) <$> sessionAliveC session
+
+-- | Get the time it took to resolve the hostname and connect to the server.
+getConnectTiming :: Session -> SimpleSSH ConnectTiming
+getConnectTiming session = lift $
+  alloca $ \resolvePtr -> alloca $ \connectPtr -> do
+    getConnectTimingC session resolvePtr connectPtr
+    ConnectTiming <$> (toInteger <$> peek resolvePtr)
+                  <*> (toInteger <$> peek connectPtr)
+
+-- | Get the measurements of a session opened with 'sessionStats'.
+getStats :: Session -> SimpleSSH Stats
+getStats session = lift $ allocaArray statsFields $ \fieldsPtr -> do
+  getStatsC session fieldsPtr
+  [started, resolved, connected, handshaken, authStarted, authenticated,
+   bytesIn, bytesOut, waits, blocked] <-
+    map toInteger <$> peekArray statsFields fieldsPtr
+  return $ Stats started resolved connected handshaken authStarted
+                 authenticated bytesIn bytesOut waits blocked
+  where
+    statsFields = fromIntegral statsFieldsC
+
+-- | Start measuring a session opened without 'sessionStats', from now on.
+enableStats :: Session -> SimpleSSH ()
+enableStats = lift . statsEnableC
+
+-- | The recent history of a traced session, oldest first, see
+-- 'sessionTrace'. Empty when the session is not traced.
+--
+-- This can be called from another thread while the session is in use, e.g.
+-- to see where a stalled command is stuck.
+getTrace :: Session -> SimpleSSH [TraceEvent]
+getTrace session = lift $ do
+  size <- traceSizeC session
+  allocaArray (fromIntegral size * traceFields) $ \fieldsPtr ->
+    allocaBytes (fromIntegral size * traceMessageSize) $ \messagesPtr -> do
+      count <- fromIntegral <$> traceDumpC session fieldsPtr messagesPtr size
+      fields <- map toInteger <$> peekArray (count * traceFields) fieldsPtr
+      forM (zip [0 ..] (chunks fields)) $
+        \(i, (time, kind, subject, value)) -> do
+          message <- BS.packCString $
+            messagesPtr `plusPtr` (i * traceMessageSize)
+          return $ TraceEvent time (readTraceKind kind) subject value message
+  where
+    traceFields      = fromIntegral traceFieldsC
+    traceMessageSize = fromIntegral traceMessageC
+
+    chunks (time : kind : subject : value : rest) =
+      (time, kind, subject, value) : chunks rest
+    chunks _ = []
+
+-- | Start tracing a session opened without 'sessionTrace', keeping its last
+-- events.
+enableTrace :: Session -- ^ Session to trace
+            -> Int     -- ^ Number of events kept
+            -> SimpleSSH ()
+enableTrace session size = lift $ traceEnableC session (fromIntegral size) 0
+
+-- | LIBSSH2_TRACE_KEX, AUTH, CONN, ERROR and SOCKET, leaving out the
+-- per-packet messages.
+libssh2Trace :: CInt
+libssh2Trace = traceKexC .|. traceAuthC .|. traceConnC .|. traceErrorC
+           .|. traceSocketC
+
+readTraceKind :: Integer -> TraceKind
+readTraceKind kind = case kind of
+  1  -> TraceConnect
+  2  -> TraceConnected
+  3  -> TraceHandshake
+  4  -> TraceAuth
+  5  -> TraceChannelOpen
+  6  -> TraceExec
+  7  -> TraceEof
+  8  -> TraceClose
+  9  -> TraceCancel
+  10 -> TraceWait
+  11 -> TraceWake
+  12 -> TraceLibssh2
+  _  -> TraceUnknown (fromInteger kind)
+
+-- | Get the algorithms negotiated during the handshake.
+getMethods :: Session -> SimpleSSH Methods
+getMethods session = lift $
+  Methods <$> method 0 <*> method 1 <*> method 2 <*> method 3
+          <*> method 4 <*> method 5 <*> method 6 <*> method 7
+  where
+    -- LIBSSH2_METHOD_KEX to LIBSSH2_METHOD_COMP_SC
+    method i = do
+      str <- getMethodC session i
+      if str == nullPtr then return "" else peekCString str
+
+-- | Set for how long resolved hostnames are cached, 60 seconds by default.
+--
+-- The cache is shared by all the sessions of the process, 0 disables it.
+setDnsCacheTtl :: Integer -- ^ Time to live in seconds
+               -> IO ()
+setDnsCacheTtl = setDnsTtlC . fromInteger
+
+-- | Forget every resolved hostname.
+flushDnsCache :: IO ()
+flushDnsCache = flushDnsCacheC
 
 -- | Close a session.
 closeSession :: Session -> SimpleSSH ()
@@ -297,3 +968,225 @@ withSessionMemory hostname port timeout username publicKey
   ExceptT $
     runExceptT (action authenticatedSession)
       `finally` closeSessionC authenticatedSession
+
+-- | Open a connection with custom options, authenticate with the given
+-- action, e.g. 'authenticateWithAgent', execute some action and close the
+-- connection.
+withSessionWith :: SessionOptions                 -- ^ Options
+                -> String                         -- ^ Hostname
+                -> Integer                        -- ^ Port
+                -> Integer                        -- ^ Timeout in seconds
+                -> (Session -> SimpleSSH Session) -- ^ Authentication
+                -> (Session -> SimpleSSH a)       -- ^ Monadic action on the
+                                                  -- session
+                -> SimpleSSH a
+withSessionWith options hostname port timeout authenticate action = do
+  session              <- openSessionWith options hostname port timeout
+  authenticatedSession <- authenticate session `closingOnError` session
+  ExceptT $
+    runExceptT (action authenticatedSession)
+      `finally` closeSessionC authenticatedSession
+
+-- | Run a command on many hosts at once and return the outcome of each host,
+-- in the same order.
+--
+-- All the hosts are driven from a single event loop in C instead of a thread
+-- per host. Connection, authentication and execution of the command must
+-- all happen within the timeout of 'Concurrency', the host failing with
+-- 'Timeout' otherwise.
+execOnHosts :: [HostSpec]  -- ^ Hosts
+            -> String      -- ^ Command
+            -> Concurrency -- ^ Limits
+            -> IO [(HostSpec, Either SimpleSSHError Result)]
+execOnHosts [] _ _ = return []
+execOnHosts specs command concurrency =
+  bracket (hostsNewC (fromIntegral (length specs))) hostsFreeC $ \hosts -> do
+    forM_ (zip [0 ..] specs) $ \(i, spec) ->
+      withCString (hostName spec) $ \hostnameC ->
+      withCString (hostUser spec) $ \usernameC ->
+        let portC = fromInteger (hostPort spec)
+        in case hostAuth spec of
+          AuthPassword password -> withCString password $ \passwordC ->
+            hostsSetPasswordC hosts i hostnameC portC usernameC passwordC
+          AuthKey publicKeyPath privateKeyPath passphrase ->
+            withCString publicKeyPath $ \publicKeyPathC ->
+            withCString privateKeyPath $ \privateKeyPathC ->
+            withCString passphrase $ \passphraseC ->
+              hostsSetKeyC hosts i hostnameC portC usernameC publicKeyPathC
+                           privateKeyPathC passphraseC
+          AuthKeyHandle key ->
+            hostsSetKeyHandleC hosts i hostnameC portC usernameC key
+          AuthAgent ->
+            hostsSetAgentC hosts i hostnameC portC usernameC
+
+    withCString command $ \commandC ->
+      execOnHostsC hosts commandC
+                   (fromIntegral (concurrencyHosts concurrency))
+                   (fromInteger (concurrencyTimeout concurrency * 1000))
+
+    forM (zip [0 ..] specs) $ \(i, spec) -> do
+      res <- liftEitherCFree freeEitherResultC readResult $
+        hostsTakeResultC hosts i
+      return (spec, res)
+
+-- | Create a pool of authenticated sessions.
+newPool :: Int     -- ^ Maximum number of sessions per host and port,
+                   -- whatever their credentials, 0 for no limit
+        -> Integer -- ^ Time in seconds after which idle sessions are closed
+        -> IO Pool
+newPool maxPerHost idleTimeout =
+  poolNewC (fromIntegral maxPerHost) (fromInteger idleTimeout)
+
+-- | Close the idle sessions of a pool and free it.
+--
+-- Sessions still borrowed from the pool must not be given back afterwards.
+destroyPool :: Pool -> IO ()
+destroyPool = poolFreeC
+
+-- | Close the sessions which have been idle for too long.
+--
+-- This is also done every time a session is borrowed or given back.
+evictIdleSessions :: Pool -> IO ()
+evictIdleSessions = poolEvictIdleC
+
+-- | Borrow a session from a pool, run some action on it and give it back.
+--
+-- If there is no idle session for the key, a new one is opened with the given
+-- action. Idle sessions are checked with a keepalive before being handed out.
+-- The session is closed instead of being given back if the action fails.
+--
+-- A session is handed out to anyone giving its key without authenticating
+-- again, so the key must identify the credentials exactly, not just hash
+-- them with a non-cryptographic function.
+withPooledSession :: Pool                     -- ^ Pool to use
+                  -> String                   -- ^ Host the cap of the pool
+                                              -- applies to, e.g. host:port
+                  -> String                   -- ^ Key identifying the user
+                                              -- and the credentials
+                  -> Integer                  -- ^ Timeout in seconds to wait
+                                              -- for a slot when the host is
+                                              -- at its cap
+                  -> SimpleSSH Session        -- ^ Action opening an
+                                              -- authenticated session
+                  -> (Session -> SimpleSSH a) -- ^ Monadic action on the
+                                              -- session
+                  -> SimpleSSH a
+withPooledSession pool host key timeout open action = do
+  mSession <- liftIOEither $ withCString host $ \hostC ->
+    withCString key $ \keyC -> alloca $ \sessionPtr -> do
+      rc <- poolAcquireC pool hostC keyC (fromInteger (timeout * 1000))
+                         sessionPtr
+      if rc /= 0
+        then return $ Left $ readError rc
+        else do
+          ptr <- peek sessionPtr
+          return $ Right $
+            if ptr == nullPtr then Nothing else Just (Session ptr)
+
+  session <- case mSession of
+    Just session -> return session
+    Nothing      -> guarded (Session nullPtr) (const (return ())) open
+
+  guarded session release $ action session
+
+  where
+    discard session = withCString host $ \hostC -> withCString key $ \keyC ->
+      poolDiscardC pool hostC keyC session
+    release session = withCString host $ \hostC -> withCString key $ \keyC ->
+      poolReleaseC pool hostC keyC session
+
+    guarded :: Session -> (Session -> IO ()) -> SimpleSSH b -> SimpleSSH b
+    guarded session onSuccess act = ExceptT $ do
+      eRes <- runExceptT act `onException` discard session
+      either (const (discard session)) (const (onSuccess session)) eRes
+      return eRes
+
+-- | Version of 'withSessionPassword' borrowing the session from a pool.
+withPooledSessionPassword :: Pool                     -- ^ Pool to use
+                          -> String                   -- ^ Hostname
+                          -> Integer                  -- ^ Port
+                          -> Integer                  -- ^ Timeout in seconds
+                          -> String                   -- ^ Username
+                          -> String                   -- ^ Password
+                          -> (Session -> SimpleSSH a) -- ^ Monadic action on
+                                                      -- the session
+                          -> SimpleSSH a
+withPooledSessionPassword pool hostname port timeout username password = do
+  key <- lift $ poolKey username [text "password", text password]
+  withPooledSession pool (poolHost hostname port) key timeout $ do
+    session <- openSession hostname port timeout
+    authenticateWithPassword session username password
+      `closingOnError` session
+
+-- | Version of 'withSessionKey' borrowing the session from a pool.
+withPooledSessionKey :: Pool                     -- ^ Pool to use
+                     -> String                   -- ^ Hostname
+                     -> Integer                  -- ^ Port
+                     -> Integer                  -- ^ Timeout in seconds
+                     -> String                   -- ^ Username
+                     -> String                   -- ^ Path to public key
+                     -> String                   -- ^ Path to private key
+                     -> String                   -- ^ Passphrase
+                     -> (Session -> SimpleSSH a) -- ^ Monadic action on the
+                                                 -- session
+                     -> SimpleSSH a
+withPooledSessionKey pool hostname port timeout username publicKeyPath
+                     privateKeyPath passphrase = do
+  key <- lift $ poolKey username $
+    map text ["key", publicKeyPath, privateKeyPath, passphrase]
+  withPooledSession pool (poolHost hostname port) key timeout $ do
+    session <- openSession hostname port timeout
+    authenticateWithKey session username publicKeyPath privateKeyPath
+                        passphrase
+      `closingOnError` session
+
+-- | Version of 'withSessionMemory' borrowing the session from a pool.
+withPooledSessionMemory :: Pool                     -- ^ Pool to use
+                        -> String                   -- ^ Hostname
+                        -> Integer                  -- ^ Port
+                        -> Integer                  -- ^ Timeout in seconds
+                        -> String                   -- ^ Username
+                        -> ByteString               -- ^ Public key content
+                        -> ByteString               -- ^ Private key content
+                        -> String                   -- ^ Passphrase
+                        -> (Session -> SimpleSSH a) -- ^ Monadic action on the
+                                                    -- session
+                        -> SimpleSSH a
+withPooledSessionMemory pool hostname port timeout username publicKey
+                        privateKey passphrase = do
+  key <- lift $ poolKey username
+    [text "memory", publicKey, privateKey, text passphrase]
+  withPooledSession pool (poolHost hostname port) key timeout $ do
+    session <- openSession hostname port timeout
+    authenticateWithMemory session username publicKey privateKey passphrase
+      `closingOnError` session
+
+-- | Close the session if the action fails.
+closingOnError :: SimpleSSH a -> Session -> SimpleSSH a
+closingOnError act session =
+  act `catchError` \err -> closeSession session >> throwError err
+
+-- | What the cap of a pool applies to.
+poolHost :: String -> Integer -> String
+poolHost hostname port = hostname ++ ":" ++ show port
+
+-- | Key of a pooled session: the SHA-256, in hexadecimal, of the username
+-- and the credentials, each prefixed with its length so that no two lists
+-- are hashed the same. The credentials themselves are not kept.
+poolKey :: String -> [ByteString] -> IO String
+poolKey username credentials =
+  BS.unsafeUseAsCStringLen payload $ \(payloadC, payloadLen) ->
+  allocaBytes digestSize $ \digestC -> do
+    sha256C payloadC (fromIntegral payloadLen) digestC
+    digest <- BS.packCStringLen (digestC, digestSize)
+    return $ concatMap (\c -> [ intToDigit (ord c `div` 16)
+                              , intToDigit (ord c `mod` 16) ])
+                       (BS.unpack digest)
+  where
+    payload    = BS.concat [ BS.concat [BS.pack (show (BS.length c)), ":", c]
+                           | c <- text username : credentials ]
+    digestSize = fromIntegral sha256SizeC
+
+-- | Text credentials as bytes, 'show' keeping every character apart.
+text :: String -> ByteString
+text = BS.pack . show
@@ -1,56 +1,188 @@
+{-# LANGUAGE CApiFFI                  #-}
 {-# LANGUAGE ForeignFunctionInterface #-}
 
 module Network.SSH.Client.SimpleSSH.Foreign where
 
+import           Data.Int
+import           Data.Word
+
 import           Foreign.C.String
 import           Foreign.C.Types
 import           Foreign.Ptr
 
+import           System.Posix.Types
+
 type CEither    = Ptr ()
 newtype Session = Session (Ptr ())
 type CResult    = Ptr ()
+type CResults   = Ptr ()
 type CCount     = Ptr ()
+newtype Pool    = Pool (Ptr ())
+newtype SFTP    = SFTP (Ptr ())
+newtype Hosts   = Hosts (Ptr ())
+newtype Key     = Key (Ptr ()) deriving (Show, Eq)
+newtype Forward = Forward (Ptr ())
+newtype Jump    = Jump (Ptr ()) deriving (Show, Eq)
+type COptions    = Ptr ()
+type CAttributes = Ptr ()
+type CEntries    = Ptr ()
+type CExec       = Ptr ()
+type CBatch      = Ptr ()
+
+-- Constants of the C headers, imported so as not to drift apart from them
+
+foreign import capi "libssh2.h value LIBSSH2_ERROR_EAGAIN"
+  eagainC :: CInt
+
+foreign import capi "libssh2.h value LIBSSH2_SESSION_BLOCK_INBOUND"
+  blockInboundC :: CInt
+
+foreign import capi "libssh2.h value LIBSSH2_SESSION_BLOCK_OUTBOUND"
+  blockOutboundC :: CInt
+
+foreign import capi "libssh2.h value LIBSSH2_TRACE_KEX"
+  traceKexC :: CInt
+
+foreign import capi "libssh2.h value LIBSSH2_TRACE_AUTH"
+  traceAuthC :: CInt
+
+foreign import capi "libssh2.h value LIBSSH2_TRACE_CONN"
+  traceConnC :: CInt
+
+foreign import capi "libssh2.h value LIBSSH2_TRACE_ERROR"
+  traceErrorC :: CInt
+
+foreign import capi "libssh2.h value LIBSSH2_TRACE_SOCKET"
+  traceSocketC :: CInt
+
+foreign import capi "simplessh/types.h value SIMPLESSH_RESULT_FIELDS"
+  resultFieldsC :: CInt
+
+foreign import capi "simplessh/stats.h value SIMPLESSH_STATS_FIELDS"
+  statsFieldsC :: CInt
 
-foreign import ccall "simplessh_is_left"
+foreign import capi "simplessh/trace.h value SIMPLESSH_TRACE_FIELDS"
+  traceFieldsC :: CInt
+
+foreign import capi "simplessh/trace.h value SIMPLESSH_TRACE_MESSAGE"
+  traceMessageC :: CInt
+
+foreign import capi "simplessh/sha256.h value SIMPLESSH_SHA256_SIZE"
+  sha256SizeC :: CInt
+
+type ChunkCallback = CInt -> Ptr CChar -> CSize -> IO CInt
+type ReadCallback  = Ptr CChar -> CSize -> IO CSsize
+
+foreign import ccall "wrapper"
+  mkChunkCallback :: ChunkCallback
+                  -> IO (FunPtr ChunkCallback)
+
+foreign import ccall "wrapper"
+  mkReadCallback :: ReadCallback
+                 -> IO (FunPtr ReadCallback)
+
+foreign import ccall unsafe "simplessh_is_left"
   isLeftC :: CEither
           -> IO CInt
 
-foreign import ccall "simplessh_get_error"
+foreign import ccall unsafe "simplessh_get_error"
   getErrorC :: CEither
             -> IO CInt
 
-foreign import ccall "simplessh_get_value"
+foreign import ccall unsafe "simplessh_get_value"
   getValueC :: CEither
             -> IO (Ptr a)
 
-foreign import ccall "simplessh_get_out"
+foreign import ccall unsafe "simplessh_either_unwrap"
+  eitherUnwrapC :: CEither
+                -> Ptr (Ptr ())
+                -> IO CInt
+
+foreign import ccall unsafe "simplessh_result_read"
+  resultReadC :: CResult
+              -> Ptr CString
+              -> Ptr Int64
+              -> IO ()
+
+foreign import ccall unsafe "simplessh_get_out"
   getOutC :: CResult
           -> IO CString
 
-foreign import ccall "simplessh_get_err"
+foreign import ccall unsafe "simplessh_get_err"
   getErrC :: CResult
           -> IO CString
 
-foreign import ccall "simplessh_get_exit_code"
+foreign import ccall unsafe "simplessh_get_out_len"
+  getOutLenC :: CResult
+             -> IO CSize
+
+foreign import ccall unsafe "simplessh_get_err_len"
+  getErrLenC :: CResult
+             -> IO CSize
+
+foreign import ccall unsafe "simplessh_get_out_dropped"
+  getOutDroppedC :: CResult
+                 -> IO CSize
+
+foreign import ccall unsafe "simplessh_get_err_dropped"
+  getErrDroppedC :: CResult
+                 -> IO CSize
+
+foreign import ccall unsafe "simplessh_take_out"
+  takeOutC :: CResult
+           -> IO CString
+
+foreign import ccall unsafe "simplessh_take_err"
+  takeErrC :: CResult
+           -> IO CString
+
+foreign import ccall unsafe "simplessh_get_exit_code"
   getExitCodeC :: CResult
                -> IO CInt
 
-foreign import ccall "simplessh_get_exit_signal"
+foreign import ccall unsafe "simplessh_get_exit_signal"
   getExitSignalC :: CResult
                  -> IO CString
 
-foreign import ccall "simplessh_get_count"
+foreign import ccall unsafe "simplessh_get_results_count"
+  getResultsCountC :: CResults
+                   -> IO CInt
+
+foreign import ccall unsafe "simplessh_get_result"
+  getResultC :: CResults
+             -> CInt
+             -> IO CResult
+
+foreign import ccall unsafe "simplessh_get_count"
   getCountC :: CCount
-            -> IO CInt
+            -> IO Int64
+
+foreign import ccall unsafe "simplessh_free_result"
+  freeResultC :: CResult
+              -> IO ()
 
-foreign import ccall "simplessh_free_either_result"
+foreign import ccall unsafe "simplessh_free_results"
+  freeResultsC :: CResults
+               -> IO ()
+
+foreign import ccall unsafe "simplessh_free_either_result"
   freeEitherResultC :: CEither
                     -> IO ()
 
-foreign import ccall "simplessh_free_either_count"
+foreign import ccall unsafe "simplessh_free_either_results"
+  freeEitherResultsC :: CEither
+                     -> IO ()
+
+foreign import ccall unsafe "simplessh_free_either_count"
   freeEitherCountC :: CEither
                    -> IO ()
 
+foreign import ccall "simplessh_init"
+  initC :: IO CInt
+
+foreign import ccall "simplessh_exit"
+  exitC :: IO ()
+
 foreign import ccall "simplessh_open_session"
   openSessionC :: CString
                -> CUShort
@@ -81,19 +213,632 @@ foreign import ccall "simplessh_authenticate_memory"
                       -> CString
                       -> IO CEither
 
+foreign import ccall "simplessh_key_load"
+  keyLoadC :: CString
+           -> CString
+           -> CString
+           -> IO CEither
+
+foreign import ccall unsafe "simplessh_key_free"
+  keyFreeC :: Key
+           -> IO ()
+
 foreign import ccall "simplessh_exec_command"
   execCommandC :: Session
                -> CString
                -> IO CEither
 
+foreign import ccall "simplessh_exec_command_with"
+  execCommandWithC :: Session
+                   -> CString
+                   -> CSize
+                   -> IO CEither
+
+foreign import ccall "simplessh_exec_command_stream"
+  execCommandStreamC :: Session
+                     -> CString
+                     -> FunPtr ChunkCallback
+                     -> IO CEither
+
+foreign import ccall "simplessh_exec_commands"
+  execCommandsC :: Session
+                -> Ptr CString
+                -> CInt
+                -> CInt
+                -> IO CEither
+
 foreign import ccall "simplessh_send_file"
   sendFileC :: Session
             -> CInt
             -> Ptr CChar
-            -> CInt
+            -> Int64
             -> CString
             -> IO CEither
 
+foreign import ccall "simplessh_send_file_from_path"
+  sendFileFromPathC :: Session
+                    -> CInt
+                    -> CString
+                    -> CString
+                    -> IO CEither
+
+foreign import ccall "simplessh_send_file_callback"
+  sendFileCallbackC :: Session
+                    -> CInt
+                    -> Int64
+                    -> FunPtr ReadCallback
+                    -> CString
+                    -> IO CEither
+
+foreign import ccall "simplessh_receive_file"
+  receiveFileC :: Session
+               -> CString
+               -> CString
+               -> IO CEither
+
+foreign import ccall "simplessh_set_transfer_options"
+  setTransferOptionsC :: Session
+                      -> CSize
+                      -> CUInt
+                      -> CUInt
+                      -> IO ()
+
+foreign import ccall "simplessh_set_timeout"
+  setTimeoutC :: Session
+              -> CInt
+              -> IO ()
+
+-- Nonblocking interface. These calls never wait on the socket, the waiting
+-- being left to the IO manager. The short ones are unsafe, while those which
+-- may compute or move data for long (key exchange, known hosts check, key
+-- decryption, agent round trip, reading the output of commands) are safe so
+-- as not to hold back the garbage collector.
+
+foreign import ccall unsafe "simplessh_get_socket"
+  getSocketC :: Session
+             -> IO CInt
+
+foreign import ccall unsafe "simplessh_block_directions"
+  blockDirectionsC :: Session
+                   -> IO CInt
+
+foreign import ccall unsafe "simplessh_get_timeout"
+  getTimeoutC :: Session
+              -> IO CInt
+
+foreign import ccall unsafe "simplessh_get_keepalive_count_max"
+  getKeepaliveCountMaxC :: Session
+                        -> IO CInt
+
+foreign import ccall unsafe "simplessh_keepalive_tick"
+  keepaliveTickC :: Session
+                 -> IO CInt
+
+foreign import ccall unsafe "simplessh_set_keepalive"
+  setKeepaliveC :: Session
+                -> CInt
+                -> CInt
+                -> IO ()
+
+-- Safe as it waits for the answer to a keepalive
+foreign import ccall "simplessh_session_alive"
+  sessionAliveC :: Session
+                -> IO CInt
+
+foreign import ccall unsafe "simplessh_options_set_keepalive"
+  optionsSetKeepaliveC :: COptions
+                       -> CInt
+                       -> CInt
+                       -> IO ()
+
+foreign import ccall unsafe "simplessh_get_connect_timing"
+  getConnectTimingC :: Session
+                    -> Ptr Int64
+                    -> Ptr Int64
+                    -> IO ()
+
+foreign import ccall "simplessh_set_dns_ttl"
+  setDnsTtlC :: CInt
+             -> IO ()
+
+foreign import ccall "simplessh_flush_dns_cache"
+  flushDnsCacheC :: IO ()
+
+foreign import ccall "simplessh_connect"
+  connectC :: CString
+           -> CUShort
+           -> CInt
+           -> IO CEither
+
+foreign import ccall "simplessh_connect_with"
+  connectWithC :: CString
+               -> CUShort
+               -> CInt
+               -> COptions
+               -> IO CEither
+
+foreign import ccall unsafe "simplessh_options_new"
+  optionsNewC :: IO COptions
+
+foreign import ccall unsafe "simplessh_options_set_socket"
+  optionsSetSocketC :: COptions
+                    -> CInt
+                    -> CInt
+                    -> CInt
+                    -> CInt
+                    -> CInt
+                    -> CInt
+                    -> IO ()
+
+foreign import ccall unsafe "simplessh_options_set_known_hosts"
+  optionsSetKnownHostsC :: COptions
+                        -> CString
+                        -> CInt
+                        -> IO ()
+
+foreign import ccall unsafe "simplessh_options_set_methods"
+  optionsSetMethodsC :: COptions
+                     -> CString
+                     -> CString
+                     -> CString
+                     -> CString
+                     -> CInt
+                     -> IO ()
+
+foreign import ccall unsafe "simplessh_get_method"
+  getMethodC :: Session
+             -> CInt
+             -> IO CString
+
+foreign import ccall unsafe "simplessh_options_set_stats"
+  optionsSetStatsC :: COptions
+                   -> CInt
+                   -> IO ()
+
+foreign import ccall unsafe "simplessh_options_set_jump"
+  optionsSetJumpC :: COptions
+                  -> Jump
+                  -> IO ()
+
+foreign import ccall unsafe "simplessh_options_set_trace"
+  optionsSetTraceC :: COptions
+                   -> CInt
+                   -> CInt
+                   -> CInt
+                   -> IO ()
+
+foreign import ccall unsafe "simplessh_trace_enable"
+  traceEnableC :: Session
+               -> CSize
+               -> CInt
+               -> IO ()
+
+foreign import ccall unsafe "simplessh_trace_size"
+  traceSizeC :: Session
+             -> IO CSize
+
+foreign import ccall unsafe "simplessh_trace_dump"
+  traceDumpC :: Session
+             -> Ptr Int64
+             -> Ptr CChar
+             -> CSize
+             -> IO CSize
+
+foreign import ccall unsafe "simplessh_stats_enable"
+  statsEnableC :: Session
+               -> IO ()
+
+foreign import ccall unsafe "simplessh_stats_wait_begin"
+  statsWaitBeginC :: Session
+                  -> IO ()
+
+foreign import ccall unsafe "simplessh_stats_wait_end"
+  statsWaitEndC :: Session
+                -> IO ()
+
+foreign import ccall unsafe "simplessh_get_stats"
+  getStatsC :: Session
+            -> Ptr Int64
+            -> IO ()
+
+foreign import ccall unsafe "simplessh_get_exec_stats"
+  getExecStatsC :: CResult
+                -> Ptr Int64
+                -> IO ()
+
+foreign import ccall unsafe "simplessh_options_free"
+  optionsFreeC :: COptions
+               -> IO ()
+
+foreign import ccall unsafe "simplessh_set_socket_options"
+  setSocketOptionsC :: Session
+                    -> COptions
+                    -> IO CInt
+
+foreign import ccall "simplessh_handshake_step"
+  handshakeStepC :: Session
+                 -> IO CInt
+
+foreign import ccall unsafe "simplessh_authenticate_password_step"
+  authenticatePasswordStepC :: Session
+                            -> CString
+                            -> CString
+                            -> IO CInt
+
+foreign import ccall "simplessh_authenticate_key_step"
+  authenticateKeyStepC :: Session
+                       -> CString
+                       -> CString
+                       -> CString
+                       -> CString
+                       -> IO CInt
+
+foreign import ccall "simplessh_authenticate_memory_step"
+  authenticateMemoryStepC :: Session
+                          -> CString
+                          -> CString
+                          -> CInt
+                          -> CString
+                          -> CInt
+                          -> CString
+                          -> IO CInt
+
+foreign import ccall "simplessh_authenticate_key_handle_step"
+  authenticateKeyHandleStepC :: Session
+                             -> CString
+                             -> Key
+                             -> IO CInt
+
+foreign import ccall "simplessh_authenticate_agent_step"
+  authenticateAgentStepC :: Session
+                         -> CString
+                         -> IO CInt
+
+foreign import ccall unsafe "simplessh_exec_set_limits"
+  execSetLimitsC :: CExec
+                 -> CInt
+                 -> CSize
+                 -> CInt
+                 -> CSize
+                 -> IO ()
+
+foreign import ccall unsafe "simplessh_exec_new"
+  execNewC :: CString
+           -> CSize
+           -> IO CExec
+
+-- Safe as a step reads as much output as it can, and may call back into
+-- Haskell to read stdin
+foreign import ccall "simplessh_exec_step"
+  execStepC :: Session
+            -> CExec
+            -> IO CInt
+
+foreign import ccall unsafe "simplessh_exec_set_input"
+  execSetInputC :: CExec
+                -> FunPtr ReadCallback
+                -> IO ()
+
+foreign import ccall unsafe "simplessh_exec_start_step"
+  execStartStepC :: Session
+                 -> CExec
+                 -> IO CInt
+
+foreign import ccall unsafe "simplessh_exec_cancel"
+  execCancelC :: CExec
+              -> IO ()
+
+-- Constant, hence pure
+foreign import ccall unsafe "simplessh_exec_size"
+  execSize :: CSize
+
+foreign import ccall unsafe "simplessh_exec_setup"
+  execSetupC :: CExec
+             -> CString
+             -> CSize
+             -> CSize
+             -> CInt
+             -> CSize
+             -> CInt
+             -> CSize
+             -> IO ()
+
+foreign import ccall unsafe "simplessh_exec_get_result"
+  execGetResultC :: CExec
+                 -> IO CResult
+
+foreign import ccall unsafe "simplessh_exec_release"
+  execReleaseC :: Session
+               -> CExec
+               -> IO ()
+
+foreign import ccall unsafe "simplessh_exec_take_result"
+  execTakeResultC :: CExec
+                  -> IO CResult
+
+foreign import ccall unsafe "simplessh_exec_free"
+  execFreeC :: Session
+            -> CExec
+            -> IO ()
+
+foreign import ccall unsafe "simplessh_batch_new"
+  batchNewC :: Ptr CString
+            -> Ptr CSize
+            -> CInt
+            -> CInt
+            -> IO CBatch
+
+foreign import ccall "simplessh_batch_step"
+  batchStepC :: Session
+             -> CBatch
+             -> IO CInt
+
+foreign import ccall unsafe "simplessh_batch_take_results"
+  batchTakeResultsC :: CBatch
+                    -> IO CResults
+
+foreign import ccall unsafe "simplessh_batch_free"
+  batchFreeC :: Session
+             -> CBatch
+             -> IO ()
+
 foreign import ccall "simplessh_close_session"
   closeSessionC :: Session
                 -> IO ()
+
+foreign import ccall "simplessh_pool_new"
+  poolNewC :: CInt
+           -> CInt
+           -> IO Pool
+
+foreign import ccall "simplessh_pool_acquire"
+  poolAcquireC :: Pool
+               -> CString
+               -> CString
+               -> CInt
+               -> Ptr (Ptr ())
+               -> IO CInt
+
+foreign import ccall "simplessh_pool_release"
+  poolReleaseC :: Pool
+               -> CString
+               -> CString
+               -> Session
+               -> IO ()
+
+foreign import ccall "simplessh_pool_discard"
+  poolDiscardC :: Pool
+               -> CString
+               -> CString
+               -> Session
+               -> IO ()
+
+foreign import ccall unsafe "simplessh_sha256"
+  sha256C :: Ptr CChar
+          -> CSize
+          -> Ptr CChar
+          -> IO ()
+
+foreign import ccall "simplessh_pool_evict_idle"
+  poolEvictIdleC :: Pool
+                 -> IO ()
+
+foreign import ccall "simplessh_pool_free"
+  poolFreeC :: Pool
+            -> IO ()
+
+foreign import ccall "simplessh_hosts_new"
+  hostsNewC :: CInt
+            -> IO Hosts
+
+foreign import ccall "simplessh_hosts_set_password"
+  hostsSetPasswordC :: Hosts
+                    -> CInt
+                    -> CString
+                    -> CUShort
+                    -> CString
+                    -> CString
+                    -> IO ()
+
+foreign import ccall "simplessh_hosts_set_key"
+  hostsSetKeyC :: Hosts
+               -> CInt
+               -> CString
+               -> CUShort
+               -> CString
+               -> CString
+               -> CString
+               -> CString
+               -> IO ()
+
+foreign import ccall "simplessh_hosts_set_key_handle"
+  hostsSetKeyHandleC :: Hosts
+                     -> CInt
+                     -> CString
+                     -> CUShort
+                     -> CString
+                     -> Key
+                     -> IO ()
+
+foreign import ccall "simplessh_hosts_set_agent"
+  hostsSetAgentC :: Hosts
+                 -> CInt
+                 -> CString
+                 -> CUShort
+                 -> CString
+                 -> IO ()
+
+foreign import ccall "simplessh_exec_on_hosts"
+  execOnHostsC :: Hosts
+               -> CString
+               -> CInt
+               -> CInt
+               -> IO ()
+
+foreign import ccall "simplessh_hosts_take_result"
+  hostsTakeResultC :: Hosts
+                   -> CInt
+                   -> IO CEither
+
+foreign import ccall "simplessh_hosts_free"
+  hostsFreeC :: Hosts
+             -> IO ()
+
+foreign import ccall "simplessh_sftp_open"
+  sftpOpenC :: Session
+            -> IO CEither
+
+foreign import ccall "simplessh_sftp_set_window"
+  sftpSetWindowC :: SFTP
+                 -> CInt
+                 -> IO ()
+
+foreign import ccall "simplessh_sftp_close"
+  sftpCloseC :: SFTP
+             -> IO ()
+
+foreign import ccall unsafe "simplessh_sftp_session"
+  sftpSessionC :: SFTP
+               -> IO Session
+
+foreign import ccall "simplessh_sftp_stat"
+  sftpStatC :: SFTP
+            -> CString
+            -> IO CEither
+
+foreign import ccall "simplessh_sftp_readdir"
+  sftpReadDirC :: SFTP
+               -> CString
+               -> IO CEither
+
+foreign import ccall "simplessh_sftp_rename"
+  sftpRenameC :: SFTP
+              -> CString
+              -> CString
+              -> IO CInt
+
+foreign import ccall "simplessh_sftp_unlink"
+  sftpUnlinkC :: SFTP
+              -> CString
+              -> IO CInt
+
+foreign import ccall "simplessh_sftp_mkdir"
+  sftpMkdirC :: SFTP
+             -> CString
+             -> CInt
+             -> IO CInt
+
+foreign import ccall "simplessh_sftp_sync_blocks"
+  sftpSyncBlocksC :: SFTP
+                  -> CString
+                  -> CString
+                  -> Int64
+                  -> Ptr CChar
+                  -> Int64
+                  -> IO CEither
+
+foreign import ccall "simplessh_local_stat"
+  localStatC :: CString
+             -> IO CEither
+
+foreign import ccall "simplessh_local_readdir"
+  localReadDirC :: CString
+                -> IO CEither
+
+foreign import ccall "simplessh_sync_digests"
+  syncDigestsC :: CString
+               -> Int64
+               -> Int64
+               -> Ptr CChar
+               -> Ptr Int64
+               -> IO CInt
+
+foreign import ccall "simplessh_sftp_upload"
+  sftpUploadC :: SFTP
+              -> CInt
+              -> CString
+              -> CString
+              -> IO CEither
+
+foreign import ccall "simplessh_sftp_download"
+  sftpDownloadC :: SFTP
+                -> CString
+                -> CString
+                -> IO CEither
+
+foreign import ccall unsafe "simplessh_sftp_get_attributes"
+  sftpGetAttributesC :: CAttributes
+                     -> Ptr Word64
+                     -> Ptr CULong
+                     -> Ptr CULong
+                     -> Ptr CULong
+                     -> Ptr CULong
+                     -> Ptr CULong
+                     -> IO ()
+
+foreign import ccall unsafe "simplessh_sftp_entries_count"
+  sftpEntriesCountC :: CEntries
+                    -> IO CInt
+
+foreign import ccall unsafe "simplessh_sftp_entry_name"
+  sftpEntryNameC :: CEntries
+                 -> CInt
+                 -> IO CString
+
+foreign import ccall unsafe "simplessh_sftp_entry_attributes"
+  sftpEntryAttributesC :: CEntries
+                       -> CInt
+                       -> IO CAttributes
+
+foreign import ccall unsafe "simplessh_free_either_attributes"
+  freeEitherAttributesC :: CEither
+                        -> IO ()
+
+foreign import ccall unsafe "simplessh_free_either_entries"
+  freeEitherEntriesC :: CEither
+                     -> IO ()
+
+foreign import ccall "simplessh_forward_local"
+  forwardLocalC :: Session
+                -> CString
+                -> CUShort
+                -> CString
+                -> CUShort
+                -> IO CEither
+
+foreign import ccall "simplessh_forward_remote"
+  forwardRemoteC :: Session
+                 -> CString
+                 -> CUShort
+                 -> CString
+                 -> CUShort
+                 -> IO CEither
+
+foreign import ccall unsafe "simplessh_forward_port"
+  forwardPortC :: Forward
+               -> IO CInt
+
+foreign import ccall unsafe "simplessh_forward_count"
+  forwardCountC :: Forward
+                -> IO CInt
+
+-- Safe as it runs until stopped from another thread
+foreign import ccall "simplessh_forward_run"
+  forwardRunC :: Forward
+              -> IO CInt
+
+foreign import ccall unsafe "simplessh_forward_stop"
+  forwardStopC :: Forward
+               -> IO ()
+
+foreign import ccall "simplessh_forward_free"
+  forwardFreeC :: Forward
+               -> IO ()
+
+foreign import ccall "simplessh_jump_new"
+  jumpNewC :: Session
+           -> IO CEither
+
+foreign import ccall "simplessh_jump_free"
+  jumpFreeC :: Jump
+            -> IO ()
@@ -0,0 +1,155 @@
+-- | TCP port forwarding through an authenticated session.
+--
+-- All the connections of a forward are multiplexed over the session, each on
+-- its own channel, and relayed by 'runForward' from a single thread. Running
+-- a forward needs the threaded runtime, and the session must not be used for
+-- anything else while the forward runs.
+module Network.SSH.Client.SimpleSSH.Forward
+  ( -- * Data types
+    Forward
+  , Jump
+  -- * Main functions
+  , withLocalForward
+  , withRemoteForward
+  , withJump
+  -- * Lower-level functions
+  , openLocalForward
+  , openRemoteForward
+  , forwardPort
+  , forwardConnections
+  , runForward
+  , stopForward
+  , closeForward
+  , openJump
+  , closeJump
+  ) where
+
+import           Control.Concurrent
+import           Control.Exception
+import           Control.Monad.Except
+
+import           Foreign.C.String
+
+import           Network.SSH.Client.SimpleSSH.Foreign
+import           Network.SSH.Client.SimpleSSH.Internal
+import           Network.SSH.Client.SimpleSSH.Types
+
+-- | Listen locally and have the server connect to a host for each
+-- connection accepted (@ssh -L@).
+openLocalForward :: Session -- ^ Authenticated session
+                 -> String  -- ^ Local address to listen on
+                 -> Int     -- ^ Local port, 0 to pick a free one
+                 -> String  -- ^ Host to connect to, as seen from the server
+                 -> Int     -- ^ Port to connect to
+                 -> SimpleSSH Forward
+openLocalForward session listenHost listenPort host port = liftIOEither $
+  withCString listenHost $ \listenHostC -> withCString host $ \hostC ->
+    liftEitherC (return . Forward) $
+      forwardLocalC session listenHostC (fromIntegral listenPort)
+                    hostC (fromIntegral port)
+
+-- | Have the server listen and connect to a local host for each connection
+-- it accepts (@ssh -R@).
+openRemoteForward :: Session -- ^ Authenticated session
+                  -> String  -- ^ Address for the server to listen on
+                  -> Int     -- ^ Port on the server, 0 to let it pick one
+                  -> String  -- ^ Local host to connect to
+                  -> Int     -- ^ Local port to connect to
+                  -> SimpleSSH Forward
+openRemoteForward session bindHost bindPort host port = liftIOEither $
+  withCString bindHost $ \bindHostC -> withCString host $ \hostC ->
+    liftEitherC (return . Forward) $
+      forwardRemoteC session bindHostC (fromIntegral bindPort)
+                     hostC (fromIntegral port)
+
+-- | The port listened on, useful when 0 was asked for.
+forwardPort :: Forward -> SimpleSSH Int
+forwardPort forward = lift $ fromIntegral <$> forwardPortC forward
+
+-- | Number of connections currently relayed.
+forwardConnections :: Forward -> SimpleSSH Int
+forwardConnections forward = lift $ fromIntegral <$> forwardCountC forward
+
+-- | Relay the connections until 'stopForward' is called from another thread.
+--
+-- Fails if the session dies, the forwarded connections being lost.
+runForward :: Forward -> SimpleSSH ()
+runForward forward = liftIOEither $ liftStatusC $ forwardRunC forward
+
+-- | Make 'runForward' return.
+stopForward :: Forward -> SimpleSSH ()
+stopForward = lift . forwardStopC
+
+-- | Close the forwarded connections and stop listening.
+closeForward :: Forward -> SimpleSSH ()
+closeForward = lift . forwardFreeC
+
+-- | Run a forward in the background while the action is executed, the
+-- action being given the port listened on.
+withForward :: SimpleSSH Forward -> (Int -> SimpleSSH a) -> SimpleSSH a
+withForward open action = do
+  forward <- open
+  port    <- forwardPort forward
+
+  ExceptT $ mask $ \restore -> do
+    done <- newEmptyMVar
+    _    <- forkIO $ liftStatusC (forwardRunC forward) >>= putMVar done
+
+    let finish = do
+          forwardStopC forward
+          relay <- takeMVar done
+          forwardFreeC forward
+          return relay
+
+    res   <- restore (runExceptT (action port)) `onException` finish
+    relay <- finish
+    return $ res <* relay
+
+-- | Forward a local port to a host reachable from the server while executing
+-- some action.
+withLocalForward :: Session                -- ^ Authenticated session
+                 -> String                 -- ^ Local address to listen on
+                 -> Int                    -- ^ Local port, 0 for any
+                 -> String                 -- ^ Host seen from the server
+                 -> Int                    -- ^ Port on that host
+                 -> (Int -> SimpleSSH a)   -- ^ Action given the local port
+                 -> SimpleSSH a
+withLocalForward session listenHost listenPort host port =
+  withForward $ openLocalForward session listenHost listenPort host port
+
+-- | Forward a port of the server to a local host while executing some
+-- action.
+withRemoteForward :: Session              -- ^ Authenticated session
+                  -> String               -- ^ Address on the server
+                  -> Int                  -- ^ Port on the server, 0 for any
+                  -> String               -- ^ Local host
+                  -> Int                  -- ^ Port on the local host
+                  -> (Int -> SimpleSSH a) -- ^ Action given the port of the
+                                          -- server
+                  -> SimpleSSH a
+withRemoteForward session bindHost bindPort host port =
+  withForward $ openRemoteForward session bindHost bindPort host port
+
+-- | Relay the sessions of the hosts behind a bastion (@ssh -J@). Sessions
+-- opened with 'sessionJump' set to the returned 'Jump' connect through a
+-- direct-tcpip channel of the bastion, all of them sharing its connection.
+--
+-- A thread started in C relays the channels and owns the bastion session,
+-- which must not be used otherwise until 'closeJump'.
+openJump :: Session -- ^ Session authenticated on the bastion
+         -> SimpleSSH Jump
+openJump bastion = liftIOEither $ liftEitherC (return . Jump) $ jumpNewC bastion
+
+-- | Stop relaying, which closes the sessions going through the bastion. The
+-- bastion session itself stays open.
+closeJump :: Jump -> SimpleSSH ()
+closeJump = lift . jumpFreeC
+
+-- | Open a jump, execute some action and close the jump.
+withJump :: Session                -- ^ Session authenticated on the bastion
+         -> (Jump -> SimpleSSH a)  -- ^ Action, typically opening sessions
+                                   -- with 'sessionJump' set
+         -> SimpleSSH a
+withJump bastion action = do
+  jump <- openJump bastion
+  ExceptT $ runExceptT (action jump) `finally` jumpFreeC jump
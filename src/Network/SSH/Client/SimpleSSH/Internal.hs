@@ -0,0 +1,121 @@
+module Network.SSH.Client.SimpleSSH.Internal
+  ( liftIOEither
+  , liftEitherCFree
+  , liftEitherC
+  , liftStatusC
+  , stepLoop
+  , waitSocket
+  ) where
+
+import           Control.Concurrent
+import           Control.Exception
+import           Control.Monad.Except
+
+import           Data.Bits ((.&.))
+
+import           Foreign.C.Types
+import           Foreign.Marshal.Alloc
+import           Foreign.Ptr
+import           Foreign.Storable
+
+import           GHC.Conc (atomically, orElse)
+
+import           Network.SSH.Client.SimpleSSH.Foreign
+import           Network.SSH.Client.SimpleSSH.Types
+
+import           System.Posix.Types (Fd(..))
+import           System.Timeout (timeout)
+
+-- | Helper which lifts IO actions into 'SimpleSSH'. This is used all over the
+-- place.
+liftIOEither :: IO (Either SimpleSSHError a) -> SimpleSSH a
+liftIOEither ioAction = do
+  eRes <- liftIO ioAction
+  case eRes of
+    Left err  -> throwError err
+    Right res -> return res
+
+-- | Helper which interprets a result coming from C.
+--
+-- Functions in the C part return pointers to a structure mimicking 'Either'.
+liftEitherCFree :: (CEither -> IO ()) -- ^ A custom function to free the CEither
+                -> (Ptr () -> IO a)   -- ^ A function to transform the pointer
+                                      -- contained in the C structure
+                -> IO CEither         -- ^ An action returning the structure,
+                                      -- typically a call to C
+                -> IO (Either SimpleSSHError a)
+liftEitherCFree customFree builder action = do
+  eitherC <- action
+  res <- alloca $ \valuePtr -> do
+    rc <- eitherUnwrapC eitherC valuePtr
+    if rc == 0
+      then Right <$> (builder =<< peek valuePtr)
+      else return $ Left $ readError rc
+  customFree eitherC
+  return res
+
+-- | Version of 'liftEitherCFree' using the normal 'free'.
+liftEitherC :: (Ptr () -> IO a) -> IO CEither -> IO (Either SimpleSSHError a)
+liftEitherC = liftEitherCFree free
+
+-- | Helper which interprets a status code coming from C, 0 meaning success.
+liftStatusC :: IO CInt -> IO (Either SimpleSSHError ())
+liftStatusC action = do
+  rc <- action
+  return $ if rc == 0 then Right () else Left $ readError rc
+
+-- | Call a nonblocking step from C until it is done, waiting on the socket of
+-- the session in between.
+--
+-- Only the IO manager waits, so that no OS thread is held while the server
+-- is busy.
+stepLoop :: Session -> IO CInt -> IO (Either SimpleSSHError ())
+stepLoop session step = loop
+  where
+    loop = do
+      rc <- step
+      case rc of
+        0 -> return $ Right ()
+        _ | rc == eagainC -> do
+              ready <- waitSocket session
+              if ready then loop else return $ Left Timeout
+          | otherwise -> return $ Left $ readError rc
+
+-- | Wait until the socket of a session is ready in the directions libssh2 is
+-- blocked on. Returns 'False' if the timeout of the session expires first.
+--
+-- Keepalives are sent while waiting and, as in C, the wait gives up once too
+-- many of them went by without the socket getting ready.
+waitSocket :: Session -> IO Bool
+waitSocket session = do
+  fd        <- Fd <$> getSocketC session
+  dir       <- blockDirectionsC session
+  timeoutMs <- fromIntegral <$> getTimeoutC session
+  countMax  <- fromIntegral <$> getKeepaliveCountMaxC session
+
+  let inbound  = dir .&. blockInboundC /= 0 || dir .&. blockOutboundC == 0
+      outbound = dir .&. blockOutboundC /= 0
+
+      wait = do
+        waits <- sequence $ [threadWaitReadSTM fd  | inbound]
+                         ++ [threadWaitWriteSTM fd | outbound]
+        atomically (foldr1 orElse (map fst waits)) `finally` mapM_ snd waits
+
+      loop :: Int -> Int -> IO Bool
+      loop remaining unanswered = do
+        next <- fromIntegral <$> keepaliveTickC session
+        let slice | next > 0 && (remaining < 0 || next < remaining) = next
+                  | otherwise = remaining
+        ready <- if next < 0 then return Nothing
+                             else timeout (slice * 1000) wait
+        case ready of
+          Just () -> return True
+          Nothing
+            | next < 0 || slice == remaining -> return False
+            | countMax > 0 && unanswered >= countMax -> return False
+            | otherwise -> loop (if remaining > 0 then remaining - slice
+                                                  else remaining)
+                                (unanswered + 1)
+
+  statsWaitBeginC session
+  loop timeoutMs 0 `finally` statsWaitEndC session
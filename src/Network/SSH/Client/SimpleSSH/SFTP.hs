@@ -0,0 +1,440 @@
+{-# LANGUAGE OverloadedStrings #-}
+
+-- | File transfers and file management through the SFTP subsystem.
+--
+-- Unlike SCP, transfers keep several requests in flight, see 'setWindow'.
+module Network.SSH.Client.SimpleSSH.SFTP
+  ( -- * Data types
+    SFTP
+  , Attributes(..)
+  , SyncCompare(..)
+  , SyncOptions(..)
+  , defaultSyncOptions
+  , SyncResult(..)
+  -- * Main functions
+  , withSFTP
+  , setWindow
+  , stat
+  , readDirectory
+  , makeDirectory
+  , rename
+  , unlink
+  , upload
+  , download
+  , syncFile
+  , syncDirectory
+  -- * Lower-level functions
+  , openSFTP
+  , closeSFTP
+  ) where
+
+import           Control.Exception
+import           Control.Monad.Except
+
+import           Data.Bits ((.&.))
+import qualified Data.ByteString.Char8 as BS
+import           Data.Char (intToDigit, isHexDigit, ord)
+import           Data.List (partition)
+
+import           Foreign.C.String
+import           Foreign.Marshal.Alloc
+import           Foreign.Marshal.Array
+import           Foreign.Ptr
+import           Foreign.Storable
+
+import           Network.SSH.Client.SimpleSSH (execCommandsBytesWith)
+import           Network.SSH.Client.SimpleSSH.Foreign
+import           Network.SSH.Client.SimpleSSH.Internal
+import           Network.SSH.Client.SimpleSSH.Types
+
+-- | Attributes of a remote file.
+data Attributes = Attributes
+  { attrSize             :: Integer
+  , attrPermissions      :: Integer -- ^ Including the file type bits
+  , attrUid              :: Integer
+  , attrGid              :: Integer
+  , attrAccessTime       :: Integer -- ^ In seconds since the epoch
+  , attrModificationTime :: Integer -- ^ In seconds since the epoch
+  } deriving (Show, Eq)
+
+readAttributes :: CAttributes -> IO Attributes
+readAttributes attributesC =
+  alloca $ \sizePtr -> allocaArray 5 $ \fieldsPtr -> do
+    sftpGetAttributesC attributesC sizePtr
+                       fieldsPtr (advancePtr fieldsPtr 1)
+                       (advancePtr fieldsPtr 2) (advancePtr fieldsPtr 3)
+                       (advancePtr fieldsPtr 4)
+    size <- peek sizePtr
+    [permissions, uid, gid, atime, mtime] <-
+      map toInteger <$> peekArray 5 fieldsPtr
+    return $ Attributes (toInteger size) permissions uid gid atime mtime
+
+-- | How 'syncFile' decides that a remote file is up to date.
+data SyncCompare
+  = CompareMetadata -- ^ Same size and modification time, the time being
+                    -- set by the sync which wrote the file
+  | CompareChecksum -- ^ Same size and SHA-256, computed with @sha256sum@ on
+                    -- the server
+  deriving (Show, Eq)
+
+data SyncOptions = SyncOptions
+  { syncCompare   :: SyncCompare
+  , syncBlockSize :: Int -- ^ Size of the blocks compared to only send those
+                         -- which differ, 0 to send changed files whole
+  , syncChannels  :: Int -- ^ Maximum number of digest commands running at
+                         -- the same time, 0 meaning no limit
+  } deriving (Show, Eq)
+
+defaultSyncOptions :: SyncOptions
+defaultSyncOptions = SyncOptions
+  { syncCompare   = CompareMetadata
+  , syncBlockSize = 1024 * 1024
+  , syncChannels  = 10
+  }
+
+data SyncResult = SyncResult
+  { syncFiles   :: Int     -- ^ Local files compared
+  , syncUpdated :: Int     -- ^ Remote files written to
+  , syncBytes   :: Integer -- ^ Size of these files
+  , syncSent    :: Integer -- ^ Bytes actually sent
+  } deriving (Show, Eq)
+
+readEntries :: CEntries -> IO [(BS.ByteString, Attributes)]
+readEntries entriesC = do
+  count <- sftpEntriesCountC entriesC
+  forM [0 .. count - 1] $ \i ->
+    (,) <$> (BS.packCString =<< sftpEntryNameC entriesC i)
+        <*> (readAttributes =<< sftpEntryAttributesC entriesC i)
+
+readCount :: CCount -> IO Integer
+readCount countC = toInteger <$> getCountC countC
+
+-- | Start the SFTP subsystem on an authenticated session.
+openSFTP :: Session -> SimpleSSH SFTP
+openSFTP session = liftIOEither $ liftEitherC (return . SFTP) $ sftpOpenC session
+
+-- | Shut the SFTP subsystem down.
+closeSFTP :: SFTP -> SimpleSSH ()
+closeSFTP = lift . sftpCloseC
+
+-- | Start the SFTP subsystem, execute some action and shut it down.
+withSFTP :: Session               -- ^ Authenticated session
+         -> (SFTP -> SimpleSSH a) -- ^ Monadic action using SFTP
+         -> SimpleSSH a
+withSFTP session action = do
+  sftp <- openSFTP session
+  ExceptT $ runExceptT (action sftp) `finally` sftpCloseC sftp
+
+-- | Set how many read or write requests of about 30 KB transfers keep in
+-- flight, 16 by default.
+--
+-- The throughput of a transfer is bounded by window * 30 KB / RTT, so the
+-- window should cover the bandwidth-delay product of the link.
+setWindow :: SFTP -> Int -> SimpleSSH ()
+setWindow sftp window = lift $ sftpSetWindowC sftp (fromIntegral window)
+
+-- | Get the attributes of a remote file, following symbolic links.
+stat :: SFTP -> String -> SimpleSSH Attributes
+stat sftp path = liftIOEither $ withCString path $ \pathC ->
+  liftEitherCFree freeEitherAttributesC readAttributes $ sftpStatC sftp pathC
+
+-- | List a remote directory, without "." and "..".
+readDirectory :: SFTP -> String -> SimpleSSH [(BS.ByteString, Attributes)]
+readDirectory sftp path = liftIOEither $ withCString path $ \pathC ->
+  liftEitherCFree freeEitherEntriesC readEntries $ sftpReadDirC sftp pathC
+
+-- | Create a remote directory.
+makeDirectory :: SFTP    -- ^ SFTP to use
+              -> Integer -- ^ Mode (e.g. 0o755, note the octal notation)
+              -> String  -- ^ Remote path
+              -> SimpleSSH ()
+makeDirectory sftp mode path = liftIOEither $ withCString path $ \pathC ->
+  liftStatusC $ sftpMkdirC sftp pathC (fromInteger mode)
+
+-- | Rename a remote file.
+rename :: SFTP   -- ^ SFTP to use
+       -> String -- ^ Old path
+       -> String -- ^ New path
+       -> SimpleSSH ()
+rename sftp source target = liftIOEither $
+  withCString source $ \sourceC -> withCString target $ \targetC ->
+    liftStatusC $ sftpRenameC sftp sourceC targetC
+
+-- | Remove a remote file.
+unlink :: SFTP -> String -> SimpleSSH ()
+unlink sftp path = liftIOEither $ withCString path $ \pathC ->
+  liftStatusC $ sftpUnlinkC sftp pathC
+
+-- | Send a local file and returns the number of bytes transferred.
+upload :: SFTP     -- ^ SFTP to use
+       -> Integer  -- ^ File mode (e.g. 0o644, note the octal notation)
+       -> FilePath -- ^ Local path
+       -> String   -- ^ Remote path
+       -> SimpleSSH Integer
+upload sftp mode source target = liftIOEither $
+  withCString source $ \sourceC -> withCString target $ \targetC ->
+    liftEitherCFree freeEitherCountC readCount $
+      sftpUploadC sftp (fromInteger mode) sourceC targetC
+
+-- | Receive a remote file and returns the number of bytes transferred.
+download :: SFTP     -- ^ SFTP to use
+         -> String   -- ^ Remote path
+         -> FilePath -- ^ Local path
+         -> SimpleSSH Integer
+download sftp source target = liftIOEither $
+  withCString source $ \sourceC -> withCString target $ \targetC ->
+    liftEitherCFree freeEitherCountC readCount $
+      sftpDownloadC sftp sourceC targetC
+
+-- | Bring a remote file up to date with a local one and tell what was sent.
+--
+-- Nothing is sent when the remote file compares equal, see 'SyncCompare'.
+-- Otherwise, when the remote file is not empty, the blocks of both files
+-- are digested, remotely with @split@ and @sha256sum@, and only the blocks
+-- which differ are written in place. A transfer which was interrupted thus
+-- resumes where it stopped, the blocks already sent being found equal. The
+-- remote file finally gets the size, mode and times of the local one.
+--
+-- Blocks are compared at the same offsets, so data inserted in the middle
+-- of a file makes the rest of it be sent again. Servers without the GNU
+-- @split@ fall back to @dd@, and those without @sha256sum@ get the changed
+-- files whole.
+syncFile :: SFTP        -- ^ SFTP to use
+         -> SyncOptions -- ^ How to compare the files
+         -> FilePath    -- ^ Local path
+         -> String      -- ^ Remote path
+         -> SimpleSSH SyncResult
+syncFile sftp options source target = do
+  sourceRaw <- lift $ encodePath source
+  targetRaw <- lift $ encodePath target
+  local     <- localStat sourceRaw
+  remote    <- remoteStat sftp targetRaw
+  syncBatch sftp options [SyncFile sourceRaw targetRaw local remote]
+
+-- | Bring a remote directory up to date with a local one, recursively, as
+-- 'syncFile' does for each regular file. Missing directories are created
+-- and remote files missing locally are left alone.
+--
+-- The remote digests of the files of a directory are computed concurrently,
+-- each command running on its own channel, see 'syncChannels'.
+syncDirectory :: SFTP        -- ^ SFTP to use
+              -> SyncOptions -- ^ How to compare the files
+              -> FilePath    -- ^ Local directory
+              -> String      -- ^ Remote directory
+              -> SimpleSSH SyncResult
+syncDirectory sftp options source target = do
+  sourceRaw <- lift $ encodePath source
+  targetRaw <- lift $ encodePath target
+  syncTree sftp options sourceRaw targetRaw
+
+-- | Paths as handed to C, encoded once so that the names read from
+-- directories can be appended to them as they are.
+type RawPath = BS.ByteString
+
+encodePath :: String -> IO RawPath
+encodePath path = withCString path BS.packCString
+
+joinPath :: RawPath -> RawPath -> RawPath
+joinPath dir name
+  | BS.null dir || BS.last dir == '/' = BS.append dir name
+  | otherwise = BS.concat [dir, "/", name]
+
+-- | A local file to bring up to date.
+data SyncFile = SyncFile
+  { fileSource :: RawPath
+  , fileTarget :: RawPath
+  , fileLocal  :: Attributes
+  , fileRemote :: Maybe Attributes -- ^ Nothing if it does not exist
+  }
+
+emptyResult :: SyncResult
+emptyResult = SyncResult 0 0 0 0
+
+addResults :: SyncResult -> SyncResult -> SyncResult
+addResults a b = SyncResult
+  { syncFiles   = syncFiles a   + syncFiles b
+  , syncUpdated = syncUpdated a + syncUpdated b
+  , syncBytes   = syncBytes a   + syncBytes b
+  , syncSent    = syncSent a    + syncSent b
+  }
+
+isRegular, isDirectory :: Attributes -> Bool
+isRegular attributes   = attrPermissions attributes .&. 0o170000 == 0o100000
+isDirectory attributes = attrPermissions attributes .&. 0o170000 == 0o040000
+
+localStat :: RawPath -> SimpleSSH Attributes
+localStat path = liftIOEither $ BS.useAsCString path $ \pathC ->
+  liftEitherCFree freeEitherAttributesC readAttributes $ localStatC pathC
+
+-- | The attributes of a remote file, Nothing if it cannot be stat'ed.
+remoteStat :: SFTP -> RawPath -> SimpleSSH (Maybe Attributes)
+remoteStat sftp path = do
+  res <- lift $ BS.useAsCString path $ \pathC ->
+    liftEitherCFree freeEitherAttributesC readAttributes $ sftpStatC sftp pathC
+  case res of
+    Right attributes -> return $ Just attributes
+    Left Sftp        -> return Nothing
+    Left err         -> throwError err
+
+syncTree :: SFTP -> SyncOptions -> RawPath -> RawPath -> SimpleSSH SyncResult
+syncTree sftp options source target = do
+  local  <- liftIOEither $ BS.useAsCString source $ \sourceC ->
+    liftEitherCFree freeEitherEntriesC readEntries $ localReadDirC sourceC
+  remote <- remoteStat sftp target
+  remoteEntries <- liftIOEither $ BS.useAsCString target $ \targetC ->
+    case remote of
+      Just _ ->
+        liftEitherCFree freeEitherEntriesC readEntries $ sftpReadDirC sftp targetC
+      Nothing -> do
+        mode <- either (const 0o755) attrPermissions <$>
+          BS.useAsCString source (liftEitherCFree freeEitherAttributesC
+                                                  readAttributes . localStatC)
+        fmap (const []) <$>
+          liftStatusC (sftpMkdirC sftp targetC (fromInteger (mode .&. 0o777)))
+
+  let files = [ SyncFile (joinPath source name) (joinPath target name)
+                         attributes (lookup name remoteEntries)
+              | (name, attributes) <- local, isRegular attributes ]
+      dirs  = [ name | (name, attributes) <- local, isDirectory attributes ]
+
+  res <- syncBatch sftp options files
+  foldM (\acc name -> addResults acc <$>
+                        syncTree sftp options (joinPath source name)
+                                              (joinPath target name))
+        res dirs
+
+-- | Sync files, the remote digests of all of them being computed by a
+-- single batch of commands.
+syncBatch :: SFTP -> SyncOptions -> [SyncFile] -> SimpleSSH SyncResult
+syncBatch _ _ [] = return emptyResult
+syncBatch sftp options files = do
+  session <- lift $ sftpSessionC sftp
+
+  stale <- case syncCompare options of
+    CompareMetadata -> return $ filter (not . sameMetadata) files
+    CompareChecksum -> do
+      let (sized, resized) = partition sameSize files
+      remote <- remoteDigests session channels $
+        map (\file -> BS.append "sha256sum -- " (quote (fileTarget file))) sized
+      local  <- mapM (\file -> localDigests (fileSource file) 0 1) sized
+      return $ resized ++ [ file | (file, r, l) <- zip3 sized remote local
+                                 , r /= Just l ]
+
+  let blockSize = syncBlockSize options
+      deltas    = filter (delta blockSize) stale
+  remoteBlocks <- remoteDigests session channels $
+    map (blocksCommand blockSize) deltas
+
+  let blocksOf file = do
+        remote  <- fileRemote file
+        digests <- join $ lookup (fileTarget file) $
+                     zip (map fileTarget deltas) remoteBlocks
+        if length digests == blockCount blockSize (attrSize remote)
+          then Just digests
+          else Nothing
+
+  sent <- forM stale $ \file -> case blocksOf file of
+    Nothing -> sendBlocks sftp file 0 Nothing
+    Just remote -> do
+      let count = blockCount blockSize $ attrSize $ fileLocal file
+      local <- localDigests (fileSource file) blockSize count
+      sendBlocks sftp file blockSize $ Just $
+        zipWith (/=) (map Just local) (map Just remote ++ repeat Nothing)
+
+  return SyncResult
+    { syncFiles   = length files
+    , syncUpdated = length stale
+    , syncBytes   = sum $ map (attrSize . fileLocal) stale
+    , syncSent    = sum sent
+    }
+  where
+    channels = syncChannels options
+
+    sameSize file = fmap attrSize (fileRemote file)
+                 == Just (attrSize (fileLocal file))
+
+    sameMetadata file = sameSize file &&
+      fmap attrModificationTime (fileRemote file)
+        == Just (attrModificationTime (fileLocal file))
+
+    delta blockSize file = blockSize > 0 &&
+      maybe False (\remote -> attrSize remote > 0 && isRegular remote)
+            (fileRemote file)
+
+blockCount :: Int -> Integer -> Int
+blockCount blockSize size =
+  fromInteger $ (size + toInteger blockSize - 1) `div` toInteger blockSize
+
+-- | Digest the blocks of a remote file, one line per block. @split@ is only
+-- able to run a filter in its GNU version, @dd@ being tried otherwise.
+blocksCommand :: Int -> SyncFile -> BS.ByteString
+blocksCommand blockSize file = BS.concat
+  [ "split -b ", size, " --filter=sha256sum -- ", path, " 2>/dev/null || "
+  , "{ i=0; while [ $i -lt ", count, " ]; do dd if=", path, " bs=", size
+  , " skip=$i count=1 2>/dev/null | sha256sum; i=$((i+1)); done; }"
+  ]
+  where
+    size  = BS.pack $ show blockSize
+    count = BS.pack $ show $ maybe 0 (blockCount blockSize . attrSize)
+                                    (fileRemote file)
+    path  = quote $ fileTarget file
+
+-- | Quote a path for the shell of the server.
+quote :: RawPath -> BS.ByteString
+quote path = BS.concat ["'", BS.intercalate "'\\''" (BS.split '\'' path), "'"]
+
+-- | The digests printed by each command, in hexadecimal, Nothing for the
+-- commands which failed.
+remoteDigests :: Session -> Int -> [BS.ByteString]
+              -> SimpleSSH [Maybe [BS.ByteString]]
+remoteDigests _ _ [] = return []
+remoteDigests session channels commands =
+  map digests <$> execCommandsBytesWith channels session commands
+  where
+    digests result
+      | resultExit result == ExitSuccess =
+          mapM digest $ BS.lines $ resultOut result
+      | otherwise = Nothing
+
+    -- sha256sum starts the line with a backslash for names it escapes
+    digest line =
+      let hex = BS.take 64 $ BS.dropWhile (== '\\') line
+      in if BS.length hex == 64 && BS.all isHexDigit hex then Just hex
+                                                          else Nothing
+
+-- | The digests of the `count` blocks of a local file, in hexadecimal, fewer
+-- if the file got shorter since it was stat'ed.
+localDigests :: RawPath -> Int -> Int -> SimpleSSH [BS.ByteString]
+localDigests path blockSize count = liftIOEither $
+  BS.useAsCString path $ \pathC ->
+  allocaBytes (count * digestSize) $ \digestsC -> alloca $ \writtenPtr -> do
+    res <- liftStatusC $ syncDigestsC pathC (fromIntegral blockSize)
+                                      (fromIntegral count) digestsC writtenPtr
+    written <- fromIntegral <$> peek writtenPtr
+    digests <- BS.packCStringLen (digestsC, written * digestSize)
+    return $ chunks digests <$ res
+  where
+    digestSize = fromIntegral sha256SizeC
+
+    chunks digests
+      | BS.null digests = []
+      | otherwise = let (digest, rest) = BS.splitAt digestSize digests
+                    in hex digest : chunks rest
+
+    hex = BS.pack . concatMap (\c -> [ intToDigit (ord c `div` 16)
+                                     , intToDigit (ord c `mod` 16) ])
+                . BS.unpack
+
+-- | Write the flagged blocks of a file, all of it for Nothing, and return
+-- the number of bytes sent.
+sendBlocks :: SFTP -> SyncFile -> Int -> Maybe [Bool] -> SimpleSSH Integer
+sendBlocks sftp file blockSize changed = liftIOEither $
+  BS.useAsCString (fileSource file) $ \sourceC ->
+  BS.useAsCString (fileTarget file) $ \targetC -> do
+    let send changedC count = liftEitherCFree freeEitherCountC readCount $
+          sftpSyncBlocksC sftp sourceC targetC (fromIntegral blockSize)
+                          changedC count
+    case changed of
+      Nothing    -> send nullPtr 0
+      Just flags -> withArrayLen (map (\flag -> if flag then 1 else 0) flags) $
+        \count changedC -> send changedC (fromIntegral count)
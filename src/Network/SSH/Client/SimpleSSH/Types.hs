@@ -1,6 +1,28 @@
 module Network.SSH.Client.SimpleSSH.Types
   ( Result(..)
   , ResultExit(..)
+  , ExecOptions(..)
+  , OutputLimit(..)
+  , defaultExecOptions
+  , Job(..)
+  , TransferOptions(..)
+  , defaultTransferOptions
+  , SessionOptions(..)
+  , defaultSessionOptions
+  , SocketOptions(..)
+  , defaultSocketOptions
+  , interactiveSocketOptions
+  , bulkSocketOptions
+  , HostSpec(..)
+  , HostAuth(..)
+  , Concurrency(..)
+  , defaultConcurrency
+  , ConnectTiming(..)
+  , Methods(..)
+  , Stats(..)
+  , ExecStats(..)
+  , TraceKind(..)
+  , TraceEvent(..)
   , SimpleSSH
   , SimpleSSHError(..)
   , runSimpleSSH
@@ -10,9 +32,13 @@ module Network.SSH.Client.SimpleSSH.Types
 import           Control.Monad.Except
 
 import qualified Data.ByteString.Char8 as BS
+import           Data.IORef
 
+import           Foreign.C.String
 import           Foreign.C.Types
 
+import           Network.SSH.Client.SimpleSSH.Foreign (CExec, Jump, Key, Session)
+
 -- | Exit code or signal of a process.
 data ResultExit
   = ExitSuccess
@@ -22,9 +48,270 @@ data ResultExit
 
 -- | The result of a command execution.
 data Result = Result
-  { resultOut  :: BS.ByteString -- ^ The process' stdout
-  , resultErr  :: BS.ByteString -- ^ The process' stderr
-  , resultExit :: ResultExit    -- ^ The process' exit code or signal
+  { resultOut        :: BS.ByteString   -- ^ The process' stdout
+  , resultErr        :: BS.ByteString   -- ^ The process' stderr
+  , resultExit       :: ResultExit      -- ^ The process' exit code or signal
+  , resultOutDropped :: Integer         -- ^ Bytes of stdout left out because
+                                        -- of 'execStdoutLimit'
+  , resultErrDropped :: Integer         -- ^ Same for stderr
+  , resultStats      :: Maybe ExecStats -- ^ When the session is measured,
+                                        -- see 'sessionStats'
+  } deriving (Show, Eq)
+
+-- | Measurements of a command. Timestamps are in microseconds on the
+-- monotonic clock, comparable with those of 'Stats'.
+data ExecStats = ExecStats
+  { execStatsStarted  :: Integer -- ^ First attempt to open the channel
+  , execStatsOpened   :: Integer -- ^ Channel open
+  , execStatsExecuted :: Integer -- ^ Command accepted by the server
+  , execStatsDrained  :: Integer -- ^ End of the output
+  , execStatsClosed   :: Integer -- ^ Channel closed
+  , execStatsWaits    :: Integer -- ^ Waits on the socket of the session
+                                 -- while the command ran, shared with the
+                                 -- commands running at the same time
+  , execStatsBlocked  :: Integer -- ^ Time spent in these waits, in
+                                 -- microseconds
+  } deriving (Show, Eq)
+
+-- | Options for the execution of a command.
+data ExecOptions = ExecOptions
+  { execSizeHint    :: Int -- ^ Expected size of stdout in bytes, 0 if
+                           -- unknown. The buffer is allocated upfront so
+                           -- that an output of this size is read without
+                           -- any reallocation.
+  , execStdoutLimit :: OutputLimit
+  , execStderrLimit :: OutputLimit
+  } deriving (Show, Eq)
+
+-- | A command left running on the server, see 'startCommand'.
+data Job = Job
+  { jobSession :: Session
+  , jobExec    :: CExec
+  , jobCommand :: CString -- ^ Referenced by the exec until it is freed
+  , jobOutcome :: IORef (Maybe (Either SimpleSSHError Result))
+    -- ^ Set once the command is done, the exec being freed then
+  }
+
+-- | Bound on what is kept of an output stream. The rest is still read, so
+-- that the command is not blocked, but dropped.
+data OutputLimit
+  = NoLimit
+  | KeepHead Int -- ^ Keep the first bytes
+  | KeepTail Int -- ^ Keep the last bytes, e.g. for the end of a log
+  deriving (Show, Eq)
+
+defaultExecOptions :: ExecOptions
+defaultExecOptions = ExecOptions
+  { execSizeHint    = 0
+  , execStdoutLimit = NoLimit
+  , execStderrLimit = NoLimit
+  }
+
+-- | Sizes used by the transfers of a session.
+data TransferOptions = TransferOptions
+  { transferChunkSize  :: Int -- ^ Size of the writes of SCP uploads
+  , transferWindowSize :: Int -- ^ Window of the channels receiving data,
+                              -- i.e. commands and SCP downloads
+  , transferPacketSize :: Int -- ^ Maximum packet size of the channels opened
+                              -- for commands
+  } deriving (Show, Eq)
+
+-- | The defaults of libssh2, with 16 KB writes.
+defaultTransferOptions :: TransferOptions
+defaultTransferOptions = TransferOptions
+  { transferChunkSize  = 16 * 1024
+  , transferWindowSize = 2 * 1024 * 1024
+  , transferPacketSize = 32768
+  }
+
+-- | Options used when opening a session.
+data SessionOptions = SessionOptions
+  { sessionSocket            :: SocketOptions
+  , sessionKeepAlive         :: Int -- ^ Interval in seconds between SSH
+                                    -- keepalives sent while waiting on the
+                                    -- server, 0 for none
+  , sessionKeepAliveCountMax :: Int -- ^ Keepalives going by without any
+                                    -- answer before the connection is
+                                    -- considered dead, 0 for no limit
+  , sessionKnownHosts        :: Maybe FilePath -- ^ known_hosts file the
+                                               -- host key must be found in
+  , sessionAcceptNewHosts    :: Bool -- ^ Accept the hosts missing from
+                                     -- 'sessionKnownHosts', changed or
+                                     -- revoked keys being still rejected
+  , sessionKex               :: [String] -- ^ Key exchange algorithms in
+                                         -- order of preference, e.g.
+                                         -- "curve25519-sha256", none for
+                                         -- the defaults of libssh2
+  , sessionHostKeys          :: [String] -- ^ Host key algorithms
+  , sessionCiphers           :: [String] -- ^ Ciphers, e.g.
+                                         -- "aes128-gcm@openssh.com"
+  , sessionMacs              :: [String] -- ^ MACs, unused by AEAD ciphers
+  , sessionCompression       :: Bool -- ^ zlib compression, worth it for
+                                     -- text over slow links
+  , sessionStats             :: Bool -- ^ Measure the session and its
+                                     -- commands, see 'getStats'
+  , sessionJump              :: Maybe Jump -- ^ Bastion to connect through,
+                                           -- see 'openJump'
+  , sessionTrace             :: Int -- ^ Events kept of the recent history
+                                    -- of the session, 0 for no tracing, see
+                                    -- 'getTrace'
+  , sessionTraceSample       :: Int -- ^ Only trace one session in that
+                                    -- many, to leave tracing on in
+                                    -- production
+  , sessionTraceLibssh2      :: Bool -- ^ Also record the messages of
+                                     -- libssh2, when it is built with
+                                     -- debugging
+  } deriving (Show, Eq)
+
+-- | No keepalives, no host key check, the algorithms of libssh2 and no
+-- compression.
+defaultSessionOptions :: SessionOptions
+defaultSessionOptions = SessionOptions
+  { sessionSocket            = defaultSocketOptions
+  , sessionKeepAlive         = 0
+  , sessionKeepAliveCountMax = 0
+  , sessionKnownHosts        = Nothing
+  , sessionAcceptNewHosts    = False
+  , sessionKex               = []
+  , sessionHostKeys          = []
+  , sessionCiphers           = []
+  , sessionMacs              = []
+  , sessionCompression       = False
+  , sessionStats             = False
+  , sessionJump              = Nothing
+  , sessionTrace             = 0
+  , sessionTraceSample       = 1
+  , sessionTraceLibssh2      = False
+  }
+
+-- | TCP tuning of the socket of a session, 0 meaning the system default.
+data SocketOptions = SocketOptions
+  { socketNoDelay           :: Bool -- ^ Disable Nagle's algorithm
+  , socketSendBuffer        :: Int  -- ^ SO_SNDBUF in bytes
+  , socketReceiveBuffer     :: Int  -- ^ SO_RCVBUF in bytes
+  , socketKeepAlive         :: Int  -- ^ Idle time in seconds before TCP
+                                    -- keepalive probes, 0 for none
+  , socketKeepAliveInterval :: Int  -- ^ Time in seconds between probes
+  , socketUserTimeout       :: Int  -- ^ Time in milliseconds unacknowledged
+                                    -- data may stay in flight before the
+                                    -- connection is dropped (Linux only)
+  } deriving (Show, Eq)
+
+-- | The system defaults.
+defaultSocketOptions :: SocketOptions
+defaultSocketOptions = SocketOptions
+  { socketNoDelay           = False
+  , socketSendBuffer        = 0
+  , socketReceiveBuffer     = 0
+  , socketKeepAlive         = 0
+  , socketKeepAliveInterval = 0
+  , socketUserTimeout       = 0
+  }
+
+-- | For short commands, where latency matters more than throughput.
+interactiveSocketOptions :: SocketOptions
+interactiveSocketOptions = defaultSocketOptions { socketNoDelay = True }
+
+-- | For large transfers over links with a high bandwidth-delay product.
+bulkSocketOptions :: SocketOptions
+bulkSocketOptions = defaultSocketOptions
+  { socketSendBuffer    = 4 * 1024 * 1024
+  , socketReceiveBuffer = 4 * 1024 * 1024
+  }
+
+-- | A host to connect to and how to authenticate on it.
+data HostSpec = HostSpec
+  { hostName :: String
+  , hostPort :: Integer
+  , hostUser :: String
+  , hostAuth :: HostAuth
+  } deriving (Show, Eq)
+
+data HostAuth
+  = AuthPassword String
+  | AuthKey FilePath FilePath String -- ^ Paths to the public and private keys
+                                     -- and passphrase
+  | AuthKeyHandle Key -- ^ Key loaded once for all the hosts, see 'loadKey'
+  | AuthAgent         -- ^ Identities of the agent at SSH_AUTH_SOCK
+  deriving (Show, Eq)
+
+-- | Limits of a fan-out over several hosts.
+data Concurrency = Concurrency
+  { concurrencyHosts   :: Int     -- ^ Hosts in progress at the same time, 0
+                                  -- meaning no limit
+  , concurrencyTimeout :: Integer -- ^ Time in seconds given to each host,
+                                  -- from connection to the end of the command
+  } deriving (Show, Eq)
+
+-- | 100 hosts at a time with 30 seconds each.
+defaultConcurrency :: Concurrency
+defaultConcurrency = Concurrency
+  { concurrencyHosts   = 100
+  , concurrencyTimeout = 30
+  }
+
+-- | Time spent establishing the connection of a session.
+data ConnectTiming = ConnectTiming
+  { timingResolve :: Integer -- ^ Name resolution, in microseconds
+  , timingConnect :: Integer -- ^ TCP connection, in microseconds
+  } deriving (Show, Eq)
+
+-- | Measurements of a session. Timestamps are in microseconds on the
+-- monotonic clock, 0 for the phases not reached.
+data Stats = Stats
+  { statsStarted       :: Integer -- ^ Connection requested
+  , statsResolved      :: Integer -- ^ Hostname resolved
+  , statsConnected     :: Integer -- ^ TCP connection established
+  , statsHandshaken    :: Integer -- ^ Handshake and host key check done
+  , statsAuthStarted   :: Integer
+  , statsAuthenticated :: Integer
+  , statsBytesIn       :: Integer -- ^ Bytes read from the socket, encrypted
+  , statsBytesOut      :: Integer -- ^ Bytes written to the socket
+  , statsWaits         :: Integer -- ^ Times the socket had to be waited on
+  , statsBlocked       :: Integer -- ^ Time spent waiting, in microseconds
+  } deriving (Show, Eq)
+
+-- | What a 'TraceEvent' marks.
+data TraceKind
+  = TraceConnect     -- ^ Connection requested, the message being the
+                     -- hostname and the value the port
+  | TraceConnected   -- ^ Connection established or failed
+  | TraceHandshake   -- ^ Handshake and host key check over
+  | TraceAuth        -- ^ Authentication over
+  | TraceChannelOpen -- ^ Channel of a command open
+  | TraceExec        -- ^ Command accepted by the server
+  | TraceEof         -- ^ End of the output of a command
+  | TraceClose       -- ^ Channel closed, the value being the exit code
+  | TraceCancel      -- ^ Channel closed by 'cancelCommand'
+  | TraceWait        -- ^ Wait on the socket, the value being the
+                     -- directions libssh2 is blocked on
+  | TraceWake        -- ^ End of the wait
+  | TraceLibssh2     -- ^ Message of libssh2, see 'sessionTraceLibssh2'
+  | TraceUnknown Int
+  deriving (Show, Eq)
+
+-- | An event in the history of a traced session. For the phases which can
+-- fail, the value is 0 or the error as numbered in C.
+data TraceEvent = TraceEvent
+  { traceTime    :: Integer -- ^ Microseconds on the monotonic clock
+  , traceKind    :: TraceKind
+  , traceSubject :: Integer -- ^ Identifies the command concerned, 0 for the
+                            -- session itself
+  , traceValue   :: Integer
+  , traceMessage :: BS.ByteString
+  } deriving (Show, Eq)
+
+-- | Algorithms negotiated during the handshake, "out" being from the client
+-- to the server and "in" the other way around.
+data Methods = Methods
+  { methodKex            :: String
+  , methodHostKey        :: String
+  , methodCipherOut      :: String
+  , methodCipherIn       :: String
+  , methodMacOut         :: String
+  , methodMacIn          :: String
+  , methodCompressionOut :: String
+  , methodCompressionIn  :: String
   } deriving (Show, Eq)
 
 type SimpleSSH a = ExceptT SimpleSSHError IO a
@@ -45,6 +332,10 @@ data SimpleSSHError
   | Read
   | FileOpen
   | Write
+  | Timeout
+  | SftpInit
+  | Sftp
+  | Cancelled
   | Unknown
   deriving (Show, Eq)
 
@@ -62,4 +353,8 @@ readError errNum = case errNum of
   10 -> Read
   11 -> FileOpen
   12 -> Write
+  13 -> Timeout
+  14 -> SftpInit
+  15 -> Sftp
+  16 -> Cancelled
   _  -> Unknown